@@ -0,0 +1,280 @@
+/***********************************************************
+* Program: aqi.h
+* Purpose: Convert dust concentration to AQI and calculate hourly average
+************************************************************/
+
+#ifndef AQI_H
+#define AQI_H
+
+#include "header.h"
+#include "writer.h"
+#include <cstdint>
+#include <string_view>
+
+/* Structure for storing data from input file */
+struct DataField 
+{
+    int id;
+    string_view time;               /* kept by caller for the whole run (see arena.h) */
+    int value;                      /* 0.1 unit */
+};
+
+/* Structure for handle data of dust concentration conversion */
+struct AQIRange 
+{
+    double value_min;
+    double value_max;
+    int AQI_min;
+    int AQI_max;
+    string level;
+};
+
+#define NUM_LEVELS          7           /* rows of aqiRanges */
+
+/* Dust concentration conversion table */
+vector<AQIRange> aqiRanges = 
+{
+    {0.0, 12.0, 0, 50, "Good"},
+    {12.0, 35.5, 50, 100, "Moderate"},
+    {35.5, 55.5, 100, 150, "Slightly unhealthy"},
+    {55.5, 150.5, 150, 200, "Unhealthy"},
+    {150.5, 250.5, 200, 300, "Very unhealthy"},
+    {250.5, 350.5, 300, 400, "Hazardous"},
+    {350.5, 550.5, 400, 500, "Extremely hazardous"}
+};
+
+/* Convert dust concentration to AQI
+* Inputs: dust concentration
+* Output: AQI */
+int convertPM25toAQI(double value) 
+{
+    double AQI = 0;                 /* value out of every range */
+    for (const AQIRange& range : aqiRanges) 
+    {
+        if (value >= range.value_min && value <= range.value_max) 
+        {
+            AQI = ((range.AQI_max - range.AQI_min) / (range.value_max - range.value_min)) * (value - range.value_min) + range.AQI_min;
+            break;
+        }
+    }
+    return (int)AQI;
+}
+
+/* Convert AQI to pollution level
+* Inputs: AQI
+* Output: pollution level string
+* Pre-condition: */
+string AQItoLevel(int AQI) 
+{
+    string level;
+    for (const AQIRange& range : aqiRanges) {
+        if (AQI >= range.AQI_min && AQI <= range.AQI_max) {
+            level = range.level;
+            break;
+        }
+    }
+    return level;
+}
+
+/* Find row of AQI in aqiRanges, same order as AQItoLevel()
+* Input: AQI
+* Output: row index, -1 if not found */
+int levelIndex(int AQI) 
+{
+    for (int i = 0; i < (int)aqiRanges.size(); i++) 
+    {
+        if (AQI >= aqiRanges[i].AQI_min && AQI <= aqiRanges[i].AQI_max)
+            return i;
+    }
+    return -1;
+}
+
+/* Find row of pollution level in aqiRanges
+* Input: level name
+* Output: row index, -1 if not found */
+int findLevel(const string &level)
+{
+    for (int i = 0; i < (int)aqiRanges.size(); i++)
+    {
+        if (aqiRanges[i].level == level)
+            return i;
+    }
+    return -1;
+}
+
+/* Convert dust concentration with at most one digit after decimal point to 0.1 unit,
+without going through floating point
+* Inputs: number string, result
+* Output: true (if string is valid) or false */
+bool parseDustValue(string_view value_str, int &tenths)
+{
+    size_t pos = 0;
+    bool negative = !value_str.empty() && value_str[0] == '-';
+    if (negative)
+        pos++;
+
+    long long num = 0;
+    size_t digits = 0;
+    for (; pos < value_str.size() && value_str[pos] >= '0' && value_str[pos] <= '9' && digits < 9; pos++, digits++)
+        num = num * 10 + (value_str[pos] - '0');
+    if (digits == 0)
+        return false;
+
+    num *= 10;
+    if (pos + 2 <= value_str.size() && value_str[pos] == '.' && value_str[pos + 1] >= '0' && value_str[pos + 1] <= '9')
+    {
+        num += value_str[pos + 1] - '0';
+        pos += 2;
+    }
+    if (pos < value_str.size() && value_str[pos] == '\r')
+        pos++;                      /* line ends with CRLF */
+    if (pos != value_str.size())
+        return false;
+
+    tenths = negative ? -num : num;
+    return true;
+}
+
+/* Convert dust concentration to 0.1 unit, same as text with one digit after decimal point
+* Input: dust concentration
+* Output: value in 0.1 unit */
+int valueToTenths(double value)
+{
+    char value_str[32];
+    char *end = to_chars(value_str, value_str + 32, value, chars_format::fixed, 1).ptr;
+    int tenths = 0;
+    parseDustValue(string_view(value_str, end - value_str), tenths);
+    return tenths;
+}
+
+/* Round average of values in 0.1 unit to 0.1 unit, half away from zero
+* Inputs: sum and number of values (at least 1)
+* Output: average in 0.1 unit */
+int roundAverage(int64_t sum, int64_t count)
+{
+    if (sum >= 0)
+        return (2 * sum + count) / (2 * count);
+    return -((-2 * sum + count) / (2 * count));
+}
+
+/* Set all elements in array to zero 
+* Inputs: integer or double array and array' size
+* Output: zero array */
+void setValuetoZero(int *array, int size) 
+{
+    for (int i = 0; i < size; i++)
+        array[i] = 0;
+}
+
+void setValuetoZero(double *array, int size) 
+{
+    for (int i = 0; i < size; i++)
+        array[i] = 0.0;
+}
+
+/* Structure for store data to write dust_aqi.csv and further analysis*/
+struct averageValue 
+{
+    int id;
+    string time;
+    int value;                      /* 0.1 unit, rounded */
+    int aqi;
+    string level;
+};
+
+/* Structure for calculating average value of each sensor in current hour */
+struct HourlyAverage 
+{
+    int num_sensors;
+    vector<int64_t> sum_value;      /* to find average value per hour (0.1 unit) */
+    vector<int> count;              /* count id frequency */
+    string time_checkpoint;         /* hour part YYYY:MM:DD hh */
+    int num_hours;                  /* number of hour changes */
+};
+
+/* Set up hourly average
+* Inputs: hourly average, number of sensors
+* Output: empty state */
+void initHourlyAverage(HourlyAverage &hourly, int num_sensors) 
+{
+    hourly.num_sensors = num_sensors;
+    hourly.sum_value.assign(num_sensors, 0);
+    hourly.count.assign(num_sensors, 0);
+    hourly.time_checkpoint = "";
+    hourly.num_hours = 0;
+}
+
+/* Calculate average PM2.5 value, AQI and pollution level of current hour
+and reset state
+* Inputs: hourly average, list of processed data
+* Output: new elements in list */
+void closeHour(HourlyAverage &hourly, vector<averageValue> &list) 
+{
+    string time = hourly.time_checkpoint;
+    time.append(":00:00");
+
+    for (int id = 0; id < hourly.num_sensors; id++) 
+    {
+        /* process data and put in vector */
+        if (hourly.count[id] > 0) 
+        {
+            /* sum is exact, so result does not depend on order of readings.
+            AQI is taken from exact average, not from value rounded to 0.1.
+            Old sum of doubles could end just below band edge, e.g. 286.49999999999994
+            gave AQI 335 where exact 286.5 gives 336 */
+            int ave_value = roundAverage(hourly.sum_value[id], hourly.count[id]);                 /* value */
+            int ave_aqi = convertPM25toAQI((double)hourly.sum_value[id] / (10.0 * hourly.count[id]));  /* AQI */
+            string level = AQItoLevel(ave_aqi);                             /* level */
+            list.push_back({id + 1, time, ave_value, ave_aqi, level});
+            hourly.sum_value[id] = 0;                                       /* reset state */
+            hourly.count[id] = 0;
+        }
+    }
+}
+
+/* Add value to current hour, close hour first if time is in next hour
+* Inputs: hourly average, id, time string, value in 0.1 unit, list of processed data
+* Output: new elements in list (if hour changes)
+* Pre-condition: 1 <= id <= num_sensors */
+void addHourlyValue(HourlyAverage &hourly, int id, string_view time, int value, vector<averageValue> &list) 
+{
+    if (hourly.time_checkpoint.size() != 13 || time.compare(0, 13, hourly.time_checkpoint) != 0) 
+    {
+        closeHour(hourly, list);
+        hourly.time_checkpoint.assign(time, 0, 13);        /* extract hour part */
+        hourly.num_hours++;
+    }
+
+    hourly.sum_value[id - 1] += value;          /* sum value increment */
+    hourly.count[id - 1]++;
+}
+
+/* Write line in dust_sensor.csv
+* Inputs: buffer of dust_sensor.csv, id, time string (19 characters) and value */
+void writeSensorLine(WriteBuffer &out, int id, const char *time, double value) 
+{
+    writeInt(out, id);
+    writeChar(out, ',');
+    writeText(out, time, 19);
+    writeChar(out, ',');
+    writeFixed(out, value, 1);
+    writeChar(out, '\n');
+}
+
+/* Write line in dust_aqi.csv
+* Inputs: buffer of dust_aqi.csv, processed data */
+void writeAverageValue(WriteBuffer &out, const averageValue &entry) 
+{
+    writeInt(out, entry.id);
+    writeChar(out, ',');
+    writeText(out, entry.time);
+    writeChar(out, ',');
+    writeTenths(out, entry.value);
+    writeChar(out, ',');
+    writeInt(out, entry.aqi);
+    writeChar(out, ',');
+    writeText(out, entry.level);
+    writeChar(out, '\n');
+}
+
+#endif
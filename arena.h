@@ -0,0 +1,208 @@
+/***********************************************************
+* Program: arena.h
+* Purpose: Bump allocator for records of one run, optionally on huge pages,
+    and budget of memory in use
+************************************************************/
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "header.h"
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#define ARENA_BLOCK_SIZE    (2 << 20)       /* bytes per block, bigger allocation gets its own block */
+#define HUGE_PAGE_SIZE      (2 << 20)
+#define MEBIBYTE            (1 << 20)
+
+/* Structure for memory budget of run, shared by threads. Counts big allocations
+(input text, records, arena blocks), not small ones */
+struct MemoryBudget
+{
+    size_t limit;                   /* bytes, 0 if there is no limit */
+    atomic<size_t> in_use;
+    atomic<size_t> peak;
+    atomic<size_t> refused;         /* bytes in use plus refused allocation, 0 if none */
+};
+
+/* Structure for block of arena */
+struct ArenaBlock
+{
+    char *data;
+    size_t size;
+    bool mapped;                    /* from mmap(), else from malloc() */
+};
+
+/* Structure for arena, memory is given in order and freed all at once */
+struct Arena
+{
+    MemoryBudget *budget;           /* NULL if not counted */
+    bool huge_pages;
+    vector<ArenaBlock> blocks;
+    char *next;                     /* free part of current block */
+    char *end;
+    bool failed;                    /* an allocation was refused */
+};
+
+/* Set up budget
+* Inputs: budget, limit in bytes (0 if there is no limit) */
+void initMemoryBudget(MemoryBudget &budget, size_t limit)
+{
+    budget.limit = limit;
+    budget.in_use = 0;
+    budget.peak = 0;
+    budget.refused = 0;
+}
+
+/* Count bytes in use, refuse them if they go over limit
+* Inputs: budget (NULL if not counted), bytes
+* Output: true (if bytes fit in budget) or false, nothing is counted then */
+bool chargeMemory(MemoryBudget *budget, size_t bytes)
+{
+    if (budget == NULL)
+        return true;
+    size_t in_use = budget->in_use.load();
+    do
+    {
+        if (budget->limit > 0 && in_use + bytes > budget->limit)
+        {
+            budget->refused = in_use + bytes;
+            return false;
+        }
+    } while (!budget->in_use.compare_exchange_weak(in_use, in_use + bytes));
+
+    size_t peak = budget->peak.load();
+    while (in_use + bytes > peak && !budget->peak.compare_exchange_weak(peak, in_use + bytes));
+    return true;
+}
+
+/* Count bytes which are not used any more
+* Inputs: budget (NULL if not counted), bytes */
+void releaseMemory(MemoryBudget *budget, size_t bytes)
+{
+    if (budget != NULL)
+        budget->in_use -= bytes;
+}
+
+/* Set up empty arena, no memory is taken until first allocation
+* Inputs: arena, budget (NULL if not counted), use huge pages or not */
+void initArena(Arena &arena, MemoryBudget *budget, bool huge_pages)
+{
+    arena.budget = budget;
+    arena.huge_pages = huge_pages;
+    arena.blocks.clear();
+    arena.next = NULL;
+    arena.end = NULL;
+    arena.failed = false;
+}
+
+/* Take new block from system and count it in budget. Huge pages are reserved pages
+(MAP_HUGETLB) if there are any, else transparent huge pages are asked for
+* Inputs: arena, size of block
+* Output: block, NULL if budget or system refuses */
+char *newArenaBlock(Arena &arena, size_t size)
+{
+    ArenaBlock block = {NULL, size, false};
+#ifdef __linux__
+    if (arena.huge_pages)
+    {
+        block.size = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+        if (!chargeMemory(arena.budget, block.size))
+            return NULL;
+        void *data = mmap(NULL, block.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (data == MAP_FAILED)
+        {
+            data = mmap(NULL, block.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (data != MAP_FAILED)
+                madvise(data, block.size, MADV_HUGEPAGE);
+        }
+        block.data = (data == MAP_FAILED) ? NULL : (char*)data;
+        block.mapped = true;
+    }
+#endif
+    if (!block.mapped)
+    {
+        if (!chargeMemory(arena.budget, block.size))
+            return NULL;
+        block.data = (char*)malloc(block.size);
+    }
+
+    if (block.data == NULL)
+    {
+        releaseMemory(arena.budget, block.size);
+        return NULL;
+    }
+    arena.blocks.push_back(block);
+    return block.data;
+}
+
+/* Take memory from arena, it is freed with arena
+* Inputs: arena, size, alignment (power of 2, at most 16)
+* Output: memory, NULL if budget or system refuses (failed is set) */
+void *arenaAlloc(Arena &arena, size_t size, size_t align)
+{
+    if (arena.next != NULL)
+    {
+        uintptr_t pos = ((uintptr_t)arena.next + align - 1) & ~(uintptr_t)(align - 1);
+        if (pos + size <= (uintptr_t)arena.end)
+        {
+            arena.next = (char*)(pos + size);
+            return (void*)pos;
+        }
+    }
+
+    /* big allocation gets its own block, current block is kept */
+    if (size > ARENA_BLOCK_SIZE / 4)
+    {
+        char *data = newArenaBlock(arena, size);
+        arena.failed |= (data == NULL);
+        return data;
+    }
+    char *block = newArenaBlock(arena, ARENA_BLOCK_SIZE);
+    if (block == NULL)
+    {
+        arena.failed = true;
+        return NULL;
+    }
+    arena.next = block + size;
+    arena.end = block + arena.blocks.back().size;
+    return block;
+}
+
+/* Copy text to arena
+* Inputs: arena, text
+* Output: copy, empty if budget or system refuses (failed is set) */
+string_view arenaString(Arena &arena, string_view text)
+{
+    char *data = (char*)arenaAlloc(arena, text.size(), 1);
+    if (data == NULL)
+        return string_view();
+    memcpy(data, text.data(), text.size());
+    return string_view(data, text.size());
+}
+
+/* Give all blocks back to system and budget, arena is empty after
+* Input: arena */
+void freeArena(Arena &arena)
+{
+    for (const ArenaBlock &block : arena.blocks)
+    {
+#ifdef __linux__
+        if (block.mapped)
+            munmap(block.data, block.size);
+        else
+#endif
+            free(block.data);
+        releaseMemory(arena.budget, block.size);
+    }
+    arena.blocks.clear();
+    arena.next = NULL;
+    arena.end = NULL;
+}
+
+#endif
@@ -0,0 +1,380 @@
+/***********************************************************
+* Program: async.h
+* Purpose: Write output buffers in background (io_uring or writer threads)
+************************************************************/
+
+#ifndef ASYNC_H
+#define ASYNC_H
+
+#include "header.h"
+#include <atomic>
+
+#ifndef _WIN32
+#include "queue.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_set>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define ASYNC_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#define ASYNC_QUEUE_DEPTH   64          /* io_uring entries */
+#define ASYNC_THREADS       4           /* writer threads without io_uring */
+
+/* Structure for one write in flight */
+struct WriteRequest
+{
+    int fd;
+    const char *data;
+    size_t size;
+    long long offset;               /* position in file */
+    atomic<int> *busy;              /* set to 0 when whole data is written */
+    atomic<bool> *failed;           /* set to true if write failed, one flag per output file */
+};
+
+/* Structure for background writer shared by output files.
+io_uring is used where kernel has it, otherwise requests go to writer threads */
+struct AsyncWriter
+{
+    bool uring;
+    atomic<bool> failed;            /* io_uring stopped working, new writes are refused */
+    mutex done_lock;
+    condition_variable done;        /* a write finished */
+#ifdef ASYNC_IO_URING
+    mutex submit_lock;              /* one submitter at a time */
+    mutex reap_lock;                /* one thread takes completions at a time */
+    unordered_set<WriteRequest*> in_flight;     /* submitted writes, guarded by done_lock */
+    unsigned cq_entries;            /* at most this many writes in flight */
+    bool stopped;                   /* no-op which stops reaper is done, guarded by reap_lock */
+    int ring_fd;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_size, cq_size, sqes_size;
+    io_uring_sqe *sqes;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array, sq_entries;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    io_uring_cqe *cqes;
+    thread reaper;                  /* waits for completions */
+#endif
+    BoundedQueue<WriteRequest*> queue;
+    vector<thread> workers;
+};
+
+/* Write whole byte array at position, retry on partial write
+* Inputs: file descriptor, byte array, its size and position
+* Output: true (if success) or false */
+bool pwriteAll(int fd, const char *bytes, size_t size, long long offset)
+{
+    while (size > 0)
+    {
+        long n = pwrite(fd, bytes, size, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        bytes += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+/* Mark request as finished and wake up waiting threads,
+failure is kept in flag of its output file
+* Inputs: writer, request (deleted), true if data is written */
+void finishRequest(AsyncWriter &writer, WriteRequest *request, bool ok)
+{
+    {
+        lock_guard<mutex> guard(writer.done_lock);
+#ifdef ASYNC_IO_URING
+        writer.in_flight.erase(request);
+#endif
+        if (!ok)
+            request->failed->store(true);
+        request->busy->store(0);
+    }
+    writer.done.notify_all();
+    delete request;
+}
+
+#ifdef ASYNC_IO_URING
+/* Handle completions in ring, rest of partial write is written on this thread
+* Input: writer
+* Output: true (if no-op which stops reaper is done) or false */
+bool reapCompletions(AsyncWriter &writer)
+{
+    lock_guard<mutex> guard(writer.reap_lock);
+    unsigned head = *writer.cq_head;
+    unsigned tail = __atomic_load_n(writer.cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++)
+    {
+        io_uring_cqe &cqe = writer.cqes[head & *writer.cq_mask];
+        WriteRequest *request = (WriteRequest*)cqe.user_data;
+        if (request == NULL)
+        {
+            writer.stopped = true;
+            continue;
+        }
+
+        bool ok = (cqe.res >= 0 || cqe.res == -EINTR || cqe.res == -EAGAIN);
+        size_t n = max(cqe.res, 0);
+        if (ok && n < request->size)
+            ok = pwriteAll(request->fd, request->data + n, request->size - n, request->offset + n);
+        finishRequest(writer, request, ok);
+    }
+    __atomic_store_n(writer.cq_head, head, __ATOMIC_RELEASE);
+    return writer.stopped;
+}
+
+/* Put request in submission ring and tell kernel. Ring is full of completions (EBUSY):
+they are taken and call is retried. Request which kernel does not take is finished as failed
+* Inputs: writer, request (NULL for no-op which stops reaper)
+* Output: true (if kernel took request) or false */
+bool submitUring(AsyncWriter &writer, WriteRequest *request)
+{
+    lock_guard<mutex> guard(writer.submit_lock);
+    if (writer.failed)
+        return false;                       /* request is finished by failUring() */
+
+    unsigned tail = *writer.sq_tail;
+    unsigned index = tail & *writer.sq_mask;
+    io_uring_sqe &sqe = writer.sqes[index];
+    memset(&sqe, 0, sizeof(sqe));
+    if (request == NULL)
+        sqe.opcode = IORING_OP_NOP;
+    else
+    {
+        sqe.opcode = IORING_OP_WRITE;
+        sqe.fd = request->fd;
+        sqe.addr = (unsigned long long)request->data;
+        sqe.len = request->size;
+        sqe.off = request->offset;
+    }
+    sqe.user_data = (unsigned long long)request;
+    writer.sq_array[index] = index;
+    __atomic_store_n(writer.sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    /* without SQPOLL the kernel takes entry during this call, so ring never fills */
+    while (syscall(__NR_io_uring_enter, writer.ring_fd, 1, 0, 0, NULL, 0) < 0)
+    {
+        if (errno == EBUSY || errno == EAGAIN)
+            reapCompletions(writer);
+        else if (errno != EINTR)
+            break;
+    }
+    if (__atomic_load_n(writer.sq_head, __ATOMIC_ACQUIRE) != tail)
+        return true;
+
+    /* entry is not taken, take it back so ring has no stale entry */
+    __atomic_store_n(writer.sq_tail, tail, __ATOMIC_RELEASE);
+    if (request != NULL)
+        finishRequest(writer, request, false);
+    return false;
+}
+
+/* io_uring stopped working: refuse new writes, finish writes in flight as failed
+* Input: writer */
+void failUring(AsyncWriter &writer)
+{
+    {
+        lock_guard<mutex> guard(writer.done_lock);
+        writer.failed = true;
+    }
+    writer.done.notify_all();               /* submitters waiting for room give up */
+
+    lock_guard<mutex> guard(writer.submit_lock);
+    vector<WriteRequest*> requests;
+    {
+        lock_guard<mutex> done_guard(writer.done_lock);
+        requests.assign(writer.in_flight.begin(), writer.in_flight.end());
+    }
+    for (WriteRequest *request : requests)
+        finishRequest(writer, request, false);
+}
+
+/* Reaper: wait for completions and handle them
+* Input: writer */
+void reapUring(AsyncWriter &writer)
+{
+    while (true)
+    {
+        if (syscall(__NR_io_uring_enter, writer.ring_fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0
+            && errno != EINTR)
+        {
+            failUring(writer);
+            return;
+        }
+        if (reapCompletions(writer))
+            return;
+    }
+}
+
+/* Set up io_uring with raw system calls
+* Input: writer
+* Output: true (if kernel has io_uring) or false */
+bool initUring(AsyncWriter &writer)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    writer.ring_fd = syscall(__NR_io_uring_setup, ASYNC_QUEUE_DEPTH, &params);
+    if (writer.ring_fd < 0)
+        return false;
+
+    writer.sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    writer.cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    writer.sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    writer.sq_ptr = mmap(NULL, writer.sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        writer.ring_fd, IORING_OFF_SQ_RING);
+    writer.cq_ptr = mmap(NULL, writer.cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        writer.ring_fd, IORING_OFF_CQ_RING);
+    writer.sqes = (io_uring_sqe*)mmap(NULL, writer.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        writer.ring_fd, IORING_OFF_SQES);
+    if (writer.sq_ptr == MAP_FAILED || writer.cq_ptr == MAP_FAILED || writer.sqes == MAP_FAILED)
+    {
+        close(writer.ring_fd);
+        return false;
+    }
+
+    char *sq = (char*)writer.sq_ptr, *cq = (char*)writer.cq_ptr;
+    writer.sq_head = (unsigned*)(sq + params.sq_off.head);
+    writer.sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    writer.sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    writer.sq_array = (unsigned*)(sq + params.sq_off.array);
+    writer.sq_entries = params.sq_entries;
+    writer.cq_entries = params.cq_entries;
+    writer.stopped = false;
+    writer.cq_head = (unsigned*)(cq + params.cq_off.head);
+    writer.cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    writer.cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    writer.cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    writer.reaper = thread(reapUring, ref(writer));
+    return true;
+}
+#endif
+
+/* Writer thread: write requests from queue
+* Input: writer */
+void writeStage(AsyncWriter &writer)
+{
+    WriteRequest *request;
+    while (popQueue(writer.queue, request))
+        finishRequest(writer, request, pwriteAll(request->fd, request->data, request->size, request->offset));
+}
+
+/* Start background writer, io_uring first, writer threads if it is not available
+* Input: writer
+* Output: true (if started) or false */
+bool initAsyncWriter(AsyncWriter &writer)
+{
+    writer.failed = false;
+    writer.uring = false;
+#ifdef ASYNC_IO_URING
+    writer.uring = initUring(writer);
+    if (writer.uring)
+        return true;
+#endif
+    initQueue(writer.queue, ASYNC_QUEUE_DEPTH);
+    for (int i = 0; i < ASYNC_THREADS; i++)
+        writer.workers.push_back(thread(writeStage, ref(writer)));
+    return true;
+}
+
+/* Write data at position in background, busy flag is set to 1 until it is done.
+With io_uring caller waits while completion ring has no room
+* Inputs: writer, file descriptor, data (kept until done), size, position, busy flag,
+    failed flag of output file (set if write fails) */
+void submitWrite(AsyncWriter &writer, int fd, const char *data, size_t size, long long offset, atomic<int> &busy,
+    atomic<bool> &failed)
+{
+    busy = 1;
+    WriteRequest *request = new WriteRequest{fd, data, size, offset, &busy, &failed};
+#ifdef ASYNC_IO_URING
+    if (writer.uring)
+    {
+        bool refused;
+        {
+            unique_lock<mutex> guard(writer.done_lock);
+            writer.done.wait(guard, [&] { return writer.in_flight.size() < writer.cq_entries || writer.failed; });
+            refused = writer.failed;
+            if (!refused)
+                writer.in_flight.insert(request);
+        }
+        if (refused)
+            finishRequest(writer, request, false);
+        else
+            submitUring(writer, request);
+        return;
+    }
+#endif
+    pushQueue(writer.queue, std::move(request));
+}
+
+/* Wait until write with busy flag is done
+* Inputs: writer, busy flag */
+void waitWrite(AsyncWriter &writer, atomic<int> &busy)
+{
+    unique_lock<mutex> guard(writer.done_lock);
+    writer.done.wait(guard, [&] { return busy.load() == 0; });
+}
+
+/* Stop background writer after all writes are done.
+Failed writes are reported by their output files
+* Input: writer
+* Output: true (if io_uring kept working) or false */
+bool closeAsyncWriter(AsyncWriter &writer)
+{
+#ifdef ASYNC_IO_URING
+    if (writer.uring)
+    {
+        /* all output files are closed, nothing in flight */
+        if (!submitUring(writer, NULL) && !writer.failed)
+        {
+            /* reaper waits for completion which never comes, ring is left to process exit */
+            writer.reaper.detach();
+            return false;
+        }
+        writer.reaper.join();
+        munmap(writer.sqes, writer.sqes_size);
+        munmap(writer.cq_ptr, writer.cq_size);
+        munmap(writer.sq_ptr, writer.sq_size);
+        close(writer.ring_fd);
+        return !writer.failed;
+    }
+#endif
+    closeQueue(writer.queue);
+    for (thread &worker : writer.workers)
+        worker.join();
+    writer.workers.clear();
+    return !writer.failed;
+}
+
+#else
+
+/* Windows: output files are written on calling thread */
+struct AsyncWriter
+{
+    bool uring;
+};
+
+bool initAsyncWriter(AsyncWriter &writer)
+{
+    writer.uring = false;
+    return false;
+}
+
+bool closeAsyncWriter(AsyncWriter &writer)
+{
+    return true;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,92 @@
+/***********************************************************
+* Program: cache.h
+* Purpose: Least recently used cache of answers, bounded by entries and bytes
+************************************************************/
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "header.h"
+#include <list>
+#include <unordered_map>
+
+/* Structure for cached answer */
+struct CacheEntry
+{
+    string key;
+    string value;
+};
+
+/* Structure for cache, most recently used entry is at front of list */
+struct ResultCache
+{
+    size_t max_entries;
+    size_t max_bytes;                   /* total size of values */
+    size_t bytes;
+    list<CacheEntry> entries;
+    unordered_map<string, list<CacheEntry>::iterator> index;
+    long long hits;
+    long long misses;
+};
+
+/* Set up empty cache
+* Inputs: cache, maximum number of entries, maximum bytes of values */
+void initCache(ResultCache &cache, size_t max_entries, size_t max_bytes)
+{
+    cache.max_entries = max_entries;
+    cache.max_bytes = max_bytes;
+    cache.bytes = 0;
+    cache.entries.clear();
+    cache.index.clear();
+    cache.hits = 0;
+    cache.misses = 0;
+}
+
+/* Find answer and mark it most recently used
+* Inputs: cache, key
+* Output: answer, NULL if not cached */
+const string *findCache(ResultCache &cache, const string &key)
+{
+    auto found = cache.index.find(key);
+    if (found == cache.index.end())
+    {
+        cache.misses++;
+        return NULL;
+    }
+    cache.hits++;
+    cache.entries.splice(cache.entries.begin(), cache.entries, found->second);
+    return &found->second->value;
+}
+
+/* Keep answer, least recently used entries are removed until it fits.
+Answer bigger than whole cache is not kept
+* Inputs: cache, key, answer */
+void storeCache(ResultCache &cache, const string &key, const string &value)
+{
+    if (cache.max_entries == 0 || value.size() > cache.max_bytes || cache.index.count(key) > 0)
+        return;
+
+    while (!cache.entries.empty()
+        && (cache.entries.size() >= cache.max_entries || cache.bytes + value.size() > cache.max_bytes))
+    {
+        CacheEntry &last = cache.entries.back();
+        cache.bytes -= last.value.size();
+        cache.index.erase(last.key);
+        cache.entries.pop_back();
+    }
+
+    cache.entries.push_front({key, value});
+    cache.index[key] = cache.entries.begin();
+    cache.bytes += value.size();
+}
+
+/* Remove all answers, used when data changes
+* Input: cache */
+void clearCache(ResultCache &cache)
+{
+    cache.entries.clear();
+    cache.index.clear();
+    cache.bytes = 0;
+}
+
+#endif
@@ -0,0 +1,312 @@
+/***********************************************************
+* Program: columnar.h
+* Purpose: Column file which describes itself and is mapped in memory without parsing
+************************************************************/
+
+#ifndef COLUMNAR_H
+#define COLUMNAR_H
+
+#include "header.h"
+#include "writer.h"
+#include <cstdint>
+#include <cstring>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/* File layout, every part begins at multiple of COLUMN_ALIGN bytes so columns can be used in place:
+    header      ColumnHeader
+    directory   one ColumnEntry per column
+    columns     values of each column (num_rows * width bytes), dictionary of dictionary column after it
+    dictionary  number of strings (u32), then length (u32) and characters of each string
+Numbers are in byte order of machine (little-endian), version 1 reads as other number on big-endian */
+
+#define COLUMN_MAGIC        "DUSTCOL1"
+#define COLUMN_VERSION      1
+#define COLUMN_ALIGN        64
+#define COLUMN_NAME_SIZE    24
+#define COLUMN_NULL         255         /* code of dictionary column without value */
+
+/* column type */
+#define COLUMN_INT16        1
+#define COLUMN_INT32        2
+#define COLUMN_UINT32       3
+#define COLUMN_INT64        4
+#define COLUMN_DICT8        5           /* uint8 code in dictionary */
+
+/* Structure for first 64 bytes of file */
+struct ColumnHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t num_columns;
+    uint64_t num_rows;
+    uint8_t reserved[40];
+};
+
+/* Structure for position of one column */
+struct ColumnEntry
+{
+    char name[COLUMN_NAME_SIZE];        /* null-terminated */
+    uint32_t type;
+    uint32_t dict_count;                /* strings in dictionary, 0 if not dictionary column */
+    uint64_t offset;                    /* position of values */
+    uint64_t size;
+    uint64_t dict_offset;               /* position of dictionary */
+    uint64_t dict_size;
+};
+
+static_assert(sizeof(ColumnHeader) == 64 && sizeof(ColumnEntry) == 64, "column file layout");
+
+/* Structure for column to be written */
+struct ColumnSource
+{
+    string name;
+    uint32_t type;
+    const void *data;                   /* num_rows values */
+    vector<string> dictionary;          /* for COLUMN_DICT8 */
+};
+
+/* Structure for opened column file */
+struct ColumnFile
+{
+    const char *data;                   /* whole file */
+    size_t size;
+    const ColumnHeader *header;
+    const ColumnEntry *entries;
+    bool mapped;                        /* data is mapped, otherwise it is allocated */
+};
+
+/* Get size of one value
+* Input: column type
+* Output: bytes per value, 0 if type is unknown */
+size_t columnWidth(uint32_t type)
+{
+    switch (type)
+    {
+        case COLUMN_INT16:  return 2;
+        case COLUMN_INT32:  return 4;
+        case COLUMN_UINT32: return 4;
+        case COLUMN_INT64:  return 8;
+        case COLUMN_DICT8:  return 1;
+    }
+    return 0;
+}
+
+/* Round position up to multiple of COLUMN_ALIGN */
+uint64_t alignColumn(uint64_t pos)
+{
+    return (pos + COLUMN_ALIGN - 1) / COLUMN_ALIGN * COLUMN_ALIGN;
+}
+
+/* Write zero bytes until position is multiple of COLUMN_ALIGN
+* Inputs: buffer, current position */
+void padColumn(WriteBuffer &out, uint64_t pos)
+{
+    static const char ZEROS[COLUMN_ALIGN] = {0};
+    writeText(out, ZEROS, alignColumn(pos) - pos);
+}
+
+/* Write column file
+* Inputs: file name, number of rows, columns, background writer (NULL if written on this thread)
+* Output: true (if file is written) or false */
+bool writeColumnFile(const string &file_name, uint64_t num_rows, const vector<ColumnSource> &columns,
+    AsyncWriter *async)
+{
+    ColumnHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, COLUMN_MAGIC, 8);
+    header.version = COLUMN_VERSION;
+    header.num_columns = columns.size();
+    header.num_rows = num_rows;
+
+    /* find position of each part */
+    vector<ColumnEntry> entries(columns.size());
+    vector<string> dictionaries(columns.size());
+    uint64_t pos = alignColumn(sizeof(ColumnHeader) + columns.size() * sizeof(ColumnEntry));
+    for (size_t i = 0; i < columns.size(); i++)
+    {
+        ColumnEntry &entry = entries[i];
+        memset(&entry, 0, sizeof(entry));
+        strncpy(entry.name, columns[i].name.c_str(), COLUMN_NAME_SIZE - 1);
+        entry.type = columns[i].type;
+        entry.offset = pos;
+        entry.size = num_rows * columnWidth(entry.type);
+        pos = alignColumn(pos + entry.size);
+
+        if (entry.type == COLUMN_DICT8)
+        {
+            string &bytes = dictionaries[i];
+            uint32_t count = columns[i].dictionary.size();
+            bytes.append((const char*)&count, 4);
+            for (const string &text : columns[i].dictionary)
+            {
+                uint32_t length = text.size();
+                bytes.append((const char*)&length, 4);
+                bytes.append(text);
+            }
+            entry.dict_count = count;
+            entry.dict_offset = pos;
+            entry.dict_size = bytes.size();
+            pos = alignColumn(pos + entry.dict_size);
+        }
+    }
+
+    WriteBuffer out;
+    if (!openWriteBufferAtomic(out, file_name, async))
+        return false;
+    setBinaryWriteBuffer(out);
+
+    writeText(out, (const char*)&header, sizeof(header));
+    writeText(out, (const char*)entries.data(), entries.size() * sizeof(ColumnEntry));
+    padColumn(out, sizeof(header) + entries.size() * sizeof(ColumnEntry));
+    for (size_t i = 0; i < columns.size(); i++)
+    {
+        writeText(out, (const char*)columns[i].data, entries[i].size);
+        padColumn(out, entries[i].offset + entries[i].size);
+        writeText(out, dictionaries[i]);
+        padColumn(out, entries[i].dict_offset + entries[i].dict_size);
+    }
+    return closeWriteBuffer(out);
+}
+
+/* Check if file begins with column file magic
+* Input: file name
+* Output: true or false */
+bool isColumnFile(const string &file_name)
+{
+    ifstream input_file(file_name, ios::binary);
+    char magic[8] = {0};
+    input_file.read(magic, 8);
+    return input_file && memcmp(magic, COLUMN_MAGIC, 8) == 0;
+}
+
+/* Release data of column file
+* Input: column file */
+void closeColumnFile(ColumnFile &file)
+{
+    if (file.data == NULL)
+        return;
+#ifndef _WIN32
+    if (file.mapped)
+        munmap((void*)file.data, file.size);
+    else
+#endif
+        freeWriteBuffer((char*)file.data);
+    file.data = NULL;
+}
+
+/* Map column file in memory (read into aligned memory where mmap does not exist),
+check that every part is inside file and every code of dictionary column is in dictionary
+* Inputs: file name, column file
+* Output: true (if file is valid) or false */
+bool openColumnFile(const string &file_name, ColumnFile &file)
+{
+    file.data = NULL;
+    file.size = 0;
+    file.mapped = false;
+#ifndef _WIN32
+    int fd = open(file_name.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd < 0)
+        return false;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(ColumnHeader))
+    {
+        close(fd);
+        return false;
+    }
+    file.size = info.st_size;
+    void *data = mmap(NULL, file.size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return false;
+    file.data = (const char*)data;
+    file.mapped = true;
+#else
+    ifstream input_file(file_name, ios::binary | ios::ate);
+    if (!input_file || input_file.tellg() < (streamoff)sizeof(ColumnHeader))
+        return false;
+    file.size = input_file.tellg();
+    char *data = allocWriteBuffer(file.size);
+    input_file.seekg(0);
+    if (data == NULL || !input_file.read(data, file.size))
+    {
+        freeWriteBuffer(data);
+        return false;
+    }
+    file.data = data;
+#endif
+
+    file.header = (const ColumnHeader*)file.data;
+    file.entries = (const ColumnEntry*)(file.data + sizeof(ColumnHeader));
+    bool valid = memcmp(file.header->magic, COLUMN_MAGIC, 8) == 0 && file.header->version == COLUMN_VERSION
+        && file.header->num_columns <= (file.size - sizeof(ColumnHeader)) / sizeof(ColumnEntry);
+    for (uint32_t i = 0; valid && i < file.header->num_columns; i++)
+    {
+        const ColumnEntry &entry = file.entries[i];
+        size_t width = columnWidth(entry.type);
+        valid = width > 0 && entry.name[COLUMN_NAME_SIZE - 1] == '\0'
+            && file.header->num_rows <= file.size / width && entry.size == file.header->num_rows * width
+            && entry.offset % COLUMN_ALIGN == 0 && entry.offset <= file.size && entry.size <= file.size - entry.offset
+            && entry.dict_offset <= file.size && entry.dict_size <= file.size - entry.dict_offset;
+
+        /* codes index dictionary, value is not checked again when used */
+        const uint8_t *codes = (const uint8_t*)(file.data + entry.offset);
+        for (uint64_t row = 0; valid && entry.type == COLUMN_DICT8 && row < file.header->num_rows; row++)
+            valid = codes[row] < entry.dict_count || codes[row] == COLUMN_NULL;
+    }
+    if (!valid)
+        closeColumnFile(file);
+    return valid;
+}
+
+/* Find column by name and type
+* Inputs: column file, name, type
+* Output: values of column, NULL if there is no such column */
+const void *findColumn(const ColumnFile &file, const char *name, uint32_t type)
+{
+    for (uint32_t i = 0; i < file.header->num_columns; i++)
+    {
+        const ColumnEntry &entry = file.entries[i];
+        if (entry.type == type && strcmp(entry.name, name) == 0)
+            return file.data + entry.offset;
+    }
+    return NULL;
+}
+
+/* Get dictionary of dictionary column
+* Inputs: column file, name, dictionary (output)
+* Output: true (if column exists and dictionary is valid) or false */
+bool findDictionary(const ColumnFile &file, const char *name, vector<string> &dictionary)
+{
+    for (uint32_t i = 0; i < file.header->num_columns; i++)
+    {
+        const ColumnEntry &entry = file.entries[i];
+        if (entry.type != COLUMN_DICT8 || strcmp(entry.name, name) != 0)
+            continue;
+
+        const char *p = file.data + entry.dict_offset, *end = p + entry.dict_size;
+        uint32_t count, length;
+        if (end - p < 4)
+            return false;
+        memcpy(&count, p, 4);
+        p += 4;
+        dictionary.clear();
+        for (uint32_t k = 0; k < count; k++)
+        {
+            if (end - p < 4)
+                return false;
+            memcpy(&length, p, 4);
+            p += 4;
+            if ((uint64_t)(end - p) < length)
+                return false;
+            dictionary.push_back(string(p, length));
+            p += length;
+        }
+        return count == entry.dict_count;
+    }
+    return false;
+}
+
+#endif
@@ -0,0 +1,176 @@
+/***********************************************************
+* Program: coverage.h
+* Purpose: Find missing and duplicated readings of each sensor per hour
+************************************************************/
+
+#ifndef COVERAGE_H
+#define COVERAGE_H
+
+#include "header.h"
+#include "writer.h"
+#include "aqi.h"
+#include <algorithm>
+#include <cstdint>
+
+/* result of coverage check */
+#define COVERAGE_NEW            0           /* first reading in its slot */
+#define COVERAGE_DUPLICATE      1           /* slot already has reading */
+
+/* Structure for tracking readings of current hour.
+Hour is split in slots of sampling seconds, each sensor has one bit per slot.
+Bits of sensor id are at [(id - 1) * words, id * words) in bits */
+struct CoverageTracker
+{
+    int sampling;                   /* time per simulation (dust_sim -st) */
+    int expected;                   /* readings expected per hour */
+    int words;                      /* 64-bit words per sensor */
+    double threshold;               /* coverage (%) below which hour is excluded, 0 if none */
+    int num_sensors;                /* number of sensors having bits */
+    int max_id;                     /* largest id seen */
+    vector<uint64_t> bits;
+    vector<int> filled;             /* readings in current hour */
+    vector<int> duplicates;         /* duplicates in current hour */
+    vector<char> excluded;          /* sensor is excluded in hour being closed */
+    string time_checkpoint;         /* hour part YYYY:MM:DD hh */
+    size_t hour_begin;              /* position of first valid data of current hour */
+    long long num_duplicates;
+    long long num_excluded;         /* sensor-hours excluded */
+    WriteBuffer file;               /* dust_coverage.csv */
+};
+
+/* Set up tracker and open coverage file
+* Inputs: tracker, sampling time, threshold (%), coverage file name,
+    background writer (NULL if written on this thread)
+* Output: true (if file can be created) or false */
+bool initCoverageTracker(CoverageTracker &tracker, int sampling, double threshold, string file_name, AsyncWriter *async)
+{
+    int slots = (3600 + sampling - 1) / sampling;
+    tracker.sampling = sampling;
+    tracker.expected = max(1, 3600 / sampling);
+    tracker.words = (slots + 63) / 64;
+    tracker.threshold = threshold;
+    tracker.num_sensors = 0;
+    tracker.max_id = 0;
+    tracker.bits.clear();
+    tracker.filled.clear();
+    tracker.duplicates.clear();
+    tracker.excluded.clear();
+    tracker.time_checkpoint = "";
+    tracker.hour_begin = 0;
+    tracker.num_duplicates = 0;
+    tracker.num_excluded = 0;
+
+    if (!openWriteBufferAtomic(tracker.file, file_name, async))
+        return false;
+    writeText(tracker.file, "id,time,readings,expected,coverage,duplicates\n");
+    return true;
+}
+
+/* Make room for sensor id, storage grows by doubling
+* Inputs: tracker, sensor id */
+void growCoverageTracker(CoverageTracker &tracker, int id)
+{
+    if (id > tracker.max_id)
+        tracker.max_id = id;
+    if (id <= tracker.num_sensors)
+        return;
+
+    int capacity = tracker.num_sensors > 0 ? tracker.num_sensors : 64;
+    while (capacity < id)
+        capacity *= 2;
+
+    tracker.bits.resize((size_t)capacity * tracker.words, 0);
+    tracker.filled.resize(capacity, 0);
+    tracker.duplicates.resize(capacity, 0);
+    tracker.excluded.resize(capacity, 0);
+    tracker.num_sensors = capacity;
+}
+
+/* Write coverage of all sensors in current hour, remove data of hours
+below threshold and reset state
+* Inputs: tracker, valid data (data of current hour is at the end) */
+void closeCoverageHour(CoverageTracker &tracker, vector<DataField> &data)
+{
+    if (tracker.time_checkpoint.empty())
+        return;
+
+    string time = tracker.time_checkpoint;
+    time.append(":00:00");
+
+    bool any_excluded = false;
+    for (int id = 0; id < tracker.max_id; id++)
+    {
+        double coverage = min(100.0, 100.0 * tracker.filled[id] / tracker.expected);
+        writeInt(tracker.file, id + 1);
+        writeChar(tracker.file, ',');
+        writeText(tracker.file, time);
+        writeChar(tracker.file, ',');
+        writeInt(tracker.file, tracker.filled[id]);
+        writeChar(tracker.file, ',');
+        writeInt(tracker.file, tracker.expected);
+        writeChar(tracker.file, ',');
+        writeFixed(tracker.file, coverage, 1);
+        writeChar(tracker.file, ',');
+        writeInt(tracker.file, tracker.duplicates[id]);
+        writeChar(tracker.file, '\n');
+
+        tracker.excluded[id] = (tracker.filled[id] > 0 && coverage < tracker.threshold);
+        if (tracker.excluded[id])
+        {
+            any_excluded = true;
+            tracker.num_excluded++;
+        }
+        tracker.filled[id] = 0;
+        tracker.duplicates[id] = 0;
+    }
+
+    /* data of this hour are at the end of vector */
+    if (any_excluded)
+    {
+        data.erase(remove_if(data.begin() + tracker.hour_begin, data.end(),
+            [&](const DataField &entry) { return tracker.excluded[entry.id - 1] != 0; }), data.end());
+    }
+    fill(tracker.bits.begin(), tracker.bits.end(), 0);
+}
+
+/* Mark slot of reading, close hour first if time is in next hour. O(1) per reading
+* Inputs: tracker, id, time string YYYY:MM:DD hh:mm:ss, valid data
+* Output: COVERAGE_NEW or COVERAGE_DUPLICATE
+* Pre-condition: id >= 1, readings come in time order */
+int trackCoverage(CoverageTracker &tracker, int id, string_view time, vector<DataField> &data)
+{
+    if (tracker.time_checkpoint.size() != 13 || time.compare(0, 13, tracker.time_checkpoint) != 0)
+    {
+        closeCoverageHour(tracker, data);
+        tracker.time_checkpoint.assign(time, 0, 13);
+        tracker.hour_begin = data.size();
+    }
+    growCoverageTracker(tracker, id);
+
+    /* minute and second are at fixed position */
+    int second = ((time[14] - '0') * 10 + (time[15] - '0')) * 60 + (time[17] - '0') * 10 + (time[18] - '0');
+    int slot = second / tracker.sampling;
+    uint64_t &word = tracker.bits[(size_t)(id - 1) * tracker.words + slot / 64];
+    uint64_t mask = (uint64_t)1 << (slot % 64);
+
+    if (word & mask)
+    {
+        tracker.duplicates[id - 1]++;
+        tracker.num_duplicates++;
+        return COVERAGE_DUPLICATE;
+    }
+    word |= mask;
+    tracker.filled[id - 1]++;
+    return COVERAGE_NEW;
+}
+
+/* Close last hour and coverage file
+* Inputs: tracker, valid data
+* Output: true (if coverage file is written) or false */
+bool closeCoverageTracker(CoverageTracker &tracker, vector<DataField> &data)
+{
+    closeCoverageHour(tracker, data);
+    return closeWriteBuffer(tracker.file);
+}
+
+#endif
@@ -8,6 +8,7 @@
 #define ERROR_H
 
 #include "header.h"
+#include <mutex>
 
 /* error table */
 vector<string> ERROR_LIST = 
@@ -16,16 +17,26 @@ vector<string> ERROR_LIST =
     "Error 02: invalid argument",
     "Error 03: file access denied",
     "Error 04: invalid csv file format",
-    "Error 05: data missing at line X"
+    "Error 05: data missing at line X",
+    "Error 06: memory budget exceeded"
 };
 
+/* log file is written by one thread at a time */
+mutex error_lock;
+
 /* Generate time string occuring error
 * Output: a local time with format YYYY:MM:DD hh:mm:ss */
 string recordTimeOccurError() 
 {
     time_t now;
     time(&now);
-    tm* tm_local = localtime(&now);         /* get time */
+    tm local;
+#ifdef _WIN32
+    localtime_s(&local, &now);
+#else
+    localtime_r(&now, &local);
+#endif
+    tm* tm_local = &local;                  /* get time */
     
     /* write time */
     stringstream ss;
@@ -46,9 +57,11 @@ Error list:
 Error 01: invalid command
 Error 02: invalid argument
 Error 04: invalid csv file format
+Error 06: memory budget exceeded
 */
 void error(int i, string log_file) 
 {
+    lock_guard<mutex> guard(error_lock);
     ofstream ERROR_STREAM;
     ERROR_STREAM.open(log_file, ios::app);
     string error_text = ERROR_LIST[i-1];
@@ -57,6 +70,7 @@ void error(int i, string log_file)
         case 01:
         case 02:
         case 04:
+        case 06:
             ERROR_STREAM << recordTimeOccurError() << " " << error_text << endl;
             break;
     }
@@ -73,6 +87,7 @@ Error 05: data missing at line X
 */
 void error(int i, string log_file, int linePos) 
 {
+    lock_guard<mutex> guard(error_lock);
     ofstream ERROR_STREAM;
     ERROR_STREAM.open(log_file, ios_base::app);
     string error_text = ERROR_LIST[i-1];
@@ -95,6 +110,7 @@ Error 03: file access denied
 */
 void error(int i, string log_file, string file_name) 
 {
+    lock_guard<mutex> guard(error_lock);
     ofstream ERROR_STREAM;
     ERROR_STREAM.open(log_file, ios_base::app);
     string error_text = ERROR_LIST[i-1];
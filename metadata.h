@@ -0,0 +1,273 @@
+/***********************************************************
+* Program: metadata.h
+* Purpose: Site, region and calibration of each sensor, hourly AQI and
+    pollution statistics of each site and region
+************************************************************/
+
+#ifndef METADATA_H
+#define METADATA_H
+
+#include "header.h"
+#include "error.h"
+#include "writer.h"
+#include "aqi.h"
+#include <cstdint>
+#include <charconv>
+#include <unordered_map>
+
+#define GAIN_SCALE          10000       /* gain is stored in 1/10000 */
+
+/* kind of group */
+#define META_SITE           0
+#define META_REGION         1
+#define NUM_META_GROUPS     2
+
+/* Structure for metadata file (id,site,region[,offset,gain]), one element per sensor at id - 1.
+Sensor which is not listed has no site and region and is not calibrated */
+struct SensorMetadata
+{
+    int max_id;
+    vector<string> names[NUM_META_GROUPS];      /* names of sites and regions, index is group code */
+    vector<int32_t> codes[NUM_META_GROUPS];     /* site and region code of sensor, -1 if not listed */
+    vector<int32_t> site_region;                /* region code of each site */
+    vector<int32_t> offset;                     /* calibration offset (0.1 unit) */
+    vector<int32_t> gain;                       /* calibration gain (1/GAIN_SCALE) */
+};
+
+/* Structure for hourly average of sites or regions, fed with hourly values of sensors */
+struct GroupAverage
+{
+    int kind;                           /* META_SITE or META_REGION */
+    const SensorMetadata *meta;
+    string time;                        /* current hour YYYY:MM:DD hh:00:00 */
+    vector<int64_t> sum_value;          /* sum of hourly values of sensors in group (0.1 unit) */
+    vector<int> num_sensors;            /* sensors having value in current hour */
+    vector<int> level_hours;            /* hours in each level, NUM_LEVELS per group */
+    WriteBuffer file;                   /* dust_aqi_site.csv or dust_aqi_region.csv */
+};
+
+/* Split line at commas
+* Inputs: line, fields (output) */
+void splitFields(const string &line, vector<string> &fields)
+{
+    fields.clear();
+    size_t pos = 0;
+    while (true)
+    {
+        size_t comma = line.find(',', pos);
+        fields.push_back(line.substr(pos, comma == string::npos ? string::npos : comma - pos));
+        if (comma == string::npos)
+            return;
+        pos = comma + 1;
+    }
+}
+
+/* Find code of name, new name gets next code
+* Inputs: names, index of names, name
+* Output: code */
+int findGroupCode(vector<string> &names, unordered_map<string, int> &index, const string &name)
+{
+    auto found = index.try_emplace(name, (int)names.size());
+    if (found.second)
+        names.push_back(name);
+    return found.first->second;
+}
+
+/* Load metadata file, site and region are required, offset and gain are optional
+* Inputs: file name, metadata, log file
+* Output: true (if file is valid) or false, error is recorded in log file */
+bool loadSensorMetadata(const string &file_name, SensorMetadata &meta, const string &log_file)
+{
+    ifstream input_file(file_name, ios::binary);
+    string textline;
+    vector<string> fields;
+    unordered_map<string, int> index[NUM_META_GROUPS];
+    int linePos = 0;
+
+    meta = SensorMetadata();
+    meta.max_id = 0;
+    getline(input_file, textline);
+    if (!textline.empty() && textline.back() == '\r')
+        textline.pop_back();
+    if (textline.compare(0, 14, "id,site,region") != 0)
+    {
+        error(04, log_file);
+        return false;
+    }
+
+    while (getline(input_file, textline))
+    {
+        linePos++;
+        if (!textline.empty() && textline.back() == '\r')
+            textline.pop_back();
+        if (textline.empty())
+            continue;
+        splitFields(textline, fields);
+
+        int id = 0, offset = 0;
+        double gain = 1.0;
+        bool valid = (fields.size() == 3 || fields.size() == 5)
+            && from_chars(fields[0].data(), fields[0].data() + fields[0].size(), id).ec == errc() && id > 0
+            && !fields[1].empty() && !fields[2].empty();
+        if (valid && fields.size() == 5)
+        {
+            /* empty offset or gain keeps default */
+            valid = (fields[3].empty() || parseDustValue(fields[3], offset))
+                && (fields[4].empty() || from_chars(fields[4].data(), fields[4].data() + fields[4].size(), gain).ec == errc())
+                && gain > 0 && gain < 100;
+        }
+
+        int site = -1, region = -1;
+        if (valid)
+        {
+            site = findGroupCode(meta.names[META_SITE], index[META_SITE], fields[1]);
+            region = findGroupCode(meta.names[META_REGION], index[META_REGION], fields[2]);
+            if (site == (int)meta.site_region.size())
+                meta.site_region.push_back(region);
+            valid = meta.site_region[site] == region;          /* site is in one region */
+        }
+        if (valid && id > meta.max_id)
+        {
+            meta.max_id = id;
+            meta.codes[META_SITE].resize(id, -1);
+            meta.codes[META_REGION].resize(id, -1);
+            meta.offset.resize(id, 0);
+            meta.gain.resize(id, GAIN_SCALE);
+        }
+        if (!valid || meta.codes[META_SITE][id - 1] >= 0)          /* id is listed twice */
+        {
+            error(05, log_file, linePos);
+            return false;
+        }
+
+        meta.codes[META_SITE][id - 1] = site;
+        meta.codes[META_REGION][id - 1] = region;
+        meta.offset[id - 1] = offset;
+        meta.gain[id - 1] = (int32_t)(gain * GAIN_SCALE + 0.5);
+    }
+    return true;
+}
+
+/* Apply calibration of sensor to value: value * gain + offset, rounded half away from zero
+* Inputs: metadata, id, value in 0.1 unit
+* Output: calibrated value in 0.1 unit */
+inline int calibrateValue(const SensorMetadata &meta, int id, int tenths)
+{
+    if (id > meta.max_id)
+        return tenths;
+    int64_t scaled = (int64_t)tenths * meta.gain[id - 1] + (int64_t)meta.offset[id - 1] * GAIN_SCALE;
+    if (scaled >= 0)
+        return (int)((scaled + GAIN_SCALE / 2) / GAIN_SCALE);
+    return -(int)((-scaled + GAIN_SCALE / 2) / GAIN_SCALE);
+}
+
+/* Set up hourly average of groups and open its file
+* Inputs: groups, META_SITE or META_REGION, metadata, file name,
+    background writer (NULL if written on this thread)
+* Output: true (if file can be created) or false */
+bool openGroupAverage(GroupAverage &group, int kind, const SensorMetadata &meta, const string &file_name,
+    AsyncWriter *async)
+{
+    size_t num_groups = meta.names[kind].size();
+    group.kind = kind;
+    group.meta = &meta;
+    group.time = "";
+    group.sum_value.assign(num_groups, 0);
+    group.num_sensors.assign(num_groups, 0);
+    group.level_hours.assign(num_groups * NUM_LEVELS, 0);
+
+    if (!openWriteBufferAtomic(group.file, file_name, async))
+        return false;
+    writeText(group.file, (kind == META_SITE) ? "site,region,time,sensors,value,aqi,pollution\n"
+        : "region,time,sensors,value,aqi,pollution\n");
+    return true;
+}
+
+/* Write average of every group in current hour and reset it
+* Input: groups */
+void closeGroupHour(GroupAverage &group)
+{
+    const vector<string> &names = group.meta->names[group.kind];
+    for (size_t k = 0; k < names.size(); k++)
+    {
+        if (group.num_sensors[k] == 0)
+            continue;
+
+        /* every sensor has the same weight, as average of its lines in dust_aqi.csv */
+        int ave_aqi = convertPM25toAQI((double)group.sum_value[k] / (10.0 * group.num_sensors[k]));
+        int level = levelIndex(ave_aqi);
+        if (level >= 0)
+            group.level_hours[k * NUM_LEVELS + level]++;
+
+        writeText(group.file, names[k]);
+        writeChar(group.file, ',');
+        if (group.kind == META_SITE)
+        {
+            writeText(group.file, group.meta->names[META_REGION][group.meta->site_region[k]]);
+            writeChar(group.file, ',');
+        }
+        writeText(group.file, group.time);
+        writeChar(group.file, ',');
+        writeInt(group.file, group.num_sensors[k]);
+        writeChar(group.file, ',');
+        writeTenths(group.file, roundAverage(group.sum_value[k], group.num_sensors[k]));
+        writeChar(group.file, ',');
+        writeInt(group.file, ave_aqi);
+        writeChar(group.file, ',');
+        writeText(group.file, AQItoLevel(ave_aqi));
+        writeChar(group.file, '\n');
+
+        group.sum_value[k] = 0;
+        group.num_sensors[k] = 0;
+    }
+}
+
+/* Add hourly value of sensor to its group, close hour first if value is in next hour
+* Inputs: groups, hourly value of sensor
+* Pre-condition: values come in time order */
+void addGroupValue(GroupAverage &group, const averageValue &entry)
+{
+    if (entry.time != group.time)
+    {
+        closeGroupHour(group);
+        group.time = entry.time;
+    }
+    if (entry.id > group.meta->max_id)
+        return;
+    int code = group.meta->codes[group.kind][entry.id - 1];
+    if (code < 0)
+        return;                         /* sensor is not listed */
+    group.sum_value[code] += entry.value;
+    group.num_sensors[code]++;
+}
+
+/* Write last hour, close file and write hours in each level of groups
+in dust_statistics.csv format
+* Inputs: groups, file name of statistics, background writer (NULL if written on this thread)
+* Output: true (if both files are written) or false */
+bool closeGroupAverage(GroupAverage &group, const string &statistics_name, AsyncWriter *async)
+{
+    closeGroupHour(group);
+    bool ok = closeWriteBuffer(group.file);
+
+    WriteBuffer out;
+    if (!openWriteBufferAtomic(out, statistics_name, async))
+        return false;
+    writeText(out, (group.kind == META_SITE) ? "site,pollution,duration\n" : "region,pollution,duration\n");
+    const vector<string> &names = group.meta->names[group.kind];
+    for (size_t k = 0; k < names.size(); k++)
+    {
+        for (int level = 0; level < NUM_LEVELS; level++)
+        {
+            writeText(out, names[k]);
+            writeChar(out, ',');
+            writeText(out, aqiRanges[level].level);
+            writeChar(out, ',');
+            writeInt(out, group.level_hours[k * NUM_LEVELS + level]);
+            writeChar(out, '\n');
+        }
+    }
+    return closeWriteBuffer(out) && ok;
+}
+
+#endif
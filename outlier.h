@@ -0,0 +1,172 @@
+/***********************************************************
+* Program: outlier.h
+* Purpose: Detect outliers in sensor stream by rolling median/MAD (Hampel filter)
+************************************************************/
+
+#ifndef OUTLIER_H
+#define OUTLIER_H
+
+#include "header.h"
+#include <algorithm>
+#include <cstring>
+
+/* outlier filter mode */
+#define FILTER_RANGE            1           /* fixed bounds [0, 550.5] only */
+#define FILTER_HAMPEL           2           /* fixed bounds and rolling median/MAD */
+
+/* default parameters of Hampel filter */
+#define HAMPEL_WINDOW           15          /* number of previous values per sensor */
+#define HAMPEL_THRESHOLD        3.0         /* number of scaled MAD */
+#define HAMPEL_MAD_SCALE        1.4826      /* MAD to standard deviation */
+#define HAMPEL_MIN_SCALE        1.0         /* lowest deviation can be flagged (ug/m3) */
+
+/* result of Hampel check */
+#define HAMPEL_NORMAL           0
+#define HAMPEL_SPIKE            1           /* too far from rolling median */
+#define HAMPEL_STUCK            2           /* same value as whole window */
+
+/* Structure for storing rolling window of all sensors.
+Window of sensor id is at [(id - 1) * window, id * window) in ring and sorted.
+Sorted window is a plain array, each update moves up to window values (O(window)).
+For windows up to a few hundred values this is faster than a balanced tree
+with O(log window) updates, whose rank walks for median and MAD miss cache */
+struct HampelFilter
+{
+    int window;                     /* window size */
+    double threshold;               /* number of scaled MAD */
+    int num_sensors;                /* number of sensors having window */
+    vector<double> ring;            /* values in arrival order */
+    vector<double> sorted;          /* same values in ascending order */
+    vector<int> head;               /* position of oldest value in ring */
+    vector<int> fill;               /* number of values in window */
+};
+
+/* Set up Hampel filter
+* Inputs: filter, window size and threshold
+* Output: empty filter */
+void initHampelFilter(HampelFilter &filter, int window, double threshold)
+{
+    filter.window = window;
+    filter.threshold = threshold;
+    filter.num_sensors = 0;
+    filter.ring.clear();
+    filter.sorted.clear();
+    filter.head.clear();
+    filter.fill.clear();
+}
+
+/* Make room for sensor id, window storage grows by doubling
+* Inputs: filter, sensor id
+* Output: filter can store window of sensor id */
+void growHampelFilter(HampelFilter &filter, int id)
+{
+    if (id <= filter.num_sensors)
+        return;
+
+    int capacity = filter.num_sensors > 0 ? filter.num_sensors : 64;
+    while (capacity < id)
+        capacity *= 2;
+
+    filter.ring.resize((size_t)capacity * filter.window);
+    filter.sorted.resize((size_t)capacity * filter.window);
+    filter.head.resize(capacity, 0);
+    filter.fill.resize(capacity, 0);
+    filter.num_sensors = capacity;
+}
+
+/* Find median absolute deviation of sorted window.
+Deviations grow when walking away from median in both directions,
+so they are merged like two sorted lists until middle one is reached, O(window)
+* Inputs: sorted window, size and median
+* Output: MAD */
+double medianAbsoluteDeviation(const double *sorted, int size, double median)
+{
+    int right = lower_bound(sorted, sorted + size, median) - sorted;       /* first value >= median */
+    int left = right - 1;
+    int middle = size / 2;
+    double deviation = 0.0, previous = 0.0;
+
+    for (int i = 0; i <= middle; i++)
+    {
+        double left_dev = (left >= 0) ? median - sorted[left] : 1e300;
+        double right_dev = (right < size) ? sorted[right] - median : 1e300;
+        previous = deviation;
+        if (left_dev < right_dev)
+        {
+            deviation = left_dev;
+            left--;
+        }
+        else
+        {
+            deviation = right_dev;
+            right++;
+        }
+    }
+
+    if (size % 2 == 0)
+        return (previous + deviation) / 2;
+    return deviation;
+}
+
+/* Check value against rolling window of its sensor and put it in window.
+Oldest value is removed from sorted window and new one inserted by binary search
+* Inputs: filter, sensor id, value
+* Output: HAMPEL_NORMAL, HAMPEL_SPIKE or HAMPEL_STUCK
+* Pre-condition: id >= 1 */
+int checkHampelOutlier(HampelFilter &filter, int id, double value)
+{
+    growHampelFilter(filter, id);
+
+    int w = filter.window;
+    double *ring = &filter.ring[(size_t)(id - 1) * w];
+    double *sorted = &filter.sorted[(size_t)(id - 1) * w];
+    int &head = filter.head[id - 1];
+    int &fill = filter.fill[id - 1];
+    int result = HAMPEL_NORMAL;
+
+    /* test only when window is full */
+    if (fill == w)
+    {
+        double median = (w % 2) ? sorted[w / 2] : (sorted[w / 2 - 1] + sorted[w / 2]) / 2;
+        double mad = medianAbsoluteDeviation(sorted, w, median);
+        double limit = filter.threshold * HAMPEL_MAD_SCALE * mad;
+        if (limit < HAMPEL_MIN_SCALE)
+            limit = HAMPEL_MIN_SCALE;
+
+        if (sorted[0] == sorted[w - 1] && value == sorted[0])
+            result = HAMPEL_STUCK;
+        else if (value - median > limit || median - value > limit)
+            result = HAMPEL_SPIKE;
+
+        /* remove oldest value */
+        double oldest = ring[head];
+        int pos = lower_bound(sorted, sorted + fill, oldest) - sorted;
+        memmove(sorted + pos, sorted + pos + 1, (fill - pos - 1) * sizeof(double));
+        fill--;
+    }
+
+    /* insert new value */
+    int pos = upper_bound(sorted, sorted + fill, value) - sorted;
+    memmove(sorted + pos + 1, sorted + pos, (fill - pos) * sizeof(double));
+    sorted[pos] = value;
+    fill++;
+
+    ring[head] = value;
+    head = (head + 1) % w;
+
+    return result;
+}
+
+/* Convert Hampel result to reason text in dust_outliers.csv
+* Input: result of checkHampelOutlier()
+* Output: reason string */
+string hampelReason(int result)
+{
+    if (result == HAMPEL_SPIKE)
+        return "spike";
+    if (result == HAMPEL_STUCK)
+        return "stuck";
+    return "";
+}
+
+#endif
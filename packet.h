@@ -0,0 +1,346 @@
+/***********************************************************
+* Program: packet.h
+* Purpose: Create data packet of dust concentration
+************************************************************/
+
+#ifndef PACKET_H
+#define PACKET_H
+
+#include "header.h"
+#include "writer.h"
+#include "readfile.h"
+#include <cstdint>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <nmmintrin.h>
+#define CRC32C_SSE42
+#endif
+
+/* Define datatype of each data in packet */
+typedef unsigned char packet_id;
+typedef unsigned char packet_start_end;
+typedef int packet_time;
+typedef float packet_value;
+typedef short int packet_aqi;
+typedef unsigned char packet_checksum;
+typedef unsigned char packet_length;
+
+const packet_length PACKET_SIZE = sizeof(packet_aqi) + sizeof(packet_checksum) 
+                                + sizeof(packet_id) + sizeof(packet_length)
+                                + sizeof(packet_time) + sizeof(packet_value)
+                                + 2 * sizeof(packet_start_end);
+const packet_start_end START_BYTE = 0x7A;
+const packet_start_end END_BYTE = 0x7F;
+
+/* Convert date and time to time in seconds
+* Input: time string
+* Output: time in seconds */
+packet_time UnixTimestampConvert(string time_str) 
+{
+    return static_cast<packet_time>(parseTimestamp(time_str));
+}
+
+/* Write data packet in byte array, values are in big-endian order
+* Input: byte array (PACKET_SIZE bytes), id, time in seconds, dust concentration and AQI
+* Output: packet in byte array */
+void fillPacket(packet_checksum *bytes, packet_id id_num, packet_time time_num, packet_value value_num, 
+    packet_aqi aqi_num) 
+{
+    uint32_t time_bits = (uint32_t)time_num, value_bits;
+    memcpy(&value_bits, &value_num, sizeof(value_bits));
+    bytes[0] = START_BYTE;
+    bytes[1] = PACKET_SIZE;
+    bytes[2] = id_num;
+    for (int i = 0; i < 4; i++) 
+    {
+        bytes[3 + i] = (packet_checksum)(time_bits >> (24 - 8 * i));
+        bytes[7 + i] = (packet_checksum)(value_bits >> (24 - 8 * i));
+    }
+    bytes[11] = (packet_checksum)((uint16_t)aqi_num >> 8);
+    bytes[12] = (packet_checksum)aqi_num;
+
+    /* checksum makes sum of bytes from length to checksum zero */
+    packet_checksum checksum = 0;
+    for (int i = 1; i < PACKET_SIZE - 2; i++) 
+        checksum += bytes[i];
+    bytes[PACKET_SIZE - 2] = (packet_checksum)(~checksum + 1);
+    bytes[PACKET_SIZE - 1] = END_BYTE;
+}
+
+/* Create data packet from values
+* Input: id, time in seconds, dust concentration and AQI
+* Output: vector<packet_checksum> packet storing byte array */
+vector<packet_checksum> buildPacket(packet_id id_num, packet_time time_num, packet_value value_num, packet_aqi aqi_num) 
+{
+    vector<packet_checksum> packet(PACKET_SIZE);
+    fillPacket(packet.data(), id_num, time_num, value_num, aqi_num);
+    return packet;
+}
+
+/* Read packet created by buildPacket(), bytes are in big-endian order
+* Input: byte array (PACKET_SIZE bytes), id, time, value and AQI (output)
+* Output: true (if start, length, checksum and end byte are correct) or false */
+bool parsePacket(const unsigned char *bytes, packet_id &id_num, packet_time &time_num, 
+    packet_value &value_num, packet_aqi &aqi_num) 
+{
+    if (bytes[0] != START_BYTE || bytes[1] != PACKET_SIZE || bytes[PACKET_SIZE - 1] != END_BYTE)
+        return false;
+
+    /* sum of bytes from length to checksum is zero */
+    packet_checksum sum = 0;
+    for (int i = 1; i < PACKET_SIZE - 1; i++)
+        sum += bytes[i];
+    if (sum != 0)
+        return false;
+
+    uint32_t time_bits = ((uint32_t)bytes[3] << 24) | ((uint32_t)bytes[4] << 16) | ((uint32_t)bytes[5] << 8) | bytes[6];
+    uint32_t value_bits = ((uint32_t)bytes[7] << 24) | ((uint32_t)bytes[8] << 16) | ((uint32_t)bytes[9] << 8) | bytes[10];
+    id_num = bytes[2];
+    time_num = (packet_time)time_bits;
+    memcpy(&value_num, &value_bits, sizeof(value_num));
+    aqi_num = (packet_aqi)((bytes[11] << 8) | bytes[12]);
+    return true;
+}
+
+/* Write packet of in output file
+* Input: 
+    OUTPUT_STREAM: buffer of output file
+    vector<packet_checksum> packet from loadingPacket()
+* Output: line of hexa array */
+void writePacket(WriteBuffer &OUTPUT_STREAM, vector<packet_checksum> &packet) 
+{
+    for (const packet_checksum& byte : packet)
+        writeHexByte(OUTPUT_STREAM, byte);
+    writeChar(OUTPUT_STREAM, '\n');
+}
+
+/* Append packet as hexa array to text, same format as writePacket()
+* Input: 
+    text: output text
+    packet: byte array from fillPacket() and its size
+* Output: line of hexa array at end of text */
+void appendPacket(string &text, const packet_checksum *packet, size_t size) 
+{
+    static const char HEXA_DIGITS[] = "0123456789ABCDEF";
+    for (size_t i = 0; i < size; i++) 
+    {
+        text.push_back(HEXA_DIGITS[packet[i] >> 4]);
+        text.push_back(HEXA_DIGITS[packet[i] & 0x0F]);
+        text.push_back(' ');
+    }
+    text.push_back('\n');
+}
+
+/* Append packet as hexa array to text
+* Input: text, vector<packet_checksum> packet from buildPacket()
+* Output: line of hexa array at end of text */
+void appendPacket(string &text, const vector<packet_checksum> &packet) 
+{
+    appendPacket(text, packet.data(), packet.size());
+}
+
+/* Packet version 2: many records of one hour in a frame
+    START_BYTE_V2 | version | payload length (varint) | payload | CRC32C (4 bytes) | END_BYTE
+payload:
+    base time (4 bytes) | number of records (varint) | records
+record (varint):
+    id - previous id (zigzag) | time - base time (zigzag) | value in 0.1 unit | AQI
+Previous id of first record is 0. CRC32C covers version, length and payload */
+const packet_start_end START_BYTE_V2 = 0x7B;
+const unsigned char PACKET_VERSION_2 = 2;
+#define FRAME_MAX_RECORDS   512             /* records per frame */
+
+/* Structure for one record in frame */
+struct FrameRecord 
+{
+    int id;
+    packet_time time;
+    int value;                  /* dust concentration in 0.1 unit */
+    int aqi;
+};
+
+/* Table for CRC32C (Castagnoli polynomial, reflected) */
+uint32_t CRC32C_TABLE[256];
+
+void initCRC32CTable() 
+{
+    for (uint32_t i = 0; i < 256; i++) 
+    {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc & 1) ? (crc >> 1) ^ 0x82F63B78 : crc >> 1;
+        CRC32C_TABLE[i] = crc;
+    }
+}
+
+#ifdef CRC32C_SSE42
+/* CRC32C with SSE4.2 instruction, 8 bytes per step */
+__attribute__((target("sse4.2")))
+uint32_t crc32cHardware(const unsigned char *data, size_t size) 
+{
+    uint64_t crc = 0xFFFFFFFF;
+    for (; size >= 8; data += 8, size -= 8) 
+    {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        crc = _mm_crc32_u64(crc, word);
+    }
+    uint32_t crc32 = (uint32_t)crc;
+    for (; size > 0; data++, size--)
+        crc32 = _mm_crc32_u8(crc32, *data);
+    return ~crc32;
+}
+#endif
+
+/* Calculate CRC32C, use SSE4.2 if processor has it
+* Input: byte array and its size
+* Output: CRC32C */
+uint32_t calculateCRC32C(const unsigned char *data, size_t size) 
+{
+#ifdef CRC32C_SSE42
+    static const bool hardware = __builtin_cpu_supports("sse4.2");
+    if (hardware)
+        return crc32cHardware(data, size);
+#endif
+    static const bool table_ready = (initCRC32CTable(), true);
+    (void)table_ready;
+
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < size; i++)
+        crc = CRC32C_TABLE[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+/* Append unsigned number as varint (7 bits per byte, low bits first)
+* Input: byte array, number */
+void appendVarint(vector<unsigned char> &bytes, uint32_t num) 
+{
+    while (num >= 0x80) 
+    {
+        bytes.push_back((unsigned char)(num | 0x80));
+        num >>= 7;
+    }
+    bytes.push_back((unsigned char)num);
+}
+
+/* Read varint
+* Input: byte array, position (moved after varint), end of array
+* Output: true (if success) or false */
+bool readVarint(const unsigned char *bytes, size_t &pos, size_t size, uint32_t &num) 
+{
+    num = 0;
+    for (int shift = 0; shift < 35 && pos < size; shift += 7) 
+    {
+        unsigned char byte = bytes[pos++];
+        num |= (uint32_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
+
+/* Map signed number to unsigned, small magnitude gets small number */
+inline uint32_t zigzagEncode(int num) 
+{
+    return ((uint32_t)num << 1) ^ (uint32_t)(num >> 31);
+}
+
+inline int zigzagDecode(uint32_t num) 
+{
+    return (int)(num >> 1) ^ -(int)(num & 1);
+}
+
+/* Append 4-byte number, most significant byte first */
+void appendUint32(vector<unsigned char> &bytes, uint32_t num) 
+{
+    for (int shift = 24; shift >= 0; shift -= 8)
+        bytes.push_back((unsigned char)(num >> shift));
+}
+
+uint32_t readUint32(const unsigned char *bytes) 
+{
+    return ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | bytes[3];
+}
+
+/* Create version 2 frame
+* Input: records, number of records and base time
+* Output: byte array of frame
+* Pre-condition: 1 <= count <= FRAME_MAX_RECORDS */
+vector<unsigned char> buildFrameV2(const FrameRecord *records, int count, packet_time base_time) 
+{
+    vector<unsigned char> payload;
+    payload.reserve(8 + count * 6);
+    appendUint32(payload, (uint32_t)base_time);
+    appendVarint(payload, count);
+
+    int previous_id = 0;
+    for (int i = 0; i < count; i++) 
+    {
+        appendVarint(payload, zigzagEncode(records[i].id - previous_id));
+        appendVarint(payload, zigzagEncode(records[i].time - base_time));
+        appendVarint(payload, records[i].value);
+        appendVarint(payload, records[i].aqi);
+        previous_id = records[i].id;
+    }
+
+    vector<unsigned char> frame;
+    frame.reserve(payload.size() + 12);
+    frame.push_back(START_BYTE_V2);
+    frame.push_back(PACKET_VERSION_2);
+    appendVarint(frame, payload.size());
+    frame.insert(frame.end(), payload.begin(), payload.end());
+    appendUint32(frame, calculateCRC32C(frame.data() + 1, frame.size() - 1));
+    frame.push_back(END_BYTE);
+    return frame;
+}
+
+/* Read version 2 frame
+* Input: byte array, its size, records (output), number of bytes used (output)
+* Output: true (if frame is complete and CRC is correct) or false */
+bool parseFrameV2(const unsigned char *bytes, size_t size, vector<FrameRecord> &records, size_t &used) 
+{
+    size_t pos = 0;
+    uint32_t payload_size, count, num;
+    if (size < 2 || bytes[0] != START_BYTE_V2 || bytes[1] != PACKET_VERSION_2)
+        return false;
+
+    pos = 2;
+    if (!readVarint(bytes, pos, size, payload_size) || pos + payload_size + 5 > size)
+        return false;
+
+    size_t payload_end = pos + payload_size;
+    if (bytes[payload_end + 4] != END_BYTE
+        || readUint32(bytes + payload_end) != calculateCRC32C(bytes + 1, payload_end - 1))
+        return false;
+
+    if (payload_size < 4)
+        return false;
+    packet_time base_time = (packet_time)readUint32(bytes + pos);
+    pos += 4;
+    if (!readVarint(bytes, pos, payload_end, count))
+        return false;
+
+    int previous_id = 0;
+    for (uint32_t i = 0; i < count; i++) 
+    {
+        FrameRecord record;
+        if (!readVarint(bytes, pos, payload_end, num))
+            return false;
+        record.id = previous_id + zigzagDecode(num);
+        if (!readVarint(bytes, pos, payload_end, num))
+            return false;
+        record.time = base_time + zigzagDecode(num);
+        if (!readVarint(bytes, pos, payload_end, num))
+            return false;
+        record.value = num;
+        if (!readVarint(bytes, pos, payload_end, num))
+            return false;
+        record.aqi = num;
+        previous_id = record.id;
+        records.push_back(record);
+    }
+
+    used = payload_end + 5;
+    return pos == payload_end;
+}
+
+#endif
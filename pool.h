@@ -0,0 +1,198 @@
+/***********************************************************
+* Program: pool.h
+* Purpose: Work-stealing thread pool for tasks which spawn sub-tasks
+************************************************************/
+
+#ifndef POOL_H
+#define POOL_H
+
+#include "header.h"
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <memory>
+
+/* Structure for set of tasks which are waited together */
+struct TaskGroup
+{
+    atomic<int> pending;                /* tasks not finished yet */
+    TaskGroup() : pending(0) {}
+};
+
+/* Structure for task in queue */
+struct PoolTask
+{
+    function<void()> run;
+    TaskGroup *group;
+};
+
+/* Structure for queue of one worker.
+Owner takes newest task from back, other threads steal oldest task from front */
+struct WorkerQueue
+{
+    mutex lock;
+    deque<PoolTask> tasks;
+};
+
+/* Structure for pool. Thread waiting for group runs queued tasks meanwhile,
+so tasks can wait for their sub-tasks without blocking workers */
+struct WorkPool
+{
+    vector<unique_ptr<WorkerQueue>> queues;     /* one per worker */
+    vector<thread> workers;
+    atomic<int> num_queued;             /* tasks in all queues */
+    atomic<unsigned> next_queue;        /* queue of next task from other threads */
+    bool stopping;
+    mutex signal_lock;
+    condition_variable signal;          /* task is queued, group is finished or pool stops */
+};
+
+/* index of queue owned by current thread, -1 if it is not a worker */
+thread_local int pool_worker = -1;
+
+/* Wake up threads waiting in pool
+* Input: pool */
+void signalPool(WorkPool &pool)
+{
+    {
+        lock_guard<mutex> guard(pool.signal_lock);
+    }
+    pool.signal.notify_all();
+}
+
+/* Take task of own queue, steal from other queues if it is empty
+* Inputs: pool, task
+* Output: true (if get task) or false */
+bool takeTask(WorkPool &pool, PoolTask &task)
+{
+    int num_queues = pool.queues.size();
+    int own = pool_worker;
+    if (own >= 0)
+    {
+        WorkerQueue &queue = *pool.queues[own];
+        lock_guard<mutex> guard(queue.lock);
+        if (!queue.tasks.empty())
+        {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+            pool.num_queued--;
+            return true;
+        }
+    }
+
+    /* steal, starting after own queue so that thieves spread out */
+    for (int i = 1; i <= num_queues; i++)
+    {
+        int victim = (own + i + num_queues) % num_queues;
+        if (victim == own)
+            continue;
+        WorkerQueue &queue = *pool.queues[victim];
+        lock_guard<mutex> guard(queue.lock);
+        if (!queue.tasks.empty())
+        {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            pool.num_queued--;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Run task and mark it finished in its group
+* Inputs: pool, task */
+void runTask(WorkPool &pool, PoolTask &task)
+{
+    task.run();
+    if (--task.group->pending == 0)
+        signalPool(pool);
+}
+
+/* Worker thread: run tasks until pool stops
+* Inputs: pool, index of own queue */
+void poolWorker(WorkPool &pool, int index)
+{
+    pool_worker = index;
+    PoolTask task;
+    while (true)
+    {
+        if (takeTask(pool, task))
+        {
+            runTask(pool, task);
+            continue;
+        }
+
+        unique_lock<mutex> guard(pool.signal_lock);
+        pool.signal.wait(guard, [&] { return pool.num_queued > 0 || pool.stopping; });
+        if (pool.stopping && pool.num_queued == 0)
+            return;
+    }
+}
+
+/* Start workers
+* Inputs: pool, number of worker threads (at least 1) */
+void initPool(WorkPool &pool, int num_threads)
+{
+    pool.num_queued = 0;
+    pool.next_queue = 0;
+    pool.stopping = false;
+    for (int i = 0; i < num_threads; i++)
+        pool.queues.push_back(unique_ptr<WorkerQueue>(new WorkerQueue));
+    for (int i = 0; i < num_threads; i++)
+        pool.workers.push_back(thread(poolWorker, ref(pool), i));
+}
+
+/* Queue task in group. Worker puts it in own queue, other threads spread tasks over queues
+* Inputs: pool, group, task */
+void spawnTask(WorkPool &pool, TaskGroup &group, function<void()> run)
+{
+    group.pending++;
+    int index = pool_worker;
+    if (index < 0)
+        index = pool.next_queue++ % pool.queues.size();
+    {
+        WorkerQueue &queue = *pool.queues[index];
+        lock_guard<mutex> guard(queue.lock);
+        queue.tasks.push_back({std::move(run), &group});
+        pool.num_queued++;
+    }
+    signalPool(pool);
+}
+
+/* Wait until all tasks of group are finished, run queued tasks meanwhile
+* Inputs: pool, group */
+void waitGroup(WorkPool &pool, TaskGroup &group)
+{
+    PoolTask task;
+    while (group.pending > 0)
+    {
+        if (takeTask(pool, task))
+        {
+            runTask(pool, task);
+            continue;
+        }
+
+        unique_lock<mutex> guard(pool.signal_lock);
+        pool.signal.wait(guard, [&] { return group.pending == 0 || pool.num_queued > 0; });
+    }
+}
+
+/* Stop workers after queued tasks are finished
+* Input: pool */
+void closePool(WorkPool &pool)
+{
+    {
+        lock_guard<mutex> guard(pool.signal_lock);
+        pool.stopping = true;
+    }
+    pool.signal.notify_all();
+    for (thread &worker : pool.workers)
+        worker.join();
+    pool.workers.clear();
+    pool.queues.clear();
+}
+
+#endif
@@ -0,0 +1,561 @@
+/***********************************************************
+* Program: query.h
+* Purpose: Filter, group and rank hourly AQI data stored by column
+************************************************************/
+
+#ifndef QUERY_H
+#define QUERY_H
+
+#include "header.h"
+#include "readfile.h"
+#include "writer.h"
+#include "aqi.h"
+#include "columnar.h"
+#include <cstdint>
+#include <cstring>
+#include <charconv>
+#include <algorithm>
+#include <unordered_map>
+#include <thread>
+
+/* group of query */
+#define GROUP_NONE          0           /* matching rows */
+#define GROUP_SENSOR        1
+#define GROUP_HOUR          2
+#define GROUP_DAY           3
+
+/* ranking of top-K */
+#define ORDER_AQI           1           /* AQI of row, max AQI of group */
+#define ORDER_VALUE         2           /* value of row, mean value of group */
+#define ORDER_HOURS         3           /* number of rows in group */
+
+#define LEVEL_UNKNOWN       255         /* AQI out of aqiRanges */
+#define QUERY_MIN_ROWS      (1 << 16)   /* rows per thread at least */
+
+/* Structure for hourly AQI data, one array per column.
+Arrays may belong to AQITable or to a mapped file */
+struct AQIColumns
+{
+    size_t num_rows;
+    int max_id;
+    const int32_t *id;
+    const uint32_t *time;           /* time in seconds */
+    const int32_t *value;           /* average value in 0.1 unit */
+    const int16_t *aqi;
+    const uint8_t *level;           /* row of aqiRanges */
+};
+
+/* Structure for columns loaded in memory */
+struct AQITable
+{
+    int max_id;
+    vector<int32_t> id;
+    vector<uint32_t> time;
+    vector<int32_t> value;
+    vector<int16_t> aqi;
+    vector<uint8_t> level;
+};
+
+/* Structure for query options */
+struct AQIQuery
+{
+    uint32_t time_from;             /* time range, both ends included */
+    uint32_t time_to;
+    int id_min;                     /* id range, both ends included */
+    int id_max;
+    int level_min;                  /* level range, both ends included */
+    int level_max;
+    int group;
+    int order;
+    bool ascending;                 /* best first instead of worst first */
+    size_t top;                     /* number of results, 0 for all */
+};
+
+/* Structure for result of one group */
+struct QueryGroup
+{
+    int64_t key;                    /* id, start of hour or start of day */
+    int hours;                      /* number of matching rows */
+    int64_t sum_value;              /* 0.1 unit */
+    int max_aqi;
+};
+
+/* Structure for row with its rank */
+struct RankedRow
+{
+    double rank;
+    size_t row;
+};
+
+/* Structure for result of one thread */
+struct QueryPartial
+{
+    vector<RankedRow> rows;                     /* matching rows, bounded heap if top > 0 */
+    vector<QueryGroup> sensors;                 /* indexed by id */
+    unordered_map<int64_t, QueryGroup> times;   /* by start of hour or day */
+    size_t num_matched;
+};
+
+/* Set default query, all rows match
+* Input: query */
+void initQuery(AQIQuery &query)
+{
+    query.time_from = 0;
+    query.time_to = UINT32_MAX;
+    query.id_min = 1;
+    query.id_max = INT32_MAX;
+    query.level_min = 0;
+    query.level_max = LEVEL_UNKNOWN;
+    query.group = GROUP_NONE;
+    query.order = ORDER_AQI;
+    query.ascending = false;
+    query.top = 0;
+}
+
+/* Convert time option to time in seconds
+* Inputs: YYYY:MM:DD hh:mm:ss or YYYY:MM:DD, end of day or not (for date only), result
+* Output: true (if time is valid) or false */
+bool parseQueryTime(string time_str, bool end_of_day, uint32_t &time_num)
+{
+    if (time_str.size() == 10)
+        time_str.append(end_of_day ? " 23:59:59" : " 00:00:00");
+    if (time_str.size() != 19 || !checkDateFormat(time_str))
+        return false;
+
+    time_t result = parseTimestamp(time_str);
+    if (result < 0)
+        return false;
+    time_num = static_cast<uint32_t>(result);
+    return true;
+}
+
+/* Set option of query
+* Inputs: option, value, query
+* Output: true (if option and value are valid) or false */
+bool parseQueryOption(const string &option, const string &value, AQIQuery &query)
+{
+    if (option == "-from")
+        return parseQueryTime(value, false, query.time_from);
+    if (option == "-to")
+        return parseQueryTime(value, true, query.time_to);
+    if (option == "-id")
+    {
+        /* single id or range first-last */
+        size_t dash = value.find('-');
+        query.id_min = atoi(value.substr(0, dash).c_str());
+        query.id_max = (dash == string::npos) ? query.id_min : atoi(value.substr(dash + 1).c_str());
+        return query.id_min >= 1 && query.id_max >= query.id_min;
+    }
+    if (option == "-level")
+    {
+        query.level_min = query.level_max = findLevel(value);
+        return query.level_min >= 0;
+    }
+    if (option == "-min-level")
+    {
+        query.level_min = findLevel(value);
+        return query.level_min >= 0;
+    }
+    if (option == "-group")
+    {
+        query.group = (value == "sensor") ? GROUP_SENSOR : (value == "hour") ? GROUP_HOUR
+                    : (value == "day") ? GROUP_DAY : -1;
+        return query.group != -1;
+    }
+    if (option == "-top")
+    {
+        query.top = atoi(value.c_str());
+        return atoi(value.c_str()) >= 1;
+    }
+    if (option == "-by")
+    {
+        query.order = (value == "aqi") ? ORDER_AQI : (value == "value") ? ORDER_VALUE
+                    : (value == "hours") ? ORDER_HOURS : -1;
+        return query.order != -1;
+    }
+    if (option == "-order" && (value == "desc" || value == "asc"))
+    {
+        query.ascending = (value == "asc");
+        return true;
+    }
+    return false;
+}
+
+/* Check if options of query fit together, number of rows is only a rank of groups
+* Input: query
+* Output: true or false */
+bool checkQuery(const AQIQuery &query)
+{
+    return !(query.order == ORDER_HOURS && query.group == GROUP_NONE);
+}
+
+/* Get columns of table
+* Input: table
+* Output: columns pointing to table */
+AQIColumns tableColumns(const AQITable &table)
+{
+    return {table.id.size(), table.max_id, table.id.data(), table.time.data(),
+        table.value.data(), table.aqi.data(), table.level.data()};
+}
+
+/* Load dust_aqi.csv format file in columns
+* Inputs: file name, table, line position of invalid line (output)
+* Output: true (if all lines are valid) or false */
+bool loadAQITable(string file_name, AQITable &table, int &error_line)
+{
+    ifstream input_file(file_name, ios::binary);
+    string textline;
+    char last_time[19] = {0};
+    uint32_t time_num = 0;
+    int linePos = 0;
+
+    table.max_id = 0;
+    error_line = 0;
+    getline(input_file, textline);          /* skip first line */
+
+    while (getline(input_file, textline))
+    {
+        linePos++;
+        if (!textline.empty() && textline.back() == '\r')
+            textline.pop_back();
+
+        /* id,YYYY:MM:DD hh:mm:ss,value,aqi,pollution */
+        const char *p = textline.data(), *end = p + textline.size();
+        int id = 0, value = 0, aqi = 0;
+        from_chars_result r = from_chars(p, end, id);
+        bool valid = (r.ec == errc()) && (id > 0) && (end - r.ptr > 21) && (r.ptr[0] == ',') && (r.ptr[20] == ',');
+        if (valid && memcmp(last_time, r.ptr + 1, 19) != 0)
+        {
+            /* time string is the same for all sensors of one hour */
+            string time_str(r.ptr + 1, 19);
+            valid = checkDateFormat(time_str);
+            time_num = static_cast<uint32_t>(parseTimestamp(time_str));
+            memcpy(last_time, r.ptr + 1, 19);
+        }
+        if (valid)
+        {
+            /* value in 0.1 unit, parsed the same way as in dust_process */
+            const char *value_end = find(r.ptr + 21, end, ',');
+            valid = (value_end < end) && parseDustValue(string_view(r.ptr + 21, value_end - r.ptr - 21), value)
+                && (value >= 0);
+            r.ptr = value_end;
+        }
+        if (valid)
+        {
+            r = from_chars(r.ptr + 1, end, aqi);
+            valid = (r.ec == errc()) && (aqi >= 0);
+        }
+        if (!valid)
+        {
+            error_line = linePos;
+            return false;
+        }
+
+        int level = levelIndex(aqi);
+        table.id.push_back(id);
+        table.time.push_back(time_num);
+        table.value.push_back(value);
+        table.aqi.push_back(static_cast<int16_t>(aqi));
+        table.level.push_back(level < 0 ? LEVEL_UNKNOWN : level);
+        table.max_id = max(table.max_id, id);
+    }
+    return true;
+}
+
+/* Use columns of mapped dust_aqi.col in place, no value is copied
+* Inputs: column file (kept open while columns are used), columns
+* Output: true (if file has every column with expected type and level dictionary) or false */
+bool columnFileColumns(const ColumnFile &file, AQIColumns &columns)
+{
+    columns.num_rows = file.header->num_rows;
+    columns.id = (const int32_t*)findColumn(file, "id", COLUMN_INT32);
+    columns.time = (const uint32_t*)findColumn(file, "time", COLUMN_UINT32);
+    columns.value = (const int32_t*)findColumn(file, "value", COLUMN_INT32);
+    columns.aqi = (const int16_t*)findColumn(file, "aqi", COLUMN_INT16);
+    columns.level = (const uint8_t*)findColumn(file, "level", COLUMN_DICT8);
+
+    vector<string> levels;
+    if (columns.id == NULL || columns.time == NULL || columns.value == NULL || columns.aqi == NULL
+        || columns.level == NULL || !findDictionary(file, "level", levels) || levels.size() != aqiRanges.size())
+        return false;
+
+    /* level code is row of aqiRanges, LEVEL_UNKNOWN is COLUMN_NULL */
+    for (size_t i = 0; i < levels.size(); i++)
+    {
+        if (levels[i] != aqiRanges[i].level)
+            return false;
+    }
+
+    /* ids index groups of sensors */
+    columns.max_id = 0;
+    for (size_t i = 0; i < columns.num_rows; i++)
+    {
+        if (columns.id[i] < 0)
+            return false;
+        columns.max_id = max(columns.max_id, (int)columns.id[i]);
+    }
+    return true;
+}
+
+/* Find start of local day
+* Input: time in seconds
+* Output: time in seconds of 00:00:00 on the same day */
+int64_t dayStart(time_t time_num)
+{
+    tm local;
+#ifdef _WIN32
+    localtime_s(&local, &time_num);
+#else
+    localtime_r(&time_num, &local);
+#endif
+    return (int64_t)time_num - (local.tm_hour * 3600 + local.tm_min * 60 + local.tm_sec);
+}
+
+/* Check if row a comes before row b in result
+* Inputs: rows, order of result */
+inline bool rankedBefore(const RankedRow &a, const RankedRow &b, bool ascending)
+{
+    if (a.rank != b.rank)
+        return ascending ? (a.rank < b.rank) : (a.rank > b.rank);
+    return a.row < b.row;
+}
+
+/* Get rank of group
+* Inputs: group, order of query
+* Output: rank */
+inline double groupRank(const QueryGroup &group, int order)
+{
+    if (order == ORDER_HOURS)
+        return group.hours;
+    if (order == ORDER_VALUE)
+        return (double)group.sum_value / group.hours;
+    return group.max_aqi;
+}
+
+/* Add row to bounded heap, the last row of result is on top
+* Inputs: heap, maximum size, row, order of result */
+inline void offerRow(vector<RankedRow> &heap, size_t top, const RankedRow &row, bool ascending)
+{
+    auto before = [ascending](const RankedRow &a, const RankedRow &b) { return rankedBefore(a, b, ascending); };
+    if (heap.size() < top)
+    {
+        heap.push_back(row);
+        push_heap(heap.begin(), heap.end(), before);
+    }
+    else if (before(row, heap.front()))
+    {
+        pop_heap(heap.begin(), heap.end(), before);
+        heap.back() = row;
+        push_heap(heap.begin(), heap.end(), before);
+    }
+}
+
+/* Add matching row to group
+* Inputs: group, value and AQI of row */
+inline void addGroupRow(QueryGroup &group, int32_t value, int16_t aqi)
+{
+    group.hours++;
+    group.sum_value += value;
+    group.max_aqi = max(group.max_aqi, (int)aqi);
+}
+
+/* Scan part of rows
+* Inputs: columns, query, row range [begin, end), result of this part */
+void scanRows(const AQIColumns &columns, const AQIQuery &query, size_t begin, size_t end, QueryPartial &partial)
+{
+    partial.num_matched = 0;
+    if (query.group == GROUP_SENSOR)
+        partial.sensors.assign(columns.max_id + 1, {0, 0, 0, 0});
+
+    uint32_t last_time = 0;
+    int64_t last_key = 0;                   /* key of last group */
+    QueryGroup *last_group = NULL;          /* rows of one hour are next to each other */
+    for (size_t i = begin; i < end; i++)
+    {
+        if (columns.time[i] < query.time_from || columns.time[i] > query.time_to
+            || columns.id[i] < query.id_min || columns.id[i] > query.id_max
+            || columns.level[i] < query.level_min || columns.level[i] > query.level_max)
+            continue;
+        partial.num_matched++;
+
+        if (query.group == GROUP_NONE && query.top == 0)
+            partial.rows.push_back({0.0, i});
+        else if (query.group == GROUP_NONE)
+            offerRow(partial.rows, query.top,
+                {(query.order == ORDER_VALUE) ? (double)columns.value[i] : (double)columns.aqi[i], i}, query.ascending);
+        else if (query.group == GROUP_SENSOR)
+            addGroupRow(partial.sensors[columns.id[i]], columns.value[i], columns.aqi[i]);
+        else
+        {
+            if (last_group == NULL || columns.time[i] != last_time)
+            {
+                last_time = columns.time[i];
+                int64_t key = (query.group == GROUP_DAY) ? dayStart(last_time) : last_time;
+                if (last_group == NULL || key != last_key)
+                    last_group = &partial.times.try_emplace(key, QueryGroup{key, 0, 0, 0}).first->second;
+                last_key = key;
+            }
+            addGroupRow(*last_group, columns.value[i], columns.aqi[i]);
+        }
+    }
+}
+
+/* Run query on all rows with threads
+* Inputs: columns, query, number of threads,
+    rows: matching rows in result order (output, group none)
+    groups: groups in result order (output, other groups)
+* Output: number of matching rows */
+size_t runQuery(const AQIColumns &columns, const AQIQuery &query, int num_threads,
+    vector<size_t> &rows, vector<QueryGroup> &groups)
+{
+    /* small tables are not worth a thread */
+    size_t max_threads = max((size_t)1, columns.num_rows / QUERY_MIN_ROWS);
+    num_threads = (int)min((size_t)max(num_threads, 1), max_threads);
+
+    vector<QueryPartial> partials(num_threads);
+    vector<thread> workers;
+    for (int t = 0; t < num_threads; t++)
+    {
+        size_t begin = columns.num_rows * t / num_threads, end = columns.num_rows * (t + 1) / num_threads;
+        workers.push_back(thread(scanRows, cref(columns), cref(query), begin, end, ref(partials[t])));
+    }
+    for (thread &worker : workers)
+        worker.join();
+
+    size_t num_matched = 0;
+    rows.clear();
+    groups.clear();
+
+    /* merge results of threads */
+    vector<RankedRow> heap;
+    unordered_map<int64_t, QueryGroup> times;
+    for (QueryPartial &partial : partials)
+    {
+        num_matched += partial.num_matched;
+        if (query.group == GROUP_NONE && query.top == 0)
+        {
+            for (const RankedRow &row : partial.rows)
+                rows.push_back(row.row);
+        }
+        else if (query.group == GROUP_NONE)
+        {
+            for (const RankedRow &row : partial.rows)
+                offerRow(heap, query.top, row, query.ascending);
+        }
+        else if (query.group == GROUP_SENSOR)
+        {
+            if (groups.empty())
+                groups.assign(partial.sensors.size(), {0, 0, 0, 0});
+            for (size_t id = 0; id < partial.sensors.size(); id++)
+            {
+                groups[id].key = id;
+                groups[id].hours += partial.sensors[id].hours;
+                groups[id].sum_value += partial.sensors[id].sum_value;
+                groups[id].max_aqi = max(groups[id].max_aqi, partial.sensors[id].max_aqi);
+            }
+        }
+        else
+        {
+            for (const auto &entry : partial.times)
+            {
+                QueryGroup &group = times.try_emplace(entry.first, QueryGroup{entry.first, 0, 0, 0}).first->second;
+                group.hours += entry.second.hours;
+                group.sum_value += entry.second.sum_value;
+                group.max_aqi = max(group.max_aqi, entry.second.max_aqi);
+            }
+        }
+    }
+
+    if (query.group == GROUP_NONE)
+    {
+        sort_heap(heap.begin(), heap.end(),
+            [&](const RankedRow &a, const RankedRow &b) { return rankedBefore(a, b, query.ascending); });
+        for (const RankedRow &row : heap)
+            rows.push_back(row.row);
+        return num_matched;
+    }
+
+    for (const auto &entry : times)
+        groups.push_back(entry.second);
+    groups.erase(remove_if(groups.begin(), groups.end(),
+        [](const QueryGroup &group) { return group.hours == 0; }), groups.end());
+
+    if (query.top == 0)
+    {
+        sort(groups.begin(), groups.end(),
+            [](const QueryGroup &a, const QueryGroup &b) { return a.key < b.key; });
+        return num_matched;
+    }
+
+    /* partial selection of top-K groups, then sort only them */
+    auto before = [&](const QueryGroup &a, const QueryGroup &b)
+    {
+        double rank_a = groupRank(a, query.order), rank_b = groupRank(b, query.order);
+        if (rank_a != rank_b)
+            return query.ascending ? (rank_a < rank_b) : (rank_a > rank_b);
+        return a.key < b.key;
+    };
+    if (groups.size() > query.top)
+    {
+        nth_element(groups.begin(), groups.begin() + query.top, groups.end(), before);
+        groups.resize(query.top);
+    }
+    sort(groups.begin(), groups.end(), before);
+    return num_matched;
+}
+
+/* Write matching rows in dust_aqi.csv format
+* Inputs: buffer of output file, columns, rows */
+void writeQueryRows(WriteBuffer &out, const AQIColumns &columns, const vector<size_t> &rows)
+{
+    writeText(out, "id,time,value,aqi,pollution\n");
+    for (size_t i : rows)
+    {
+        writeInt(out, columns.id[i]);
+        writeChar(out, ',');
+        writeTimestamp(out, columns.time[i]);
+        writeChar(out, ',');
+        writeTenths(out, columns.value[i]);
+        writeChar(out, ',');
+        writeInt(out, columns.aqi[i]);
+        writeChar(out, ',');
+        if (columns.level[i] != LEVEL_UNKNOWN)
+            writeText(out, aqiRanges[columns.level[i]].level);
+        writeChar(out, '\n');
+    }
+}
+
+/* Write groups
+* Inputs: buffer of output file, groups, group of query */
+void writeQueryGroups(WriteBuffer &out, const vector<QueryGroup> &groups, int group_by)
+{
+    writeText(out, (group_by == GROUP_SENSOR) ? "id" : (group_by == GROUP_HOUR) ? "time" : "day");
+    writeText(out, ",hours,value,aqi,max_aqi,pollution\n");
+    for (const QueryGroup &group : groups)
+    {
+        if (group_by == GROUP_SENSOR)
+            writeInt(out, group.key);
+        else
+        {
+            char Timestamp[19];
+            formatTimestamp(Timestamp, (time_t)group.key);
+            writeText(out, Timestamp, (group_by == GROUP_HOUR) ? 19 : 10);
+        }
+
+        /* value rounded half away from zero as in rollups, AQI from exact average */
+        int ave_aqi = convertPM25toAQI((double)group.sum_value / (10.0 * group.hours));
+        writeChar(out, ',');
+        writeInt(out, group.hours);
+        writeChar(out, ',');
+        writeTenths(out, roundAverage(group.sum_value, group.hours));
+        writeChar(out, ',');
+        writeInt(out, ave_aqi);
+        writeChar(out, ',');
+        writeInt(out, group.max_aqi);
+        writeChar(out, ',');
+        writeText(out, AQItoLevel(ave_aqi));
+        writeChar(out, '\n');
+    }
+}
+
+#endif
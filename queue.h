@@ -0,0 +1,79 @@
+/***********************************************************
+* Program: queue.h
+* Purpose: Bounded queue for passing data between threads
+************************************************************/
+
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include "header.h"
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+/* Structure for queue with limited number of items.
+Producer waits when queue is full, consumer waits when queue is empty */
+template <typename item_type>
+struct BoundedQueue 
+{
+    deque<item_type> items;
+    size_t capacity;
+    bool closed;                        /* no more item will be pushed */
+    mutex lock;
+    condition_variable not_empty;
+    condition_variable not_full;
+};
+
+/* Set up queue
+* Inputs: queue, maximum number of items */
+template <typename item_type>
+void initQueue(BoundedQueue<item_type> &queue, size_t capacity) 
+{
+    queue.items.clear();
+    queue.capacity = capacity;
+    queue.closed = false;
+}
+
+/* Put item at end of queue, wait if queue is full
+* Inputs: queue, item */
+template <typename item_type>
+void pushQueue(BoundedQueue<item_type> &queue, item_type &&item) 
+{
+    unique_lock<mutex> guard(queue.lock);
+    queue.not_full.wait(guard, [&] { return queue.items.size() < queue.capacity; });
+    queue.items.push_back(std::move(item));
+    guard.unlock();
+    queue.not_empty.notify_one();
+}
+
+/* Take item from beginning of queue, wait if queue is empty
+* Inputs: queue, item
+* Output: true (if get item) or false (if queue is closed and empty) */
+template <typename item_type>
+bool popQueue(BoundedQueue<item_type> &queue, item_type &item) 
+{
+    unique_lock<mutex> guard(queue.lock);
+    queue.not_empty.wait(guard, [&] { return !queue.items.empty() || queue.closed; });
+    if (queue.items.empty())
+        return false;
+
+    item = std::move(queue.items.front());
+    queue.items.pop_front();
+    guard.unlock();
+    queue.not_full.notify_one();
+    return true;
+}
+
+/* Mark queue as closed, waiting consumers get false after last item
+* Input: queue */
+template <typename item_type>
+void closeQueue(BoundedQueue<item_type> &queue) 
+{
+    {
+        lock_guard<mutex> guard(queue.lock);
+        queue.closed = true;
+    }
+    queue.not_empty.notify_all();
+}
+
+#endif
@@ -96,6 +96,42 @@ bool scanFile(string file_name, string log_file, char access_mode)
     return true;
 }
 
+/* Check if date and time is in format YYYY:MM:DD hh:mm:ss
+* Inputs: time string
+* Output: true or false */
+bool checkDateFormat(string date) 
+{
+    /* extract time string in parts */
+    stringstream ss(date);
+    int year, month, day, hour, min, sec;
+    char colon1, colon2, colon3, colon4;
+    ss >> year >> colon1 >> month >> colon2 >> day >> hour >> colon3 >> min >> colon4 >> sec;
+
+    /* check if parts are valid */
+    if ((month >= 1 && month <= 12)
+        && (day >= 1 && day <= 31)
+        && (hour >= 0 && hour <= 23)
+        && (min >= 0 && min <= 59)
+        && (sec >= 0 && sec <= 59)
+        && (colon1 == ':') && (colon2 == ':') && (colon3 == ':') && (colon4 == ':'))
+        return true;
+
+    return false;
+}
+
+/* Convert date and time to time in seconds
+* Input: time string with format YYYY:MM:DD hh:mm:ss
+* Output: time in seconds (local time) */
+time_t parseTimestamp(const string &time_str) 
+{
+    tm timeStruct = {};
+    timeStruct.tm_isdst = -1;           /* let mktime() find daylight saving time */
+    stringstream ss(time_str);          
+    /* get time from time string */
+    ss >> get_time(&timeStruct, "%Y:%m:%d %H:%M:%S");
+    return mktime(&timeStruct); 
+}
+
 /* Check if file have same format as "dust_sensor.csv"
 * Input: file name and log file
 * Output: true (if correct) or false */
@@ -106,7 +142,7 @@ bool if_DUST_SENSOR_file(string file_name, string log_file)
     getline(INPUT_FILE, temp_str);
     if (temp_str != "id,time,value") 
     {
-        error(6, log_file);
+        error(04, log_file);
         return false;
     }
     return true;
@@ -123,7 +159,7 @@ bool if_DUST_AQI_file(string file_name, string log_file)
     
     if (temp_str != "id,time,value,aqi,pollution") 
     {
-        error(6, log_file);
+        error(04, log_file);
         return false;
     }
     return true;
@@ -0,0 +1,223 @@
+/***********************************************************
+* Program: ring.h
+* Purpose: Pass records between processes through shared memory ring (Linux only)
+************************************************************/
+
+#ifndef RING_H
+#define RING_H
+
+#include "header.h"
+
+#ifdef __linux__
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define RING_MAGIC          0x44555354      /* "DUST" */
+#define RING_CAPACITY       (1 << 16)       /* records, power of 2 */
+#define RING_WAIT_NS        100000000       /* wake up every 100 ms to check again */
+
+/* Structure for record passed between tools */
+struct RingRecord
+{
+    int32_t id;
+    int32_t aqi;                /* 0 if not calculated */
+    int64_t time;               /* time in seconds */
+    double value;
+};
+
+/* Slot of ring. seq tells who may use slot:
+seq == position: free for producer, seq == position + 1: ready for consumer */
+struct RingSlot
+{
+    atomic<uint64_t> seq;
+    RingRecord record;
+};
+
+/* Structure at beginning of shared memory */
+struct RingHeader
+{
+    atomic<uint32_t> magic;                 /* set when ring is ready */
+    uint32_t capacity;
+    uint32_t producers;                     /* number of producers taking part */
+    alignas(64) atomic<uint64_t> head;      /* next position to write */
+    alignas(64) atomic<uint64_t> tail;      /* next position to read */
+    alignas(64) atomic<uint32_t> data_futex;        /* changed when record is published */
+    atomic<uint32_t> space_futex;                   /* changed when record is consumed */
+    atomic<uint32_t> consumer_waiting;
+    atomic<uint32_t> producers_waiting;
+    atomic<uint32_t> producers_done;
+};
+
+/* Structure for ring opened by this process */
+struct SharedRing
+{
+    string name;
+    RingHeader *header;
+    RingSlot *slots;
+    size_t size;                /* bytes mapped */
+};
+
+/* Wait while futex word equals expected value, at most RING_WAIT_NS */
+void futexWait(atomic<uint32_t> *word, uint32_t expected)
+{
+    timespec timeout = {0, RING_WAIT_NS};
+    syscall(SYS_futex, (uint32_t*)word, FUTEX_WAIT, expected, &timeout, NULL, 0);
+}
+
+/* Wake all processes waiting on futex word */
+void futexWake(atomic<uint32_t> *word)
+{
+    syscall(SYS_futex, (uint32_t*)word, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+}
+
+/* Open shared memory ring, create it if it does not exist
+* Inputs: ring, name, number of producers (used by creator)
+* Output: true (if success) or false */
+bool openRing(SharedRing &ring, string name, int producers)
+{
+    ring.name = (name[0] == '/') ? name : "/" + name;
+    ring.size = sizeof(RingHeader) + (size_t)RING_CAPACITY * sizeof(RingSlot);
+
+    bool creator = true;
+    int fd = shm_open(ring.name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 && errno == EEXIST)
+    {
+        creator = false;
+        fd = shm_open(ring.name.c_str(), O_RDWR, 0600);
+    }
+    if (fd < 0 || (creator && ftruncate(fd, ring.size) != 0))
+    {
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+
+    /* wait until creator has set size */
+    struct stat info;
+    while (!creator && fstat(fd, &info) == 0 && (size_t)info.st_size < ring.size)
+        sched_yield();
+
+    void *memory = mmap(NULL, ring.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED)
+        return false;
+
+    ring.header = (RingHeader*)memory;
+    ring.slots = (RingSlot*)((char*)memory + sizeof(RingHeader));
+
+    if (creator)
+    {
+        ring.header->capacity = RING_CAPACITY;
+        ring.header->producers = producers;
+        ring.header->head = 0;
+        ring.header->tail = 0;
+        ring.header->data_futex = 0;
+        ring.header->space_futex = 0;
+        ring.header->consumer_waiting = 0;
+        ring.header->producers_waiting = 0;
+        ring.header->producers_done = 0;
+        for (uint32_t i = 0; i < RING_CAPACITY; i++)
+            ring.slots[i].seq.store(i, memory_order_relaxed);
+        ring.header->magic.store(RING_MAGIC, memory_order_release);
+    }
+    else
+    {
+        while (ring.header->magic.load(memory_order_acquire) != RING_MAGIC)
+            sched_yield();
+    }
+    return true;
+}
+
+/* Write record, wait if ring is full. Many producers can write at the same time
+* Inputs: ring, record */
+void pushRing(SharedRing &ring, const RingRecord &record)
+{
+    RingHeader *header = ring.header;
+    uint64_t pos = header->head.fetch_add(1);
+    RingSlot &slot = ring.slots[pos & (header->capacity - 1)];
+
+    /* slot is free when consumer has read record of previous round */
+    while (slot.seq.load(memory_order_acquire) != pos)
+    {
+        uint32_t space = header->space_futex.load();
+        header->producers_waiting.fetch_add(1);
+        if (slot.seq.load() != pos)
+            futexWait(&header->space_futex, space);
+        header->producers_waiting.fetch_sub(1);
+    }
+
+    slot.record = record;
+    slot.seq.store(pos + 1);                /* seq_cst: ordered with load of consumer_waiting */
+
+    if (header->consumer_waiting.load() != 0)
+    {
+        header->data_futex.fetch_add(1);
+        futexWake(&header->data_futex);
+    }
+}
+
+/* Tell consumer that this producer has finished
+* Input: ring */
+void finishRing(SharedRing &ring)
+{
+    ring.header->producers_done.fetch_add(1);
+    ring.header->data_futex.fetch_add(1);
+    futexWake(&ring.header->data_futex);
+}
+
+/* Read record, wait if ring is empty. Only one consumer
+* Inputs: ring, record (output)
+* Output: true (if get record) or false (if all producers finished and ring is empty) */
+bool popRing(SharedRing &ring, RingRecord &record)
+{
+    RingHeader *header = ring.header;
+    uint64_t pos = header->tail.load(memory_order_relaxed);
+    RingSlot &slot = ring.slots[pos & (header->capacity - 1)];
+
+    while (slot.seq.load(memory_order_acquire) != pos + 1)
+    {
+        /* all producers finished and every taken position is published */
+        if (header->producers_done.load() >= header->producers && header->head.load() == pos)
+            return false;
+
+        uint32_t data = header->data_futex.load();
+        header->consumer_waiting.store(1);
+        if (slot.seq.load() != pos + 1
+            && !(header->producers_done.load() >= header->producers && header->head.load() == pos))
+            futexWait(&header->data_futex, data);
+        header->consumer_waiting.store(0);
+    }
+
+    record = slot.record;
+    slot.seq.store(pos + header->capacity);
+    header->tail.store(pos + 1, memory_order_relaxed);
+
+    if (header->producers_waiting.load() != 0)
+    {
+        header->space_futex.fetch_add(1);
+        futexWake(&header->space_futex);
+    }
+    return true;
+}
+
+/* Unmap ring, remove its name if this process is consumer
+* Inputs: ring, consumer or not */
+void closeRing(SharedRing &ring, bool consumer)
+{
+    munmap(ring.header, ring.size);
+    if (consumer)
+        shm_unlink(ring.name.c_str());
+}
+
+#endif
+
+#endif
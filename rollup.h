@@ -0,0 +1,229 @@
+/***********************************************************
+* Program: rollup.h
+* Purpose: Fold hourly average values into daily, weekly and monthly values
+************************************************************/
+
+#ifndef ROLLUP_H
+#define ROLLUP_H
+
+#include "header.h"
+#include "writer.h"
+#include "aqi.h"
+
+/* rollup period */
+#define ROLLUP_DAY          0
+#define ROLLUP_WEEK         1           /* week starts on Monday */
+#define ROLLUP_MONTH        2
+#define NUM_ROLLUPS         3
+
+/* Structure for partial result of one sensor in one period.
+Partial results of shorter periods can be merged into longer one */
+struct RollupBucket
+{
+    int64_t sum_value;                  /* sum of hourly average values (0.1 unit) */
+    int num_hours;
+    int min_value;                      /* min and max of hourly average values (0.1 unit) */
+    int max_value;
+    int level_hours[NUM_LEVELS];        /* hours in each pollution level */
+};
+
+/* Structure for one period length */
+struct Rollup
+{
+    string period;                      /* YYYY:MM:DD of day or Monday, YYYY:MM of month */
+    vector<RollupBucket> buckets;       /* one per sensor */
+    WriteBuffer file;
+};
+
+/* Structure for all periods, hourly values go to day, finished day goes to week and month */
+struct RollupSet
+{
+    int num_sensors;
+    Rollup rollups[NUM_ROLLUPS];
+};
+
+/* Set bucket to empty state
+* Input: bucket */
+void resetBucket(RollupBucket &bucket)
+{
+    bucket.sum_value = 0;
+    bucket.num_hours = 0;
+    bucket.min_value = 0;
+    bucket.max_value = 0;
+    for (int i = 0; i < NUM_LEVELS; i++)
+        bucket.level_hours[i] = 0;
+}
+
+/* Add partial result of shorter period to bucket
+* Inputs: bucket of longer period, bucket of shorter period */
+void mergeBucket(RollupBucket &to, const RollupBucket &from)
+{
+    if (from.num_hours == 0)
+        return;
+
+    if (to.num_hours == 0 || from.min_value < to.min_value)
+        to.min_value = from.min_value;
+    if (to.num_hours == 0 || from.max_value > to.max_value)
+        to.max_value = from.max_value;
+    to.sum_value += from.sum_value;
+    to.num_hours += from.num_hours;
+    for (int i = 0; i < NUM_LEVELS; i++)
+        to.level_hours[i] += from.level_hours[i];
+}
+
+/* Find Monday of week containing day
+* Input: day with format YYYY:MM:DD
+* Output: Monday with format YYYY:MM:DD */
+string weekStart(const string &day)
+{
+    tm timeStruct = {};
+    stringstream ss(day);
+    ss >> get_time(&timeStruct, "%Y:%m:%d");
+    timeStruct.tm_hour = 12;                /* away from daylight saving change */
+    timeStruct.tm_isdst = -1;
+    mktime(&timeStruct);                    /* find day of week */
+
+    timeStruct.tm_mday -= (timeStruct.tm_wday + 6) % 7;
+    mktime(&timeStruct);                    /* normalize date */
+
+    char text[19];
+    formatTimestamp(text, mktime(&timeStruct));
+    return string(text, 10);
+}
+
+/* Open output file of each period and write header
+* Inputs: rollups, number of sensors, file names of day, week and month,
+    background writer (NULL if written on this thread)
+* Output: true (if all files can be created) or false */
+bool openRollups(RollupSet &rollup, int num_sensors, const string file_names[NUM_ROLLUPS], AsyncWriter *async)
+{
+    rollup.num_sensors = num_sensors;
+    bool ok = true;
+    for (int k = 0; k < NUM_ROLLUPS; k++)
+    {
+        Rollup &period = rollup.rollups[k];
+        period.period = "";
+        period.buckets.resize(num_sensors);
+        for (RollupBucket &bucket : period.buckets)
+            resetBucket(bucket);
+
+        ok = openWriteBufferAtomic(period.file, file_names[k], async) && ok;
+        if (period.file.fd < 0)
+            continue;
+        writeText(period.file, "id,time,hours,value,min,max,aqi,pollution");
+        for (const AQIRange& range : aqiRanges)
+        {
+            writeChar(period.file, ',');
+            writeText(period.file, range.level);
+        }
+        writeChar(period.file, '\n');
+    }
+    return ok;
+}
+
+/* Write line of period
+* Inputs: buffer of output file, id, period and its bucket */
+void writeRollupLine(WriteBuffer &out, int id, const string &period, const RollupBucket &bucket)
+{
+    int ave_aqi = convertPM25toAQI((double)bucket.sum_value / (10.0 * bucket.num_hours));
+
+    writeInt(out, id);
+    writeChar(out, ',');
+    writeText(out, period);
+    writeChar(out, ',');
+    writeInt(out, bucket.num_hours);
+    writeChar(out, ',');
+    writeTenths(out, roundAverage(bucket.sum_value, bucket.num_hours));
+    writeChar(out, ',');
+    writeTenths(out, bucket.min_value);
+    writeChar(out, ',');
+    writeTenths(out, bucket.max_value);
+    writeChar(out, ',');
+    writeInt(out, ave_aqi);
+    writeChar(out, ',');
+    writeText(out, AQItoLevel(ave_aqi));
+    for (int i = 0; i < NUM_LEVELS; i++)
+    {
+        writeChar(out, ',');
+        writeInt(out, bucket.level_hours[i]);
+    }
+    writeChar(out, '\n');
+}
+
+/* Write values of current period and reset it. Finished day is merged into week and month
+* Inputs: rollups, period index */
+void closePeriod(RollupSet &rollup, int k)
+{
+    Rollup &period = rollup.rollups[k];
+    if (period.period.empty())
+        return;
+
+    for (int id = 0; id < rollup.num_sensors; id++)
+    {
+        RollupBucket &bucket = period.buckets[id];
+        if (bucket.num_hours == 0)
+            continue;
+
+        if (period.file.fd >= 0)
+            writeRollupLine(period.file, id + 1, period.period, bucket);
+        if (k == ROLLUP_DAY)
+        {
+            mergeBucket(rollup.rollups[ROLLUP_WEEK].buckets[id], bucket);
+            mergeBucket(rollup.rollups[ROLLUP_MONTH].buckets[id], bucket);
+        }
+        resetBucket(bucket);
+    }
+}
+
+/* Add hourly average value, close periods which are finished
+* Inputs: rollups, average value with time YYYY:MM:DD hh:00:00
+* Pre-condition: values come in time order, 1 <= id <= num_sensors */
+void addRollupValue(RollupSet &rollup, const averageValue &entry)
+{
+    Rollup *rollups = rollup.rollups;
+    if (rollups[ROLLUP_DAY].period.empty() || entry.time.compare(0, 10, rollups[ROLLUP_DAY].period) != 0)
+    {
+        /* day first, so that it is merged before week or month is written */
+        closePeriod(rollup, ROLLUP_DAY);
+        rollups[ROLLUP_DAY].period.assign(entry.time, 0, 10);
+
+        string week = weekStart(rollups[ROLLUP_DAY].period);
+        if (week != rollups[ROLLUP_WEEK].period)
+        {
+            closePeriod(rollup, ROLLUP_WEEK);
+            rollups[ROLLUP_WEEK].period = week;
+        }
+        if (entry.time.compare(0, 7, rollups[ROLLUP_MONTH].period) != 0)
+        {
+            closePeriod(rollup, ROLLUP_MONTH);
+            rollups[ROLLUP_MONTH].period.assign(entry.time, 0, 7);
+        }
+    }
+
+    /* hourly value (as written in dust_aqi.csv) is a bucket of one hour */
+    RollupBucket hour;
+    resetBucket(hour);
+    hour.sum_value = hour.min_value = hour.max_value = entry.value;
+    hour.num_hours = 1;
+    int level = levelIndex(entry.aqi);
+    if (level >= 0)
+        hour.level_hours[level] = 1;
+    mergeBucket(rollups[ROLLUP_DAY].buckets[entry.id - 1], hour);
+}
+
+/* Write values of last periods and close output files
+* Input: rollups
+* Output: true (if all data is written) or false */
+bool closeRollups(RollupSet &rollup)
+{
+    bool ok = true;
+    for (int k = 0; k < NUM_ROLLUPS; k++)
+    {
+        closePeriod(rollup, k);
+        if (rollup.rollups[k].file.fd >= 0)
+            ok = closeWriteBuffer(rollup.rollups[k].file) && ok;
+    }
+    return ok;
+}
+
+#endif
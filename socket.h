@@ -0,0 +1,171 @@
+/***********************************************************
+* Program: socket.h
+* Purpose: Open TCP, UDP and Unix sockets from address string (Linux only)
+************************************************************/
+
+#ifndef SOCKET_H
+#define SOCKET_H
+
+#include "header.h"
+
+#ifdef __linux__
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+/* socket type */
+#define SOCKET_TCP      1
+#define SOCKET_UDP      2
+#define SOCKET_UNIX     3           /* Unix stream socket */
+
+/* Structure for socket address */
+struct SocketAddress
+{
+    int type;
+    sockaddr_storage addr;
+    socklen_t length;
+};
+
+/* Get socket address from string
+* Input: address string with format tcp://host:port, udp://host:port or unix:path
+* Output: true (if address is valid) or false */
+bool parseSocketAddress(string text, SocketAddress &address)
+{
+    memset(&address, 0, sizeof(address));
+
+    if (text.compare(0, 5, "unix:") == 0)
+    {
+        string path = text.substr(5);
+        sockaddr_un *addr = (sockaddr_un*)&address.addr;
+        if (path.empty() || path.size() >= sizeof(addr->sun_path))
+            return false;
+
+        address.type = SOCKET_UNIX;
+        addr->sun_family = AF_UNIX;
+        memcpy(addr->sun_path, path.c_str(), path.size() + 1);
+        address.length = sizeof(sockaddr_un);
+        return true;
+    }
+
+    if (text.compare(0, 6, "tcp://") == 0)
+        address.type = SOCKET_TCP;
+    else if (text.compare(0, 6, "udp://") == 0)
+        address.type = SOCKET_UDP;
+    else
+        return false;
+
+    string host_port = text.substr(6);
+    size_t colon = host_port.rfind(':');
+    if (colon == string::npos)
+        return false;
+    string host = host_port.substr(0, colon), port = host_port.substr(colon + 1);
+
+    addrinfo hints, *result;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = (address.type == SOCKET_TCP) ? SOCK_STREAM : SOCK_DGRAM;
+    hints.ai_flags = AI_PASSIVE;
+    if (getaddrinfo(host.empty() ? NULL : host.c_str(), port.c_str(), &hints, &result) != 0)
+        return false;
+
+    memcpy(&address.addr, result->ai_addr, result->ai_addrlen);
+    address.length = result->ai_addrlen;
+    freeaddrinfo(result);
+    return true;
+}
+
+/* Set socket in non-blocking mode
+* Input: socket
+* Output: true (if success) or false */
+bool setNonBlocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+/* Create socket of address type
+* Input: address
+* Output: socket, -1 if failed */
+int createSocket(const SocketAddress &address)
+{
+    int family = (address.type == SOCKET_UNIX) ? AF_UNIX : AF_INET;
+    int type = (address.type == SOCKET_UDP) ? SOCK_DGRAM : SOCK_STREAM;
+    return socket(family, type | SOCK_CLOEXEC, 0);
+}
+
+/* Connect to address, socket is non-blocking after connected
+* Input: address
+* Output: socket, -1 if failed */
+int connectSocket(const SocketAddress &address)
+{
+    int fd = createSocket(address);
+    if (fd < 0)
+        return -1;
+
+    if (connect(fd, (const sockaddr*)&address.addr, address.length) != 0 || !setNonBlocking(fd))
+    {
+        close(fd);
+        return -1;
+    }
+
+    if (address.type == SOCKET_TCP)
+    {
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    return fd;
+}
+
+/* Remove socket file of Unix address, other files are never removed
+* Input: address
+* Output: true (if there is no file at path now) or false */
+bool removeSocketFile(const SocketAddress &address)
+{
+    const char *path = ((const sockaddr_un*)&address.addr)->sun_path;
+    struct stat info;
+    if (lstat(path, &info) != 0)
+        return errno == ENOENT;
+    if (!S_ISSOCK(info.st_mode))
+        return false;
+    return unlink(path) == 0;
+}
+
+/* Open non-blocking socket waiting for connections (or datagrams for UDP).
+Old socket file of Unix address is replaced, but not a file of other type
+* Input: address
+* Output: socket, -1 if failed */
+int listenSocket(const SocketAddress &address)
+{
+    if (address.type == SOCKET_UNIX && !removeSocketFile(address))
+        return -1;
+
+    int fd = createSocket(address);
+    if (fd < 0)
+        return -1;
+
+    int on = 1, buffer_size = 8 << 20;
+    if (address.type != SOCKET_UNIX)
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (address.type == SOCKET_UDP)
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));      /* datagrams come in bursts */
+
+    if (bind(fd, (const sockaddr*)&address.addr, address.length) != 0
+        || (address.type != SOCKET_UDP && listen(fd, SOMAXCONN) != 0)
+        || !setNonBlocking(fd))
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,247 @@
+/***********************************************************
+* Program: summary.h
+* Purpose: Keep summary and pollution statistics of each sensor in flat arrays
+************************************************************/
+
+#ifndef SUMMARY_H
+#define SUMMARY_H
+
+#include "header.h"
+#include "readfile.h"
+#include "writer.h"
+#include "aqi.h"
+#include "columnar.h"
+#include <cstdint>
+#include <charconv>
+
+/* Structure for dust_summary.csv (or dust_summary.col), one element per sensor at id - 1 */
+struct SummaryTable
+{
+    int max_id;
+    vector<uint8_t> present;        /* sensor has summary */
+    vector<int32_t> hours;          /* duration measurement */
+    vector<int32_t> max_value;      /* 0.1 unit */
+    vector<uint32_t> max_time;      /* time in seconds */
+    vector<int32_t> min_value;
+    vector<uint32_t> min_time;
+    vector<int32_t> mean_value;
+};
+
+/* Structure for dust_statistics.csv, hours of sensor id in level k at (id - 1) * NUM_LEVELS + k */
+struct StatisticsTable
+{
+    int max_id;
+    vector<int32_t> hours;
+};
+
+/* Make room for sensor id in summary
+* Inputs: table, sensor id */
+void growSummaryTable(SummaryTable &table, int id)
+{
+    if (id <= table.max_id)
+        return;
+    table.max_id = id;
+    table.present.resize(id, 0);
+    table.hours.resize(id, 0);
+    table.max_value.resize(id, 0);
+    table.max_time.resize(id, 0);
+    table.min_value.resize(id, 0);
+    table.min_time.resize(id, 0);
+    table.mean_value.resize(id, 0);
+}
+
+/* Load dust_summary.csv format file
+* Inputs: file name, table, line position of invalid line (output)
+* Output: true (if all lines are valid) or false */
+bool loadSummaryTable(string file_name, SummaryTable &table, int &error_line)
+{
+    ifstream input_file(file_name, ios::binary);
+    string textline;
+    int linePos = 0;
+
+    table = SummaryTable();
+    table.max_id = 0;
+    error_line = 0;
+    getline(input_file, textline);          /* skip first line */
+
+    while (getline(input_file, textline))
+    {
+        linePos++;
+        if (!textline.empty() && textline.back() == '\r')
+            textline.pop_back();
+
+        /* id,parameter,time,value */
+        size_t comma1 = textline.find(','), comma2 = textline.find(',', comma1 + 1);
+        size_t comma3 = textline.rfind(',');
+        int id = 0, value = 0;
+        bool valid = comma1 != string::npos && comma2 != string::npos && comma3 > comma2
+            && from_chars(textline.data(), textline.data() + comma1, id).ec == errc() && id > 0
+            && parseDustValue(string_view(textline).substr(comma3 + 1), value);
+
+        string parameter, time_str;
+        if (valid)
+        {
+            parameter = textline.substr(comma1 + 1, comma2 - comma1 - 1);
+            time_str = textline.substr(comma2 + 1, comma3 - comma2 - 1);
+            valid = (parameter == "mean") || (time_str.size() == 19 && checkDateFormat(time_str));
+        }
+        if (!valid || (parameter != "max" && parameter != "min" && parameter != "mean"))
+        {
+            error_line = linePos;
+            return false;
+        }
+
+        growSummaryTable(table, id);
+        table.present[id - 1] = 1;
+        if (parameter == "max")
+        {
+            table.max_value[id - 1] = value;
+            table.max_time[id - 1] = static_cast<uint32_t>(parseTimestamp(time_str));
+        }
+        else if (parameter == "min")
+        {
+            table.min_value[id - 1] = value;
+            table.min_time[id - 1] = static_cast<uint32_t>(parseTimestamp(time_str));
+        }
+        else
+        {
+            table.mean_value[id - 1] = value;
+            table.hours[id - 1] = atoi(time_str.c_str());           /* hh:00:00 */
+        }
+    }
+    return true;
+}
+
+/* Load summary from mapped dust_summary.col
+* Inputs: column file, table
+* Output: true (if file has every column of summary) or false */
+bool loadSummaryColumns(const ColumnFile &file, SummaryTable &table)
+{
+    const int32_t *id = (const int32_t*)findColumn(file, "id", COLUMN_INT32);
+    const int32_t *hours = (const int32_t*)findColumn(file, "hours", COLUMN_INT32);
+    const int32_t *max_value = (const int32_t*)findColumn(file, "max", COLUMN_INT32);
+    const uint32_t *max_time = (const uint32_t*)findColumn(file, "max_time", COLUMN_UINT32);
+    const int32_t *min_value = (const int32_t*)findColumn(file, "min", COLUMN_INT32);
+    const uint32_t *min_time = (const uint32_t*)findColumn(file, "min_time", COLUMN_UINT32);
+    const int32_t *mean_value = (const int32_t*)findColumn(file, "mean", COLUMN_INT32);
+
+    table = SummaryTable();
+    table.max_id = 0;
+    if (id == NULL || hours == NULL || max_value == NULL || max_time == NULL
+        || min_value == NULL || min_time == NULL || mean_value == NULL)
+        return false;
+
+    for (size_t i = 0; i < file.header->num_rows; i++)
+    {
+        if (id[i] < 1)
+            return false;
+        growSummaryTable(table, id[i]);
+        int k = id[i] - 1;
+        table.present[k] = 1;
+        table.hours[k] = hours[i];
+        table.max_value[k] = max_value[i];
+        table.max_time[k] = max_time[i];
+        table.min_value[k] = min_value[i];
+        table.min_time[k] = min_time[i];
+        table.mean_value[k] = mean_value[i];
+    }
+    return true;
+}
+
+/* Load dust_statistics.csv format file
+* Inputs: file name, table, line position of invalid line (output)
+* Output: true (if all lines are valid) or false */
+bool loadStatisticsTable(string file_name, StatisticsTable &table, int &error_line)
+{
+    ifstream input_file(file_name, ios::binary);
+    string textline;
+    int linePos = 0;
+
+    table.max_id = 0;
+    table.hours.clear();
+    error_line = 0;
+    getline(input_file, textline);          /* skip first line */
+
+    while (getline(input_file, textline))
+    {
+        linePos++;
+        if (!textline.empty() && textline.back() == '\r')
+            textline.pop_back();
+
+        /* id,pollution,duration */
+        size_t comma1 = textline.find(','), comma2 = textline.rfind(',');
+        int id = 0, hours = 0, level = -1;
+        if (comma1 != string::npos && comma2 > comma1
+            && from_chars(textline.data(), textline.data() + comma1, id).ec == errc() && id > 0
+            && from_chars(textline.data() + comma2 + 1, textline.data() + textline.size(), hours).ec == errc())
+            level = findLevel(textline.substr(comma1 + 1, comma2 - comma1 - 1));
+        if (level < 0)
+        {
+            error_line = linePos;
+            return false;
+        }
+
+        if (id > table.max_id)
+        {
+            table.max_id = id;
+            table.hours.resize((size_t)id * NUM_LEVELS, 0);
+        }
+        table.hours[(size_t)(id - 1) * NUM_LEVELS + level] = hours;
+    }
+    return true;
+}
+
+/* Write summary of sensors in dust_summary.csv format
+* Inputs: buffer of output file, table, id range (both ends included) */
+void writeSummaryRows(WriteBuffer &out, const SummaryTable &table, int id_min, int id_max)
+{
+    writeText(out, "id,parameter,time,value\n");
+    for (int id = max(id_min, 1); id <= min(id_max, table.max_id); id++)
+    {
+        int k = id - 1;
+        if (!table.present[k])
+            continue;
+
+        writeInt(out, id);
+        writeText(out, ",max,");
+        writeTimestamp(out, table.max_time[k]);
+        writeChar(out, ',');
+        writeTenths(out, table.max_value[k]);
+        writeChar(out, '\n');
+
+        writeInt(out, id);
+        writeText(out, ",min,");
+        writeTimestamp(out, table.min_time[k]);
+        writeChar(out, ',');
+        writeTenths(out, table.min_value[k]);
+        writeChar(out, '\n');
+
+        writeInt(out, id);
+        writeText(out, ",mean,");
+        writeInt(out, table.hours[k]);
+        writeText(out, ":00:00,");
+        writeTenths(out, table.mean_value[k]);
+        writeChar(out, '\n');
+    }
+}
+
+/* Write hours in each pollution level in dust_statistics.csv format
+* Inputs: buffer of output file, table, id range (both ends included) */
+void writeStatisticsRows(WriteBuffer &out, const StatisticsTable &table, int id_min, int id_max)
+{
+    writeText(out, "id,pollution,duration\n");
+    for (int id = max(id_min, 1); id <= min(id_max, table.max_id); id++)
+    {
+        for (int k = 0; k < NUM_LEVELS; k++)
+        {
+            writeInt(out, id);
+            writeChar(out, ',');
+            writeText(out, aqiRanges[k].level);
+            writeChar(out, ',');
+            writeInt(out, table.hours[(size_t)(id - 1) * NUM_LEVELS + k]);
+            writeChar(out, '\n');
+        }
+    }
+}
+
+#endif
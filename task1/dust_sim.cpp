@@ -7,6 +7,16 @@
 #include "../header.h"
 #include "../error.h"
 #include "../readfile.h"
+#include "../writer.h"
+#include "../aqi.h"
+#include "../packet.h"
+#include "../socket.h"
+#include "../ring.h"
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <csignal>
+#include <unistd.h>
+#endif
 
 #define PM25_DATAFILE       "dust_sensor.csv"
 #define LOG_FILE            "task1.log"
@@ -18,35 +28,18 @@ double generatePM25Value()
     return (double)(rand() % 10001)/10.0;
 }
 
-/* Generate date and time from time in seconds
-* Inputs: timenow - time in seconds
-* Output: a time string with format YYYY:MM:DD hh:mm:ss */
-string generateTimestamp(time_t time_now) 
-{
-    tm* tm_local = localtime(&time_now);            /* get time from time in seconds*/
-    
-    /* write time */
-    stringstream ss;
-    ss << setfill('0')
-        << setw(4) << tm_local->tm_year + 1900 << ":"
-        << setw(2) << tm_local->tm_mon + 1 << ":"
-        << setw(2) << tm_local->tm_mday << " "
-        << setw(2) << tm_local->tm_hour << ":"
-        << setw(2) << tm_local->tm_min << ":"
-        << setw(2) << tm_local->tm_sec;
-    return ss.str();
-}
-
 /* Write simulated data in output file
 * Inputs: 
         num_sensors: number of sensors
         sampling: time per simulation
         interval: duration of simulation
-* Output: dust_sensor.csv file*/
-void simulatingData(int num_sensors, int sampling, int interval) 
+* Output: dust_sensor.csv file, true (if file is written) or false */
+bool simulatingData(int num_sensors, int sampling, int interval) 
 {
-    ofstream OUTPUTSTREAM(PM25_DATAFILE);           /* stream for write dust_sensor.csv*/
-    OUTPUTSTREAM << "id,time,value" << endl;
+    WriteBuffer OUTPUTSTREAM;                       /* buffer for write dust_sensor.csv*/
+    if (!openWriteBuffer(OUTPUTSTREAM, PM25_DATAFILE))
+        return false;
+    writeText(OUTPUTSTREAM, "id,time,value\n");
     
     /* write simulation data */
     srand(time(0));
@@ -55,22 +48,363 @@ void simulatingData(int num_sensors, int sampling, int interval)
     {
 
         time_t timenow = start_time + time_incre; /* time */
+        char Timestamp[19];
+        formatTimestamp(Timestamp, timenow);        /* same for all sensors */
 
         for (int id = 1; id <= num_sensors; id++) 
         {
-            string Timestamp = generateTimestamp(timenow);
             double dust_concentration = generatePM25Value(); /* value */
-            OUTPUTSTREAM << id << "," << Timestamp << "," << fixed << setprecision(1) << dust_concentration << endl; /* write dataline*/
+            writeSensorLine(OUTPUTSTREAM, id, Timestamp, dust_concentration); /* write dataline*/
         }
     }
-    OUTPUTSTREAM.close();
+    if (!closeWriteBuffer(OUTPUTSTREAM))
+        return false;
     cout << "Data has been saved into file dust_sensor.csv."; /* notify when done */
+    return true;
+}
+
+#ifdef __linux__
+/* Pass simulated data to next tool through shared memory ring
+* Inputs: 
+        num_sensors: number of sensors
+        sampling: time per simulation
+        interval: duration of simulation
+        ring_name: name of shared memory ring
+        producers: number of dust_sim writing in the same ring
+        id_base: first sensor id, producers of one ring should simulate different ids
+* Output: true (if ring can be opened) or false */
+bool simulatingRing(int num_sensors, int sampling, int interval, string ring_name, int producers, int id_base) 
+{
+    SharedRing ring;
+    if (!openRing(ring, ring_name, producers))
+        return false;
+
+    srand(time(0) ^ getpid());              /* producers started together get different values */
+    time_t start_time = time(NULL) - interval * 3600;
+    long long num_records = 0;
+    for (int time_incre = 0; time_incre <= interval * 3600; time_incre += sampling) 
+    {
+        RingRecord record = {0, 0, start_time + time_incre, 0.0};
+        for (int id = id_base; id < id_base + num_sensors; id++) 
+        {
+            record.id = id;
+            record.value = generatePM25Value();
+            pushRing(ring, record);
+            num_records++;
+        }
+    }
+    finishRing(ring);
+    closeRing(ring, false);
+    cout << num_records << " readings have been sent to ring " << ring_name << "."; /* notify when done */
+    return true;
+}
+
+/* message format in network mode */
+#define FORMAT_CSV          1           /* dust_sensor.csv lines */
+#define FORMAT_PACKET       2           /* dust_convert packets */
+#define FORMAT_FRAME        3           /* dust_convert version 2 frames */
+
+#define SEND_BATCH          256         /* datagrams per sendmmsg() */
+#define MAX_PENDING         (4 << 20)   /* bytes waiting on one stream socket */
+
+/* Structure for network mode options */
+struct FleetOption 
+{
+    SocketAddress address;
+    int format;
+    int num_conns;              /* sensors share connections round-robin */
+    int jitter;                 /* sensors send at random time in [0, jitter] ms after tick */
+    int burst;                  /* sensors buffer readings and send every burst ticks */
+    double speed;               /* simulated seconds per real second */
+};
+
+/* Structure for connection and data waiting to be sent */
+struct FleetConnection 
+{
+    int fd;                     /* -1 after write error */
+    string pending;             /* messages not sent yet */
+    size_t sent;                /* bytes of pending already sent (stream) */
+    vector<size_t> message_end; /* end of each datagram in pending (UDP) */
+};
+
+/* Structure for counting sent data */
+struct FleetCount 
+{
+    long long messages;
+    long long readings;
+    long long bytes;
+    long long dropped;          /* messages not sent because socket was full or closed */
+    long long closed;           /* connections closed after write error */
+};
+
+/* Get monotonic time
+* Output: time in seconds */
+double monotonicSeconds() 
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* Create message of readings of one sensor
+* Inputs: 
+    message: output
+    format: message format
+    id: sensor id
+    times: time of each reading, Timestamps: time string of each reading (19 characters each)
+    count: number of readings
+* Output: message */
+void encodeMessage(string &message, int format, int id, const time_t *times, const char *Timestamps, int count) 
+{
+    message.clear();
+    vector<FrameRecord> records;
+
+    for (int i = 0; i < count; i++) 
+    {
+        double dust_concentration = generatePM25Value();
+        bool in_range = (dust_concentration <= 550.5);
+        int aqi = in_range ? convertPM25toAQI(dust_concentration) : 0;
+
+        if (format == FORMAT_CSV) 
+        {
+            char value_str[16];
+            message.append(to_string(id));
+            message.push_back(',');
+            message.append(Timestamps + 19 * i, 19);
+            message.push_back(',');
+            message.append(value_str, to_chars(value_str, value_str + 16, dust_concentration, chars_format::fixed, 1).ptr);
+            message.push_back('\n');
+        }
+        else if (format == FORMAT_PACKET) 
+        {
+            vector<packet_checksum> packet = buildPacket(static_cast<packet_id>(id), static_cast<packet_time>(times[i]),
+                static_cast<packet_value>(dust_concentration), static_cast<packet_aqi>(aqi));
+            message.append((const char*)packet.data(), packet.size());
+        }
+        else 
+            records.push_back({id, static_cast<packet_time>(times[i]), (int)(dust_concentration * 10 + 0.5), aqi});
+    }
+
+    if (format == FORMAT_FRAME) 
+    {
+        vector<unsigned char> frame = buildFrameV2(records.data(), records.size(), records[0].time);
+        message.append((const char*)frame.data(), frame.size());
+    }
+}
+
+/* Send pending data of connection without blocking.
+Stream connection is closed when peer is gone or on other write error
+* Inputs: connection, socket type, counter
+* Output: sent data removed from pending */
+void flushConnection(FleetConnection &conn, int type, FleetCount &count) 
+{
+    if (conn.fd < 0)
+        return;
+    if (type != SOCKET_UDP) 
+    {
+        while (conn.sent < conn.pending.size()) 
+        {
+            long n = write(conn.fd, conn.pending.data() + conn.sent, conn.pending.size() - conn.sent);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n == 0 || (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)))
+                break;                  /* socket is full, wait for EPOLLOUT */
+            if (n < 0) 
+            {
+                close(conn.fd);         /* also removed from epoll */
+                conn.fd = -1;
+                conn.pending.clear();
+                conn.sent = 0;
+                count.closed++;
+                return;
+            }
+            conn.sent += n;
+        }
+        if (conn.sent == conn.pending.size()) 
+        {
+            conn.pending.clear();
+            conn.sent = 0;
+        }
+        return;
+    }
+
+    /* one datagram per message, sent in batches */
+    size_t first = 0, start = 0;
+    while (first < conn.message_end.size()) 
+    {
+        mmsghdr msgs[SEND_BATCH];
+        iovec iovs[SEND_BATCH];
+        size_t n = min((size_t)SEND_BATCH, conn.message_end.size() - first);
+        size_t begin = start;
+        for (size_t i = 0; i < n; i++) 
+        {
+            size_t end = conn.message_end[first + i];
+            iovs[i].iov_base = &conn.pending[begin];
+            iovs[i].iov_len = end - begin;
+            memset(&msgs[i], 0, sizeof(mmsghdr));
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            begin = end;
+        }
+
+        int sent = sendmmsg(conn.fd, msgs, n, MSG_DONTWAIT);
+        if (sent < 0)
+            sent = 0;
+        count.dropped += n - sent;          /* datagram is not kept when socket is full */
+        first += n;
+        start = begin;
+    }
+    conn.pending.clear();
+    conn.message_end.clear();
+}
+
+/* Wait until time, send pending data when stream sockets become writable
+* Inputs: epoll, connections, socket type, due time, counter */
+void waitUntil(int epfd, vector<FleetConnection> &conns, int type, double due, FleetCount &count) 
+{
+    epoll_event events[64];
+    while (true) 
+    {
+        double now = monotonicSeconds();
+        if (now >= due)
+            return;
+
+        int n = epoll_wait(epfd, events, 64, (int)((due - now) * 1000) + 1);
+        for (int i = 0; i < n; i++)
+            flushConnection(conns[events[i].data.u32], type, count);
+    }
 }
 
+/* Emulate sensors sending readings to socket
+* Inputs: 
+        num_sensors: number of sensors
+        sampling: time per simulation
+        interval: duration of simulation
+        option: network mode options
+* Output: readings sent to socket
+        true (if connected) or false */
+bool simulatingFleet(int num_sensors, int sampling, int interval, const FleetOption &option) 
+{
+    signal(SIGPIPE, SIG_IGN);           /* write error instead of exit when peer is gone */
+
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    vector<FleetConnection> conns(option.num_conns);
+    for (int i = 0; i < option.num_conns; i++) 
+    {
+        conns[i].fd = connectSocket(option.address);
+        conns[i].sent = 0;
+        if (conns[i].fd < 0)
+            return false;
+
+        if (option.address.type != SOCKET_UDP) 
+        {
+            epoll_event event;
+            event.events = EPOLLOUT | EPOLLET;
+            event.data.u32 = i;
+            epoll_ctl(epfd, EPOLL_CTL_ADD, conns[i].fd, &event);
+        }
+    }
+
+    srand(time(0));
+    time_t start_time = time(NULL) - interval * 3600;
+    int num_ticks = interval * 3600 / sampling + 1;
+    double start = monotonicSeconds();
+    FleetCount count = {0, 0, 0, 0, 0};
+
+    vector<time_t> times(option.burst);
+    vector<char> Timestamps(19 * option.burst);
+    vector<int> offset(num_sensors + 1), slot_start(option.jitter + 2), order(num_sensors);
+    string message;
+
+    for (int tick = 0; tick < num_ticks; tick++) 
+    {
+        /* remember time of readings buffered since last send */
+        int buffered = tick % option.burst;
+        times[buffered] = start_time + (time_t)tick * sampling;
+        formatTimestamp(&Timestamps[19 * buffered], times[buffered]);
+        if (buffered != option.burst - 1 && tick != num_ticks - 1)
+            continue;
+
+        /* sort sensors by random send time (counting sort over milliseconds) */
+        fill(slot_start.begin(), slot_start.end(), 0);
+        for (int id = 1; id <= num_sensors; id++) 
+        {
+            offset[id] = option.jitter > 0 ? rand() % (option.jitter + 1) : 0;
+            slot_start[offset[id] + 1]++;
+        }
+        for (int slot = 0; slot <= option.jitter; slot++)
+            slot_start[slot + 1] += slot_start[slot];
+        for (int id = 1; id <= num_sensors; id++)
+            order[slot_start[offset[id]]++] = id;
+
+        double tick_time = start + (double)tick * sampling / option.speed;
+        int pos = 0;
+        while (pos < num_sensors) 
+        {
+            int slot = offset[order[pos]];
+            waitUntil(epfd, conns, option.address.type, tick_time + slot / 1000.0, count);
+
+            /* every sensor due in this millisecond */
+            for (; pos < num_sensors && offset[order[pos]] == slot; pos++) 
+            {
+                int id = order[pos];
+                FleetConnection &conn = conns[(id - 1) % option.num_conns];
+                encodeMessage(message, option.format, id, times.data(), Timestamps.data(), buffered + 1);
+                count.messages++;
+                count.readings += buffered + 1;
+
+                if (conn.fd < 0 || conn.pending.size() - conn.sent + message.size() > MAX_PENDING) 
+                {
+                    count.dropped++;
+                    continue;
+                }
+                conn.pending.append(message);
+                if (option.address.type == SOCKET_UDP)
+                    conn.message_end.push_back(conn.pending.size());
+                count.bytes += message.size();
+            }
+
+            for (FleetConnection &conn : conns)
+                flushConnection(conn, option.address.type, count);
+        }
+    }
+
+    /* send the rest on stream sockets, wait at most 5 seconds */
+    double deadline = monotonicSeconds() + 5;
+    for (FleetConnection &conn : conns) 
+    {
+        while (!conn.pending.empty() && monotonicSeconds() < deadline) 
+        {
+            waitUntil(epfd, conns, option.address.type, monotonicSeconds() + 0.01, count);
+            flushConnection(conn, option.address.type, count);
+        }
+        if (conn.fd >= 0)
+            close(conn.fd);
+    }
+    close(epfd);
+
+    double seconds = monotonicSeconds() - start;
+    cout << "Messages sent: " << count.messages - count.dropped << endl;
+    cout << "Readings sent: " << count.readings << endl;
+    cout << "Bytes sent: " << count.bytes << endl;
+    cout << "Messages dropped: " << count.dropped << endl;
+    cout << "Connections closed on error: " << count.closed << endl;
+    cout << "Duration: " << fixed << setprecision(3) << seconds << " s ("
+        << setprecision(0) << (count.messages - count.dropped) / (seconds > 0 ? seconds : 1) << " messages/s)" << endl;
+    return true;
+}
+#endif
+
 /* Main function 
 * Input: command-line statement
+    dust_sim -n num_sensors [-st sampling] [-si interval]
+    network mode: -net tcp://host:port | udp://host:port | unix:path
+        [-fmt csv|packet|frame] [-conn connections] [-jitter ms] [-burst ticks] [-speed factor]
+    shared memory mode: -ring name [-producers number of dust_sim writing in ring] [-id-base first id]
+        sensors have ids id-base .. id-base + num_sensors - 1 (default 1), every producer
+        of one ring needs its own range, e.g. -n 100 -id-base 1 and -n 100 -id-base 101
 * Output: 
-    dust_sensor.csv
+    dust_sensor.csv (or readings sent to socket or ring)
     task1.log
     notification (should appear if program run successfully)
 * Pre-condition: task1.log is accessible
@@ -89,8 +423,21 @@ int main(int argc, char *argv[])
     int sampling = 30;              /* time per simulation */
     int interval = 24;              /* duration measurement */
 
+    /* network mode */
+    string net_address = "";        /* empty if write dust_sensor.csv */
+    string format = "csv";
+    int num_conns = 1;
+    int jitter = 0;
+    int burst = 1;
+    double speed = 1.0;
+
+    /* shared memory mode */
+    string ring_name = "";          /* empty if not used */
+    int producers = 1;
+    int id_base = 1;                /* first sensor id */
+
     /* check if command-line is correct */
-    if (argc <= 2 || argc > 7) 
+    if (argc <= 2 || argc % 2 == 0) 
     {
         error(01, LOG_FILE);
         return 1;
@@ -106,6 +453,24 @@ int main(int argc, char *argv[])
             sampling = atoi(argv[i + 1]);                   /* new time per simulation */
         else if (str == "-si")
             interval = atoi(argv[i + 1]);                   /* new duration measurement */
+        else if (str == "-net")
+            net_address = argv[i + 1];                      /* send readings to socket */
+        else if (str == "-fmt")
+            format = argv[i + 1];
+        else if (str == "-conn")
+            num_conns = atoi(argv[i + 1]);
+        else if (str == "-jitter")
+            jitter = atoi(argv[i + 1]);
+        else if (str == "-burst")
+            burst = atoi(argv[i + 1]);
+        else if (str == "-speed")
+            speed = atof(argv[i + 1]);
+        else if (str == "-ring")
+            ring_name = argv[i + 1];                        /* send readings to shared memory ring */
+        else if (str == "-producers")
+            producers = atoi(argv[i + 1]);
+        else if (str == "-id-base")
+            id_base = atoi(argv[i + 1]);
         else 
         {
             error(02, LOG_FILE);
@@ -123,13 +488,69 @@ int main(int argc, char *argv[])
     cout << "Number of sensors: " << num_sensors << endl;
     cout << "Sampling time: " << sampling << endl;
     cout << "Measurement duration: " << interval << endl;
+
+    if (!ring_name.empty()) 
+    {
+#ifdef __linux__
+        if (producers < 1 || id_base < 1 || id_base > INT32_MAX - num_sensors) 
+        {
+            error(02, LOG_FILE);
+            return 1;
+        }
+        if (!simulatingRing(num_sensors, sampling, interval, ring_name, producers, id_base)) 
+        {
+            error(03, LOG_FILE, ring_name);
+            return 1;
+        }
+        return 0;
+#else
+        error(02, LOG_FILE);            /* shared memory ring needs Linux */
+        return 1;
+#endif
+    }
+
+    if (!net_address.empty()) 
+    {
+#ifdef __linux__
+        FleetOption option;
+        option.num_conns = num_conns;
+        option.jitter = jitter;
+        option.burst = burst;
+        option.speed = speed;
+        option.format = (format == "csv") ? FORMAT_CSV : (format == "packet") ? FORMAT_PACKET 
+                        : (format == "frame") ? FORMAT_FRAME : 0;
+
+        /* packet has one byte for id */
+        if (!parseSocketAddress(net_address, option.address) || option.format == 0
+            || (option.format == FORMAT_PACKET && num_sensors > 255)
+            || num_conns < 1 || jitter < 0 || burst < 1 || speed <= 0) 
+        {
+            error(02, LOG_FILE);
+            return 1;
+        }
+
+        if (!simulatingFleet(num_sensors, sampling, interval, option)) 
+        {
+            error(03, LOG_FILE, net_address);
+            return 1;
+        }
+        return 0;
+#else
+        error(02, LOG_FILE);            /* network mode needs Linux */
+        return 1;
+#endif
+    }
     
     /* check if dust_sensor.csv is accessible */
     if (!scanFile(PM25_DATAFILE, LOG_FILE, WRITE_MODE))
         return 1;
     
     /* write simulation data in dust_sensor.csv */
-    simulatingData(num_sensors, sampling, interval); 
+    if (!simulatingData(num_sensors, sampling, interval)) 
+    {
+        error(03, LOG_FILE, PM25_DATAFILE);
+        return 1;
+    }
     
     return 0;
 }
\ No newline at end of file
@@ -7,294 +7,761 @@
 #include "../header.h"
 #include "../error.h"
 #include "../readfile.h"
+#include "../outlier.h"
+#include "../writer.h"
+#include "../aqi.h"
+#include "../ring.h"
+#include "../rollup.h"
+#include "../coverage.h"
+#include "../async.h"
+#include "../pool.h"
+#include "../columnar.h"
+#include "../metadata.h"
+#include "../validate.h"
+#include "../arena.h"
+#include <thread>
+#include <charconv>
+#include <string_view>
+#include <algorithm>
+#include <filesystem>
+#include <chrono>
 
 #define INPUT_FILE_LOCATION     "../task1"
 #define OUTLIER_FILE            "dust_outliers.csv"
+#define COVERAGE_FILE           "dust_coverage.csv"
 #define AQI_FILE                "dust_aqi.csv"
+#define DAILY_FILE              "dust_aqi_daily.csv"
+#define WEEKLY_FILE             "dust_aqi_weekly.csv"
+#define MONTHLY_FILE            "dust_aqi_monthly.csv"
 #define SENSOR_ANALYSING_FILE   "dust_summary.csv"
 #define SENSOR_STATISTICS_FILE  "dust_statistics.csv"
+#define AQI_COLUMNAR_FILE       "dust_aqi.col"
+#define SUMMARY_COLUMNAR_FILE   "dust_summary.col"
+#define SITE_AQI_FILE           "dust_aqi_site.csv"
+#define REGION_AQI_FILE         "dust_aqi_region.csv"
+#define SITE_STATISTICS_FILE    "dust_statistics_site.csv"
+#define REGION_STATISTICS_FILE  "dust_statistics_region.csv"
 #define LOG_FILE                "task2.log"
+#define PARSE_CHUNK_SIZE        (4 << 20)       /* bytes of input file parsed by one task */
 
-/* Check if date and time is in format YYYY:MM:DD hh:mm:ss
-* Inputs: time string
-* Output: true or false */
-bool checkDateFormat(string date) 
-{
-    /* extract time string in parts */
-    stringstream ss(date);
-    int year, month, day, hour, min, sec;
-    char colon1, colon2, colon3, colon4;
-    ss >> year >> colon1 >> month >> colon2 >> day >> hour >> colon3 >> min >> colon4 >> sec;
-
-    /* check if parts are valid */
-    if ((month >= 1 && month <= 12)
-        && (day >= 1 && day <= 31)
-        && (hour >= 0 && hour <= 23)
-        && (min >= 0 && min <= 59)
-        && (sec >= 0 && sec <= 59)
-        && (colon1 == ':') && (colon2 == ':') && (colon3 == ':') && (colon4 == ':'))
-        return true;
+/* format of dust_aqi and dust_summary */
+#define OUTPUT_CSV              1
+#define OUTPUT_COLUMNAR         2               /* columnar.h file, mapped by dust_query */
+
+/* background writer of output files, NULL if files are written on formatting thread */
+AsyncWriter *output_writer = NULL;
+
+/* Structure for options of data processing, same for every data set */
+struct ProcessOptions
+{
+    int filter_mode;
+    int window;                 /* window and threshold of Hampel filter */
+    double threshold;
+    int sampling;               /* time per simulation, 0 if unknown */
+    double min_coverage;        /* hours below it are excluded (%) */
+    int output_format;          /* OUTPUT_CSV and/or OUTPUT_COLUMNAR */
+    const SensorMetadata *meta; /* site, region and calibration, NULL if not given */
+    MemoryBudget *budget;       /* memory in use of run */
+    bool huge_pages;            /* records are kept on huge pages */
+};
+
+/* Structure for names of output files of one data set, empty if file is not written */
+struct OutputNames
+{
+    string outlier;
+    string coverage;
+    string aqi;
+    string daily;
+    string weekly;
+    string monthly;
+    string summary;
+    string statistics;
+    string aqi_columnar;
+    string summary_columnar;
+    string group_aqi[NUM_META_GROUPS];          /* by site and region */
+    string group_statistics[NUM_META_GROUPS];
+};
+
+/* Make names of output files
+* Inputs: prefix (empty for default names), options
+* Output: names of output files */
+OutputNames outputNames(const string &prefix, const ProcessOptions &options)
+{
+    bool csv = (options.output_format & OUTPUT_CSV) != 0;
+    bool columnar = (options.output_format & OUTPUT_COLUMNAR) != 0;
+    bool grouped = options.meta != NULL;
+    return {prefix + OUTLIER_FILE, options.sampling > 0 ? prefix + COVERAGE_FILE : "", 
+        csv ? prefix + AQI_FILE : "", prefix + DAILY_FILE, prefix + WEEKLY_FILE, prefix + MONTHLY_FILE, 
+        csv ? prefix + SENSOR_ANALYSING_FILE : "", prefix + SENSOR_STATISTICS_FILE,
+        columnar ? prefix + AQI_COLUMNAR_FILE : "", columnar ? prefix + SUMMARY_COLUMNAR_FILE : "",
+        {grouped ? prefix + SITE_AQI_FILE : "", grouped ? prefix + REGION_AQI_FILE : ""},
+        {grouped ? prefix + SITE_STATISTICS_FILE : "", grouped ? prefix + REGION_STATISTICS_FILE : ""}};
+}
 
-    return false;
+/* Check if output files are accessible before any work,
+each file is written under temporary name and renamed when finished
+* Input: output names
+* Output: true (if all files are accessible) or false */
+bool checkOutputFiles(const OutputNames &names)
+{
+    vector<string> output_files = {names.outlier, names.coverage, names.aqi, names.daily, names.weekly, 
+        names.monthly, names.summary, names.statistics, names.aqi_columnar, names.summary_columnar,
+        names.group_aqi[META_SITE], names.group_aqi[META_REGION], 
+        names.group_statistics[META_SITE], names.group_statistics[META_REGION]};
+    for (const string &file_name : output_files) 
+    {
+        if (!file_name.empty() && !scanFile(file_name, LOG_FILE, WRITE_MODE))
+            return false;
+    }
+    return true;
 }
 
-/* Structure for storing data from input file */
-struct DataField 
+/* Structure for line of input file, fields point into text of file */
+struct RawReading
 {
     int id;
-    string time;
-    double value;
+    int value;                  /* 0.1 unit */
+    string_view id_str;
+    string_view time_str;
+    string_view value_str;
 };
 
-/* Filter outliers and store the rest data in vector
+/* Structure for part of input file parsed by one task */
+struct ReadingChunk
+{
+    size_t begin;               /* byte range, begins at start of line */
+    size_t end;
+    RawReading *readings;       /* one per line, in arena of file */
+    int num_readings;
+    int num_lines;              /* lines parsed */
+    int bad_line;               /* position of first bad line in chunk, 0 if none */
+};
+
+/* Structure for input file */
+struct SensorFile
+{
+    string location;            /* file directory */
+    string prefix;              /* prefix of output files */
+    string text;                /* whole file, kept while readings are used */
+    vector<ReadingChunk> chunks;
+    bool ok;                    /* file is read and processed */
+    size_t num_lines;           /* data lines */
+    size_t charged;             /* bytes counted in budget, besides arena */
+    Arena arena;                /* readings */
+};
+
+/* Write outlier line in dust_outliers.csv
+* Inputs: buffer of dust_outliers.csv, fields of input line and reason */
+void writeOutlier(WriteBuffer &outlier_file, const string &id_str, string_view time_str,
+    const string &value_str, const string &reason)
+{
+    writeText(outlier_file, id_str);
+    writeChar(outlier_file, ',');
+    writeText(outlier_file, time_str.data(), time_str.size());
+    writeChar(outlier_file, ',');
+    writeText(outlier_file, value_str);
+    writeChar(outlier_file, ',');
+    writeText(outlier_file, reason);
+    writeChar(outlier_file, '\n');
+}
+
+/* Record error of output file which cannot be written
+* Inputs: result of writing, file name
+* Output: result of writing */
+bool checkOutputFile(bool ok, const string &file_name)
+{
+    if (!ok)
+        error(03, LOG_FILE, file_name);
+    return ok;
+}
+
+/* Open dust_outliers.csv and write first two lines
+* Inputs: buffer of dust_outliers.csv, file name
+* Output: true (if file can be created) or false */
+bool openOutlierFile(WriteBuffer &outlier_file, const string &file_name)
+{
+    if (!openWriteBufferAtomic(outlier_file, file_name, output_writer))
+        return false;
+    writeText(outlier_file, "number of outliers:                 \n");        /* first line, blank for write number of outliers */
+    writeText(outlier_file, "id,time,value,reason\n");                         /* second line */
+    return true;
+}
+
+/* Close dust_outliers.csv and write number of outliers in first line
+* Inputs: buffer of dust_outliers.csv, number of outliers
+* Output: true (if all data is written) or false */
+bool closeOutlierFile(WriteBuffer &outlier_file, int num_outlier)
+{
+    bool ok = patchWriteBuffer(outlier_file, 0, "number of outliers: " + to_string(num_outlier));      /* write number of outliers in first line */
+    return closeWriteBuffer(outlier_file) && ok;
+}
+
+/* Close dust_outliers.csv and coverage file of data set which is not complete,
+they are removed instead of renamed
+* Inputs: buffer of dust_outliers.csv, coverage (NULL if not tracked) */
+void abortOutlierFile(WriteBuffer &outlier_file, CoverageTracker* coverage)
+{
+    abortWriteBuffer(outlier_file);
+    if (coverage != NULL)
+        abortWriteBuffer(coverage->file);
+}
+
+/* Check if reading is duplicate or outlier, write it in dust_outliers.csv or store it in vector
 * Inputs:
-    file_location: file directory
-    num_sensors: number of sensors
-* Output: vector<DataField> data */
-vector<DataField> sortDatainFile(string& file_location, int* num_sensors) 
+    outlier_file: buffer of dust_outliers.csv
+    hampel: rolling median/MAD filter, NULL if only fixed bounds are used
+    coverage: readings per sensor-hour, NULL if sampling time is not given
+    id, time_str, value_str, dust_value: fields of reading (dust_value in 0.1 unit),
+        time_str is kept for the whole run
+    num_outlier: number of outliers (increased if reading is outlier)
+    data: valid data */
+void filterReading(WriteBuffer &outlier_file, HampelFilter* hampel, CoverageTracker* coverage, int id, const string &id_str,
+    string_view time_str, const string &value_str, int dust_value, int &num_outlier, vector<DataField> &data)
 {
-    vector<DataField> data;                     /* handle valid data */
-    ifstream input_file(file_location);         /* stream of input and output file*/
-    ofstream outlier_file(OUTLIER_FILE);
+    int hampel_result = HAMPEL_NORMAL;
+    if (coverage != NULL && trackCoverage(*coverage, id, time_str, data) == COVERAGE_DUPLICATE) 
+    {
+        num_outlier++;
+        writeOutlier(outlier_file, id_str, time_str, value_str, "duplicate");
+    }
+    else if ((dust_value < 0) || (dust_value > 5505)) 
+    {
+        num_outlier++;
+        writeOutlier(outlier_file, id_str, time_str, value_str, "out of range");
+    }
+    else if (hampel != NULL 
+        && (hampel_result = checkHampelOutlier(*hampel, id, dust_value / 10.0)) != HAMPEL_NORMAL)
+    {
+        num_outlier++;
+        writeOutlier(outlier_file, id_str, time_str, value_str, hampelReason(hampel_result));
+    }
+    else
+        data.push_back({id,time_str,dust_value});           /* import valid data */
+}
 
-    outlier_file << "number of outliers:                 " << endl;             /* first line, blank for write number of outliers */
-    outlier_file << "id,time,value" << endl;                                    /* second line */
+/* Get fields of input line
+* Inputs: line without end of line, reading
+* Output: true (if line is valid) or false */
+bool parseReading(string_view line, RawReading &reading)
+{
+    string_view fields[3];
+    size_t pos = 0;
+    for (int i = 0; i < 3 && pos <= line.size(); i++)
+    {
+        size_t comma = line.find(',', pos);
+        if (comma == string_view::npos)
+            comma = line.size();
+        fields[i] = line.substr(pos, comma - pos);
+        pos = comma + 1;
+    }
+    reading.id_str = fields[0];
+    reading.time_str = fields[1];
+    reading.value_str = fields[2];
+    if ((reading.id_str.size() == 0) || (reading.time_str.size() == 0) || (reading.value_str.size() == 0))
+        return false;
 
-    string textline;
-    int num_outlier = 0;                    /* count outliers */
-    int linePos = 1;                        /* show line position */
-    int id_max = 0;                         /* to find number of sensors */
-    getline(input_file, textline);          /* skip first line */
-     
-    /* scan dataline */
-    while (getline(input_file, textline)) 
-    {
-        stringstream ss(textline);
-        string id_str, time_str, value_str;
-
-        /* get data from line */
-        getline(ss, id_str, ',');
-        getline(ss, time_str, ',');
-        getline(ss, value_str, ',');
-    
-        int id = stoi(id_str);              /* get id */
-        if ((id_str.size() == 0) || (time_str.size() == 0) || (value_str.size() == 0)
-            || (id < 1) || (checkDateFormat(time_str) == false)) 
+    const char *id_end = reading.id_str.data() + reading.id_str.size();
+    if (from_chars(reading.id_str.data(), id_end, reading.id).ec != errc()
+        || !parseDustValue(reading.value_str, reading.value))
+        return false;
+    return (reading.id >= 1) && checkTimeField(reading.time_str.data(), reading.time_str.size());
+}
+
+/* Parse lines of chunk, stop at first bad line. Values are calibrated here,
+so calibration runs in parallel with parsing
+* Inputs: text of input file, chunk, metadata (NULL if values are not calibrated) */
+void parseChunk(const string &text, ReadingChunk &chunk, const SensorMetadata *meta)
+{
+    chunk.num_readings = 0;
+    chunk.num_lines = 0;
+    chunk.bad_line = 0;
+    size_t pos = chunk.begin;
+    while (pos < chunk.end)
+    {
+        size_t line_end = text.find('\n', pos);
+        if (line_end == string::npos || line_end > chunk.end)
+            line_end = chunk.end;
+        chunk.num_lines++;
+
+        RawReading reading;
+        if (!parseReading(string_view(text.data() + pos, line_end - pos), reading))
         {
-            error(07, LOG_FILE, linePos);
-            break;
+            chunk.bad_line = chunk.num_lines;
+            return;
         }
+        if (meta != NULL)
+            reading.value = calibrateValue(*meta, reading.id, reading.value);
+        chunk.readings[chunk.num_readings++] = reading;
+        pos = line_end + 1;
+    }
+}
+
+/* Read whole input file
+* Input: input file
+* Output: true (if file can be read) or false */
+bool readSensorFile(SensorFile &file)
+{
+    ifstream input_file(file.location, ios::binary);
+    if (!input_file)
+        return false;
+    input_file.seekg(0, ios::end);
+    file.text.resize(input_file.tellg());
+    input_file.seekg(0, ios::beg);
+    input_file.read(&file.text[0], file.text.size());
+    return (bool)input_file;
+}
 
-        if (id_max < id)
-            id_max = id;                /* find number of sensors */
+/* Read input file, check all its lines and parse it, large file is split in chunks
+which are parsed in parallel. Text, readings and valid data of whole file are counted
+in memory budget before they are made, so run stops before any work if they do not fit
+* Inputs: pool, input file, options of task 2.1
+* Output: true (if file is loaded) or false, error is recorded in log file */
+bool loadSensorFile(WorkPool &pool, SensorFile &file, const ProcessOptions &options)
+{
+    error_code code;
+    size_t file_size = filesystem::file_size(file.location, code);
+    if (code)
+    {
+        error(03, LOG_FILE, file.location);
+        return false;
+    }
+    if (!chargeMemory(options.budget, file_size))
+    {
+        error(06, LOG_FILE);
+        return false;
+    }
+    file.charged = file_size;
+    if (!readSensorFile(file))
+    {
+        error(03, LOG_FILE, file.location);
+        return false;
+    }
+    if (!validateText(file.text, DUST_SENSOR_LAYOUT, LOG_FILE))
+        return false;               /* every bad line is recorded, nothing is processed */
 
-        double dust_value = stod(value_str);                    /* get dust concentration */
-        if ((dust_value < 0) || (dust_value > 550.5)) 
+    /* skip first line, split the rest at end of line. Every line is valid, so it is a reading */
+    size_t size = file.text.size();
+    size_t begin = file.text.find('\n');
+    begin = (begin == string::npos) ? size : begin + 1;
+    file.chunks.clear();
+    file.num_lines = 0;
+    while (begin < size)
+    {
+        size_t end = min(begin + PARSE_CHUNK_SIZE, size);
+        if (end < size)
         {
-            num_outlier++;
-            outlier_file << textline << endl;
+            end = file.text.find('\n', end);
+            end = (end == string::npos) ? size : end + 1;
         }
-        else
-            data.push_back({id,time_str,dust_value});           /* import valid data */
-
-        linePos++;                      /* move to next line*/
+        int num_lines = count(file.text.begin() + begin, file.text.begin() + end, '\n') + (file.text[end - 1] != '\n');
+        file.chunks.push_back({begin, end, NULL, 0, num_lines, 0});
+        file.num_lines += num_lines;
+        begin = end;
     }
-    *num_sensors = id_max; // return the maximum sensors
 
-    /* close stream  */
-    input_file.close();
-    outlier_file.seekp(0, ios::beg);                                /* return to first line */
-    outlier_file <<  "number of outliers: " << num_outlier;         /* write number of outliers */
-    outlier_file.close();
+    /* readings are in arena, pointers to them and valid data are in vectors of exact size */
+    size_t data_bytes = file.num_lines * (sizeof(const RawReading*) + sizeof(DataField));
+    initArena(file.arena, options.budget, options.huge_pages);
+    RawReading *readings = NULL;
+    if (file.num_lines > 0)
+        readings = (RawReading*)arenaAlloc(file.arena, file.num_lines * sizeof(RawReading), alignof(RawReading));
+    if ((file.num_lines > 0 && readings == NULL) || !chargeMemory(options.budget, data_bytes))
+    {
+        error(06, LOG_FILE);
+        return false;
+    }
+    file.charged += data_bytes;
+    for (ReadingChunk &chunk : file.chunks)
+    {
+        chunk.readings = readings;
+        readings += chunk.num_lines;
+    }
 
-    cout << "Filter outliers completely. Output file: " << OUTLIER_FILE << endl;            /* notify */
-    return data;
+    if (file.chunks.size() == 1)
+    {
+        parseChunk(file.text, file.chunks[0], options.meta);
+        return true;
+    }
+    TaskGroup group;
+    const SensorMetadata *meta = options.meta;
+    for (ReadingChunk &chunk : file.chunks)
+        spawnTask(pool, group, [&file, &chunk, meta] { parseChunk(file.text, chunk, meta); });
+    waitGroup(pool, group);
+    return true;
 }
 
-/* Structure for handle data of dust concentration conversion */
-struct AQIRange 
+/* Give text and readings of input file back, with their bytes in budget
+* Inputs: input file, options of task 2.1 */
+void releaseSensorFile(SensorFile &file, const ProcessOptions &options)
 {
-    double value_min;
-    double value_max;
-    int AQI_min;
-    int AQI_max;
-    string level;
-};
-
-/* Dust concentration conversion table */
-vector<AQIRange> aqiRanges = 
-{
-    {0.0, 12.0, 0, 50, "Good"},
-    {12.0, 35.5, 50, 100, "Moderate"},
-    {35.5, 55.5, 100, 150, "Slightly unhealthy"},
-    {55.5, 150.5, 150, 200, "Unhealthy"},
-    {150.5, 250.5, 200, 300, "Very unhealthy"},
-    {250.5, 350.5, 300, 400, "Hazardous"},
-    {350.5, 550.5, 400, 500, "Extremely hazardous"}
-};
+    string().swap(file.text);
+    vector<ReadingChunk>().swap(file.chunks);
+    freeArena(file.arena);
+    releaseMemory(options.budget, file.charged);
+    file.charged = 0;
+}
 
-/* Convert dust concentration to AQI
-* Inputs: dust concentration
-* Output: AQI */
-int convertPM25toAQI(double value) 
+/* Add readings of parsed file in line order, stop at first bad line
+* Inputs: input file, readings */
+void collectReadings(const SensorFile &file, vector<const RawReading*> &readings)
 {
-    double AQI;
-    for (const AQIRange& range : aqiRanges) 
+    int linePos = 0;                        /* lines before chunk */
+    readings.reserve(readings.size() + file.num_lines);
+    for (const ReadingChunk &chunk : file.chunks)
     {
-        if (value >= range.value_min && value <= range.value_max) 
+        for (int i = 0; i < chunk.num_readings; i++)
+            readings.push_back(&chunk.readings[i]);
+        if (chunk.bad_line > 0)
         {
-            AQI = ((range.AQI_max - range.AQI_min) / (range.value_max - range.value_min)) * (value - range.value_min) + range.AQI_min;
-            break;
+            error(05, LOG_FILE, linePos + chunk.bad_line);
+            return;
         }
+        linePos += chunk.num_lines;
     }
-    return (int)AQI;
 }
 
-/* Convert AQI to pollution level
-* Inputs: AQI
-* Output: pollution level string
-* Pre-condition: */
-string AQItoLevel(int AQI) 
+/* Filter outliers and store the rest data in vector
+* Inputs:
+    readings: readings in time order
+    outlier_name: name of dust_outliers.csv
+    hampel: rolling median/MAD filter, NULL if only fixed bounds are used
+    coverage: readings per sensor-hour, NULL if sampling time is not given
+    times: arena of time strings of data, kept for the whole run (stops if it is full)
+    num_sensors, num_outlier: number of sensors and outliers
+    written: dust_outliers.csv and coverage file are written or not (error is recorded)
+* Output: vector<DataField> data */
+vector<DataField> filterReadings(const vector<const RawReading*> &readings, const string &outlier_name,
+    HampelFilter* hampel, CoverageTracker* coverage, Arena &times, int* num_sensors, int* num_outlier, bool* written) 
 {
-    string level;
-    for (const AQIRange& range : aqiRanges) {
-        if (AQI >= range.AQI_min && AQI <= range.AQI_max) {
-            level = range.level;
-            break;
+    vector<DataField> data;                     /* handle valid data */
+    WriteBuffer outlier_file;
+    *num_sensors = *num_outlier = 0;
+    *written = checkOutputFile(openOutlierFile(outlier_file, outlier_name), outlier_name);
+    if (!*written)
+    {
+        abortOutlierFile(outlier_file, coverage);
+        return data;
+    }
+    data.reserve(readings.size());              /* counted in budget by loadSensorFile() */
+
+    int id_max = 0;                         /* to find number of sensors */
+    string id_str, value_str;
+    string_view time_str, last_time;        /* readings at same time share one copy */
+    for (const RawReading *reading : readings) 
+    {
+        id_str.assign(reading->id_str);
+        if (reading->time_str != last_time)
+        {
+            last_time = reading->time_str;
+            time_str = arenaString(times, last_time);
+            if (times.failed)
+            {
+                abortOutlierFile(outlier_file, coverage);       /* data set is not complete */
+                return data;
+            }
         }
+        value_str.assign(reading->value_str);
+        if (id_max < reading->id)
+            id_max = reading->id;           /* find number of sensors */
+
+        filterReading(outlier_file, hampel, coverage, reading->id, id_str, time_str, value_str, reading->value,
+            *num_outlier, data);
     }
-    return level;
+    *num_sensors = id_max; // return the maximum sensors
+
+    if (coverage != NULL)
+        *written = checkOutputFile(closeCoverageTracker(*coverage, data), coverage->file.file_name);
+    *written = checkOutputFile(closeOutlierFile(outlier_file, *num_outlier), outlier_name) && *written;
+    return data;
 }
 
-/* Set all elements in array to zero 
-* Inputs: integer or double array and array' size
-* Output: zero array */
-void setValuetoZero(int *array, int size) 
+#ifdef __linux__
+/* Filter outliers of readings from shared memory ring and store the rest data in vector.
+Readings of several dust_sim are interleaved, so they are all received and put
+in time order first, hourly average, Hampel filter and coverage need time order
+* Inputs:
+    ring, producers: ring written by dust_sim and number of dust_sim
+    outlier_name: name of dust_outliers.csv
+    hampel: rolling median/MAD filter, NULL if only fixed bounds are used
+    coverage: readings per sensor-hour, NULL if sampling time is not given
+    meta: metadata, NULL if values are not calibrated
+    times: arena of time strings of data, kept for the whole run (stops if it is full)
+    num_sensors, num_outlier: number of sensors and outliers
+    written: dust_outliers.csv and coverage file are written or not (error is recorded)
+* Output: vector<DataField> data */
+vector<DataField> receiveDatainRing(SharedRing &ring, int producers, const string &outlier_name, HampelFilter* hampel,
+    CoverageTracker* coverage, const SensorMetadata *meta, Arena &times, int* num_sensors, int* num_outlier, bool* written) 
 {
-    for (int i = 0; i < size; i++)
-        array[i] = 0;
+    vector<DataField> data;                     /* handle valid data */
+    WriteBuffer outlier_file;
+    *num_sensors = *num_outlier = 0;
+    *written = checkOutputFile(openOutlierFile(outlier_file, outlier_name), outlier_name);
+    if (!*written)
+    {
+        abortOutlierFile(outlier_file, coverage);
+        return data;
+    }
+
+    RingRecord record;
+    vector<RingRecord> records;             /* readings of all producers in time order */
+    size_t next = 0;
+    if (producers > 1) 
+    {
+        while (popRing(ring, record))
+            records.push_back(record);
+        stable_sort(records.begin(), records.end(), 
+            [](const RingRecord &a, const RingRecord &b) { return a.time < b.time; });
+    }
+    auto nextRecord = [&](RingRecord &out) 
+    {
+        if (producers == 1)
+            return popRing(ring, out);
+        if (next == records.size())
+            return false;
+        out = records[next++];
+        return true;
+    };
+
+    int recordPos = 1;                      /* show record position */
+    int id_max = 0;                         /* to find number of sensors */
+    int64_t last_time = -1;
+    string id_str, value_str;
+    string_view time_str;                   /* in arena, shared by readings of one tick */
+
+    while (nextRecord(record)) 
+    {
+        if (record.id < 1) 
+        {
+            error(05, LOG_FILE, recordPos++);       /* skip record, producers keep writing */
+            continue;
+        }
+
+        /* same text as dust_sensor.csv, time string is the same for all sensors of one tick */
+        if (record.time != last_time) 
+        {
+            char Timestamp[19];
+            formatTimestamp(Timestamp, record.time);
+            time_str = arenaString(times, string_view(Timestamp, 19));
+            if (times.failed)
+            {
+                abortOutlierFile(outlier_file, coverage);       /* data set is not complete */
+                return data;
+            }
+            last_time = record.time;
+        }
+        char value_text[32];
+        value_str.assign(value_text, to_chars(value_text, value_text + 32, record.value, chars_format::fixed, 1).ptr);
+        int tenths = 0;
+        parseDustValue(value_str, tenths);          /* same value as text in dust_sensor.csv */
+        if (meta != NULL)
+            tenths = calibrateValue(*meta, record.id, tenths);
+        id_str = to_string(record.id);
+
+        if (id_max < record.id)
+            id_max = record.id;                 /* find number of sensors */
+
+        filterReading(outlier_file, hampel, coverage, record.id, id_str, time_str, value_str, tenths, *num_outlier, data);
+        recordPos++;
+    }
+    *num_sensors = id_max; // return the maximum sensors
+
+    if (coverage != NULL)
+        *written = checkOutputFile(closeCoverageTracker(*coverage, data), coverage->file.file_name);
+    *written = checkOutputFile(closeOutlierFile(outlier_file, *num_outlier), outlier_name) && *written;
+    return data;
 }
 
-void setValuetoZero(double *array, int size) 
+/* Pass average values to next tool through shared memory ring
+* Inputs: ring read by dust_convert, vector<averageValue> list */
+void sendAverageValue(SharedRing &ring, vector<averageValue> &list) 
 {
-    for (int i = 0; i < size; i++)
-        array[i] = 0.0;
+    string last_time;
+    int64_t time_num = 0;
+    for (const averageValue& entry : list) 
+    {
+        if (entry.time != last_time) 
+        {
+            time_num = parseTimestamp(entry.time);
+            last_time = entry.time;
+        }
+        pushRing(ring, {entry.id, entry.aqi, time_num, entry.value / 10.0});
+    }
+    finishRing(ring);
 }
+#endif
 
-/* Structure for store data to write dust_aqi.csv and further analysis*/
-struct averageValue 
+/* Add hourly value of sensor to periods and to its site and region
+* Inputs: rollups, groups (NULL if no metadata), hourly value */
+void foldAverageValue(RollupSet &rollup, GroupAverage *groups, const averageValue &entry)
 {
-    int id;
-    string time;
-    double value;
-    int aqi;
-    string level;
-};
+    addRollupValue(rollup, entry);
+    for (int k = 0; groups != NULL && k < NUM_META_GROUPS; k++)
+        addGroupValue(groups[k], entry);
+}
 
-/* calculate average PM2.5 value, AQI and pollution level
+/* calculate average PM2.5 value, AQI and pollution level,
+fold each finished hour into daily, weekly and monthly values
 * Inputs:
     vector<DataField> data: from sortDataInFile()
     num_sensors: number of sensors
     interval: duration measurement
-* Output: vector<averageValue> list */
-vector<averageValue> calculateAverageValue(vector<DataField> &data, int num_sensors, int *interval) 
+    rollup: daily, weekly and monthly values (output files are opened, caller closes them)
+    groups: hourly values of sites and regions (output files are opened), NULL if no metadata
+* Output: vector<averageValue> list, dust_aqi_daily.csv, dust_aqi_weekly.csv, dust_aqi_monthly.csv,
+    dust_aqi_site.csv, dust_aqi_region.csv */
+vector<averageValue> calculateAverageValue(vector<DataField> &data, int num_sensors, int *interval, RollupSet &rollup,
+    GroupAverage *groups) 
 {
-    double sum_value[num_sensors];              /* to find average value per hour*/
-    int count[num_sensors];                     /* count id frequency */
-    setValuetoZero(sum_value, num_sensors);     /* initial state */
-    setValuetoZero(count, num_sensors);
-
     vector<averageValue> list;          /* handle processed data */
-    string time_checkpoint = "";
+    HourlyAverage hourly;               /* sum and count of current hour */
+    initHourlyAverage(hourly, num_sensors);
+    size_t folded = 0;                  /* values of list added to rollups */
 
     /* read each data in each element in vector */
     for (const DataField& entry : data) 
     {
-        string timenow = entry.time.substr(0, 13);          /* extract hour part */
-        if (time_checkpoint != timenow) {
-            for (int id = 0; id < num_sensors; id++) 
-            {
-                /* process data and put in vector */
-                if (count[id] > 0) 
-                {
-                    double ave_value = sum_value[id]/count[id];         /* value */
-                    int ave_aqi = convertPM25toAQI(ave_value);          /* AQI */
-                    string level = AQItoLevel(ave_aqi);                 /* level */
-                    string time = time_checkpoint;                      /* time */
-                    time.append(":00:00");
-                    list.push_back({id + 1, time, ave_value, ave_aqi, level});
-                }
-            }
+        addHourlyValue(hourly, entry.id, entry.time, entry.value, list);
+        for (; folded < list.size(); folded++)
+            foldAverageValue(rollup, groups, list[folded]);           /* hour has just finished */
+    }
+    closeHour(hourly, list);            /* calculate average value in last hour */
+    for (; folded < list.size(); folded++)
+        foldAverageValue(rollup, groups, list[folded]);
 
-            (*interval)++;              /* record duration measurement */
-            setValuetoZero(sum_value, num_sensors);         /* reset state */
-            setValuetoZero(count, num_sensors);
-        }
+    *interval += hourly.num_hours;      /* record duration measurement */
+    return list;
+}
 
-        sum_value[entry.id - 1] += entry.value;         /* sum value increment */
-        count[entry.id - 1]++;
-        time_checkpoint = timenow;
-    }
-    /* calculate average value in last hour */
-    for (int id = 0; id < num_sensors; id++) 
+/* Write data in vector<averageValue> list to dust_aqi.csv
+* Inputs: vector<averageValue> list, file name
+* Output: dust_aqi.csv, true (if file is written) or false */
+bool writeCalculateAverageValue(vector<averageValue> &list, const string &file_name) 
+{
+    WriteBuffer OUTPUT_STREAM;
+    if (!openWriteBufferAtomic(OUTPUT_STREAM, file_name, output_writer))
+        return false;
+    writeText(OUTPUT_STREAM, "id,time,value,aqi,pollution\n");
+
+    /* write data in dust_aqi.csv */
+    for (const averageValue& entry : list) 
+        writeAverageValue(OUTPUT_STREAM, entry);
+
+    return closeWriteBuffer(OUTPUT_STREAM);
+}
+
+/* Names of pollution levels, dictionary of level column
+* Output: level of each row of aqiRanges */
+vector<string> levelDictionary()
+{
+    vector<string> levels;
+    for (const AQIRange& range : aqiRanges)
+        levels.push_back(range.level);
+    return levels;
+}
+
+/* Write data in vector<averageValue> list to dust_aqi.col, 
+columns have same types as AQIColumns of dust_query
+* Inputs: vector<averageValue> list, file name
+* Output: dust_aqi.col (id, time in seconds, value in 0.1 unit, aqi, level), true (if file is written) or false */
+bool writeAverageColumns(vector<averageValue> &list, const string &file_name) 
+{
+    size_t num_rows = list.size();
+    vector<int32_t> id(num_rows), value(num_rows);
+    vector<uint32_t> time(num_rows);
+    vector<int16_t> aqi(num_rows);
+    vector<uint8_t> level(num_rows);
+
+    string last_time;
+    uint32_t time_num = 0;
+    for (size_t i = 0; i < num_rows; i++) 
     {
-        if (count[id] > 0) 
+        const averageValue &entry = list[i];
+        if (entry.time != last_time) 
         {
-            double ave_value = sum_value[id]/count[id];
-            int ave_aqi = convertPM25toAQI(ave_value);
-            string level = AQItoLevel(ave_aqi);
-            string time = time_checkpoint;
-            time.append(":00:00");
-            list.push_back({id + 1, time, ave_value, ave_aqi, level});
+            time_num = static_cast<uint32_t>(parseTimestamp(entry.time));
+            last_time = entry.time;
         }
+        int row = levelIndex(entry.aqi);
+        id[i] = entry.id;
+        time[i] = time_num;
+        value[i] = entry.value;
+        aqi[i] = static_cast<int16_t>(entry.aqi);
+        level[i] = (row < 0) ? COLUMN_NULL : row;
     }
 
-    return list;
+    return writeColumnFile(file_name, num_rows, {{"id", COLUMN_INT32, id.data(), {}}, {"time", COLUMN_UINT32, time.data(), {}},
+        {"value", COLUMN_INT32, value.data(), {}}, {"aqi", COLUMN_INT16, aqi.data(), {}},
+        {"level", COLUMN_DICT8, level.data(), levelDictionary()}}, output_writer);
 }
 
-/* Write data in vector<averageValue> list to dust_aqi.csv
-* Inputs: vector<averageValue> list
-* Output: dust_aqi.csv */
-void writeCalculateAverageValue(vector<averageValue> &list) 
+/* Write line in dust_summary.csv
+* Inputs: buffer of dust_summary.csv, id, parameter, time and value (0.1 unit) */
+void writeSummaryLine(WriteBuffer &OUTPUT_STREAM, int id, const char *parameter, string_view time, int value)
 {
-    ofstream OUTPUT_STREAM(AQI_FILE);
-    OUTPUT_STREAM << "id,time,value,aqi,pollution" << endl;
+    writeInt(OUTPUT_STREAM, id);
+    writeChar(OUTPUT_STREAM, ',');
+    writeText(OUTPUT_STREAM, parameter);
+    writeChar(OUTPUT_STREAM, ',');
+    writeText(OUTPUT_STREAM, time.data(), time.size());
+    writeChar(OUTPUT_STREAM, ',');
+    writeTenths(OUTPUT_STREAM, value);
+    writeChar(OUTPUT_STREAM, '\n');
+}
 
-    /* write data in dust_aqi.csv */
-    for (const averageValue& entry : list) 
+/* Write max, min and mean value of each sensor in dust_summary.col, one row per sensor
+* Inputs: max, min (DataField of each sensor), sum and count of values, duration measurement, file name
+* Output: dust_summary.col (id, hours, readings, max, max_time, min, min_time, mean),
+    true (if file is written) or false */
+bool writeSummaryColumns(const vector<DataField> &maxValue, const vector<DataField> &minValue,
+    const vector<int64_t> &sumValue, const int *count, int interval, const string &file_name) 
+{
+    vector<int32_t> id, hours, readings, max_value, min_value, mean_value;
+    vector<uint32_t> max_time, min_time;
+    for (size_t i = 0; i < sumValue.size(); i++) 
     {
-        OUTPUT_STREAM << fixed << setprecision(1)
-        << entry.id << ","
-        << entry.time << ","
-        << entry.value << ","
-        << entry.aqi << ","
-        << entry.level << endl;
+        if (count[i] == 0)
+            continue;
+        id.push_back(i + 1);
+        hours.push_back(interval);
+        readings.push_back(count[i]);
+        max_value.push_back(maxValue[i].value);
+        max_time.push_back(maxValue[i].time.empty() ? 0 : static_cast<uint32_t>(parseTimestamp(string(maxValue[i].time))));
+        min_value.push_back(minValue[i].value);
+        min_time.push_back(minValue[i].time.empty() ? 0 : static_cast<uint32_t>(parseTimestamp(string(minValue[i].time))));
+        mean_value.push_back(roundAverage(sumValue[i], count[i]));
     }
 
-    OUTPUT_STREAM.close();
+    return writeColumnFile(file_name, id.size(), {{"id", COLUMN_INT32, id.data(), {}}, 
+        {"hours", COLUMN_INT32, hours.data(), {}}, {"readings", COLUMN_INT32, readings.data(), {}},
+        {"max", COLUMN_INT32, max_value.data(), {}}, {"max_time", COLUMN_UINT32, max_time.data(), {}},
+        {"min", COLUMN_INT32, min_value.data(), {}}, {"min_time", COLUMN_UINT32, min_time.data(), {}},
+        {"mean", COLUMN_INT32, mean_value.data(), {}}}, output_writer);
 }
 
 /* Find max, min, mean value of each sensor
-and write in dust_summary.csv
+and write in dust_summary.csv and/or dust_summary.col
 * Inputs: 
     vector<DataField> data: from sortDataInFile()
     num_sensors: number of sensors
     interval: duration measurement
-* Output: dust_summary.csv */
-void analyseSensorData(vector<DataField> &data, int num_sensors, int interval) 
+    file_name: name of dust_summary.csv, empty if it is not written
+    columnar_name: name of dust_summary.col, empty if it is not written
+* Output: dust_summary.csv, dust_summary.col (error is recorded if one cannot be written),
+    true (if both are written) or false */
+bool analyseSensorData(vector<DataField> &data, int num_sensors, int interval, const string &file_name,
+    const string &columnar_name) 
 {
     vector<DataField> maxValue;         /* max */
     vector<DataField> minValue;         /* min */
-    double meanValue[num_sensors];      /* mean */
+    vector<int64_t> sumValue(num_sensors, 0);       /* for mean, exact in 0.1 unit */
     int count[num_sensors];
 
     /* initial state */
-    setValuetoZero(meanValue, num_sensors);         
     setValuetoZero(count, num_sensors);
     for (int i = 0; i < num_sensors; i++) 
     {
-        maxValue.push_back({0,"",0.0});
-        minValue.push_back({0,"",560.0});
+        maxValue.push_back({0,"",0});
+        minValue.push_back({0,"",5600});
     }
 
     /* read data */
@@ -305,27 +772,32 @@ void analyseSensorData(vector<DataField> &data, int num_sensors, int interval)
         if (minValue[entry.id - 1].value > entry.value)
             minValue[entry.id - 1] = {entry.id, entry.time, entry.value};           /* find min */
         
-        meanValue[entry.id - 1] += entry.value;
+        sumValue[entry.id - 1] += entry.value;
         count[entry.id - 1]++;
     }
 
-    ofstream OUTPUT_STREAM(SENSOR_ANALYSING_FILE);
-    OUTPUT_STREAM << "id,parameter,time,value" << endl;
+    bool ok = columnar_name.empty() 
+        || checkOutputFile(writeSummaryColumns(maxValue, minValue, sumValue, count, interval, columnar_name), columnar_name);
+    if (file_name.empty())
+        return ok;
+
+    WriteBuffer OUTPUT_STREAM;
+    if (!openWriteBufferAtomic(OUTPUT_STREAM, file_name, output_writer))
+        return checkOutputFile(false, file_name);
+    writeText(OUTPUT_STREAM, "id,parameter,time,value\n");
 
     /* write analysed data */
     for (int id = 0; id < num_sensors; id++) 
     {
         if (count[id] > 0) 
         {
-            meanValue[id] /= count[id]; // calculate mean value
-            OUTPUT_STREAM << fixed << setprecision(1)
-            << maxValue[id].id << "," << "max"  << "," << maxValue[id].time << "," << maxValue[id].value << endl
-            << minValue[id].id << "," << "min"  << "," << minValue[id].time << "," << minValue[id].value << endl
-            << id + 1          << "," << "mean" << "," << interval << ":00:00,"    << meanValue[id]      << endl;
+            writeSummaryLine(OUTPUT_STREAM, maxValue[id].id, "max", maxValue[id].time, maxValue[id].value);
+            writeSummaryLine(OUTPUT_STREAM, minValue[id].id, "min", minValue[id].time, minValue[id].value);
+            writeSummaryLine(OUTPUT_STREAM, id + 1, "mean", to_string(interval) + ":00:00", roundAverage(sumValue[id], count[id]));
         }
     }
 
-    OUTPUT_STREAM.close();
+    return checkOutputFile(closeWriteBuffer(OUTPUT_STREAM), file_name) && ok;
 }
 
 /* Structure for handle data of pollution level's frequency*/
@@ -340,13 +812,26 @@ struct PollutionLevel
     int Extremely_hazardous;
 };
 
+/* Write line in dust_statistics.csv
+* Inputs: buffer of dust_statistics.csv, id, pollution level and duration */
+void writeStatisticsLine(WriteBuffer &OUTPUT_STREAM, int id, const char *level, int duration)
+{
+    writeInt(OUTPUT_STREAM, id);
+    writeChar(OUTPUT_STREAM, ',');
+    writeText(OUTPUT_STREAM, level);
+    writeChar(OUTPUT_STREAM, ',');
+    writeInt(OUTPUT_STREAM, duration);
+    writeChar(OUTPUT_STREAM, '\n');
+}
+
 /* Count frequency of each pollution level in sensor 
 and write in dust_statistics.csv
 * Inputs: 
     vector<DataField> data: from sortDataInFile()
     num_sensors: number of sensors
-* Output: dust_statistics.csv */
-void SensorAverageStat(vector<averageValue> &list, int num_sensors) 
+    file_name: name of dust_statistics.csv
+* Output: dust_statistics.csv, true (if file is written) or false */
+bool SensorAverageStat(vector<averageValue> &list, int num_sensors, const string &file_name) 
 {
     vector<PollutionLevel> status_count;                /* handle data */
     for (int id = 0; id < num_sensors; id++)
@@ -371,32 +856,424 @@ void SensorAverageStat(vector<averageValue> &list, int num_sensors)
             status_count[entry.id - 1].Extremely_hazardous++;
     }
     
-    ofstream OUTPUT_STREAM(SENSOR_STATISTICS_FILE);         /* stream for dust_statistics.csv */
-    OUTPUT_STREAM << "id,pollution,duration" << endl;
+    WriteBuffer OUTPUT_STREAM;                              /* buffer for dust_statistics.csv */
+    if (!openWriteBufferAtomic(OUTPUT_STREAM, file_name, output_writer))
+        return false;
+    writeText(OUTPUT_STREAM, "id,pollution,duration\n");
 
     /* write data in file */
     for (int id = 0; id < num_sensors; id++) 
     {
-        OUTPUT_STREAM
-        << id + 1 << "," << "Good" << "," << status_count[id].Good << endl
-        << id + 1 << "," << "Moderate" << "," << status_count[id].Moderate << endl
-        << id + 1 << "," << "Slightly unhealthy" << "," << status_count[id].Slightly_unhealthy << endl
-        << id + 1 << "," << "Unhealthy" << "," << status_count[id].Unhealthy << endl
-        << id + 1 << "," << "Very unhealthy" << "," << status_count[id].Very_unhealthy << endl
-        << id + 1 << "," << "Hazardous" << "," << status_count[id].Hazardous << endl
-        << id + 1 << "," << "Extremely hazardous" << "," << status_count[id].Extremely_hazardous << endl;
+        writeStatisticsLine(OUTPUT_STREAM, id + 1, "Good", status_count[id].Good);
+        writeStatisticsLine(OUTPUT_STREAM, id + 1, "Moderate", status_count[id].Moderate);
+        writeStatisticsLine(OUTPUT_STREAM, id + 1, "Slightly unhealthy", status_count[id].Slightly_unhealthy);
+        writeStatisticsLine(OUTPUT_STREAM, id + 1, "Unhealthy", status_count[id].Unhealthy);
+        writeStatisticsLine(OUTPUT_STREAM, id + 1, "Very unhealthy", status_count[id].Very_unhealthy);
+        writeStatisticsLine(OUTPUT_STREAM, id + 1, "Hazardous", status_count[id].Hazardous);
+        writeStatisticsLine(OUTPUT_STREAM, id + 1, "Extremely hazardous", status_count[id].Extremely_hazardous);
+    }
+
+    return closeWriteBuffer(OUTPUT_STREAM);
+}
+
+/* task 2.2 - 2.4: calculate AQI and fold it into daily, weekly and monthly values
+and into sites and regions, then format dust_aqi.csv, dust_summary.csv and dust_statistics.csv at the same time
+* Inputs:
+    pool, group: formatting tasks are added to group, caller waits for it
+    data: valid data
+    num_sensors: number of sensors
+    meta: metadata, NULL if values are not grouped
+    names: output names (kept until group is finished)
+    list: average values (kept until group is finished)
+    written: all output files are written or not, set to false by tasks which fail (error is recorded) */
+void analyseDataSet(WorkPool &pool, TaskGroup &group, vector<DataField> &data, int num_sensors,
+    const SensorMetadata *meta, const OutputNames &names, vector<averageValue> &list, atomic<bool> &written)
+{
+    string rollup_files[NUM_ROLLUPS] = {names.daily, names.weekly, names.monthly};
+    string rollup_names = names.daily + ", " + names.weekly + ", " + names.monthly;
+    RollupSet rollup;                               /* daily, weekly and monthly values */
+    if (!checkOutputFile(openRollups(rollup, num_sensors, rollup_files, output_writer), rollup_names))
+        written = false;
+    GroupAverage groups[NUM_META_GROUPS];           /* hourly values of sites and regions */
+    for (int k = 0; meta != NULL && k < NUM_META_GROUPS; k++)
+    {
+        if (!checkOutputFile(openGroupAverage(groups[k], k, *meta, names.group_aqi[k], output_writer), names.group_aqi[k]))
+            written = false;
+    }
+    int interval = -1;                              /* duration measurement */
+    list = calculateAverageValue(data, num_sensors, &interval, rollup, meta != NULL ? groups : NULL);
+    if (!checkOutputFile(closeRollups(rollup), rollup_names))
+        written = false;
+    for (int k = 0; meta != NULL && k < NUM_META_GROUPS; k++)
+    {
+        if (!checkOutputFile(closeGroupAverage(groups[k], names.group_statistics[k], output_writer), 
+            names.group_aqi[k] + ", " + names.group_statistics[k]))
+            written = false;
+    }
+
+    if (!names.aqi.empty())
+        spawnTask(pool, group, [&list, &names, &written] 
+            { if (!checkOutputFile(writeCalculateAverageValue(list, names.aqi), names.aqi)) written = false; });
+    if (!names.aqi_columnar.empty())
+        spawnTask(pool, group, [&list, &names, &written] 
+            { if (!checkOutputFile(writeAverageColumns(list, names.aqi_columnar), names.aqi_columnar)) written = false; });
+    spawnTask(pool, group, [&data, num_sensors, interval, &names, &written] 
+        { if (!analyseSensorData(data, num_sensors, interval, names.summary, names.summary_columnar)) written = false; });
+    spawnTask(pool, group, [&list, num_sensors, &names, &written] 
+        { if (!checkOutputFile(SensorAverageStat(list, num_sensors, names.statistics), names.statistics)) written = false; });
+}
+
+/* Run task 2.1 - 2.4 on readings of one data set
+* Inputs:
+    pool: thread pool
+    readings: readings in time order
+    options: options of task 2.1
+    names: output names
+    num_valid, num_outlier: number of valid readings and outliers
+* Output: true (if all output files are written and data fit in memory budget) or false */
+bool processDataSet(WorkPool &pool, const vector<const RawReading*> &readings, const ProcessOptions &options,
+    const OutputNames &names, size_t &num_valid, int &num_outlier)
+{
+    CoverageTracker coverage;       /* readings of each sensor per hour */
+    if (options.sampling > 0 && !initCoverageTracker(coverage, options.sampling, options.min_coverage, 
+        names.coverage, output_writer))
+    {
+        error(03, LOG_FILE, names.coverage);
+        return false;
+    }
+    HampelFilter hampel;            /* rolling median/MAD of each sensor */
+    initHampelFilter(hampel, options.window, options.threshold);
+
+    int num_sensors;
+    bool filter_written;
+    Arena times;                    /* time strings of data */
+    initArena(times, options.budget, options.huge_pages);
+    vector<DataField> data = filterReadings(readings, names.outlier, 
+        options.filter_mode == FILTER_HAMPEL ? &hampel : NULL, options.sampling > 0 ? &coverage : NULL, 
+        times, &num_sensors, &num_outlier, &filter_written);
+    num_valid = data.size();
+    if (times.failed)
+        error(06, LOG_FILE);
+    if (times.failed || !filter_written)
+    {
+        freeArena(times);
+        return false;
+    }
+
+    TaskGroup group;
+    vector<averageValue> list;
+    atomic<bool> written(true);
+    analyseDataSet(pool, group, data, num_sensors, options.meta, names, list, written);
+    waitGroup(pool, group);
+    freeArena(times);
+    return written;
+}
+
+/* List input files of batch
+* Inputs:
+    source: directory (all .csv files in it) or manifest (one file per line)
+    output_dir: directory of output files, empty for current directory
+    files: input files, output files of each one begin with its name
+* Output: true (if source can be read) or false */
+bool listBatchFiles(const string &source, const string &output_dir, vector<SensorFile> &files)
+{
+    vector<string> locations;
+    error_code code;
+    if (filesystem::is_directory(source, code))
+    {
+        for (const filesystem::directory_entry &entry : filesystem::directory_iterator(source, code))
+        {
+            if (entry.is_regular_file(code) && entry.path().extension() == ".csv")
+                locations.push_back(entry.path().string());
+        }
+        if (code)
+            return false;
+        sort(locations.begin(), locations.end());
+    }
+    else
+    {
+        ifstream manifest(source);
+        if (!manifest)
+            return false;
+        string line;
+        while (getline(manifest, line))
+        {
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            if (!line.empty())
+                locations.push_back(line);
+        }
+    }
+
+    string directory = output_dir.empty() ? "" : output_dir + "/";
+    for (const string &location : locations)
+        files.push_back({location, directory + filesystem::path(location).stem().string() + "_", "", {}, false, 0, 0, {}});
+    return true;
+}
+
+/* Check format of input file of batch and load it
+* Inputs: pool, input file, options of task 2.1
+* Output: true (if file is loaded) or false */
+bool loadBatchFile(WorkPool &pool, SensorFile &file, const ProcessOptions &options)
+{
+    return scanFile(file.location, LOG_FILE, READ_MODE) && if_DUST_SENSOR_file(file.location, LOG_FILE)
+        && loadSensorFile(pool, file, options);
+}
+
+/* notifications of batch come from many threads */
+mutex notify_lock;
+
+/* Run task 2.1 - 2.4 on input file of batch, output files begin with name of input file
+* Inputs: pool, input file, options of task 2.1 */
+void processSensorFile(WorkPool &pool, SensorFile &file, const ProcessOptions &options)
+{
+    file.ok = loadBatchFile(pool, file, options);
+    if (!file.ok)
+    {
+        releaseSensorFile(file, options);
+        return;
+    }
+
+    vector<const RawReading*> readings;
+    collectReadings(file, readings);
+    size_t num_valid;
+    int num_outlier;
+    file.ok = processDataSet(pool, readings, options, outputNames(file.prefix, options), num_valid, num_outlier);
+
+    /* text and readings are not used any more */
+    releaseSensorFile(file, options);
+
+    if (file.ok)
+    {
+        lock_guard<mutex> guard(notify_lock);
+        cout << "Processed " << file.location << ": " << num_valid << " valid readings, " << num_outlier 
+            << " outliers. Output files: " << file.prefix << "dust_*" << endl;
+    }
+}
+
+/* Run task 2.1 - 2.4 on every input file of batch. Each file is a task of pool,
+large file is split in sub-tasks, idle threads steal tasks of busy threads
+* Inputs:
+    pool: thread pool
+    files: input files
+    options: options of task 2.1
+    merged: one set of output files for readings of all files (same id is same sensor)
+    output_dir: directory of output files, empty for current directory
+* Output: number of files which are not processed */
+int processBatch(WorkPool &pool, vector<SensorFile> &files, const ProcessOptions &options, bool merged,
+    const string &output_dir)
+{
+    TaskGroup group;
+    if (!merged)
+    {
+        for (SensorFile &file : files)
+            spawnTask(pool, group, [&pool, &file, &options] { processSensorFile(pool, file, options); });
+        waitGroup(pool, group);
+    }
+    else
+    {
+        for (SensorFile &file : files)
+            spawnTask(pool, group, [&pool, &file, &options] { file.ok = loadBatchFile(pool, file, options); });
+        waitGroup(pool, group);
+
+        /* readings of all files in time order, readings at same time keep order of files */
+        vector<const RawReading*> readings;
+        size_t num_lines = 0;
+        for (const SensorFile &file : files)
+            num_lines += file.ok ? file.num_lines : 0;
+        readings.reserve(num_lines);
+        for (const SensorFile &file : files)
+        {
+            if (file.ok)
+                collectReadings(file, readings);
+        }
+        stable_sort(readings.begin(), readings.end(), 
+            [](const RawReading *a, const RawReading *b) { return a->time_str < b->time_str; });
+
+        size_t num_valid;
+        int num_outlier;
+        string prefix = output_dir.empty() ? "" : output_dir + "/";
+        OutputNames names = outputNames(prefix, options);
+        if (processDataSet(pool, readings, options, names, num_valid, num_outlier))
+        {
+            cout << "Processed merged input: " << num_valid << " valid readings, " << num_outlier 
+                << " outliers. Output files: " << prefix << "dust_*" << endl;
+        }
+        else
+        {
+            for (SensorFile &file : files)
+                file.ok = false;
+        }
+        for (SensorFile &file : files)
+            releaseSensorFile(file, options);
+    }
+
+    int num_failed = 0;
+    for (const SensorFile &file : files)
+    {
+        if (!file.ok)
+            num_failed++;
+    }
+    return num_failed;
+}
+
+/* Run task 2.1 - 2.4 on one input file or ring, output files have default names
+* Inputs:
+    pool: thread pool
+    file_location: file directory (if ring_in is empty)
+    ring_in, producers: ring written by dust_sim and number of dust_sim, empty if input file is used
+    ring_out: ring read by dust_convert, empty if dust_aqi.csv is written
+    options: options of task 2.1
+* Output: 0 (if success) or 1 */
+int processInput(WorkPool &pool, const string &file_location, const string &ring_in, int producers,
+    const string &ring_out, const ProcessOptions &options)
+{
+    OutputNames names = outputNames("", options);
+    if (!ring_out.empty())
+        names.aqi = "";         /* average values go to ring */
+
+    /* check if file has correct format and load it */
+    SensorFile file = {file_location, "", "", {}, false, 0, 0, {}};
+    if (ring_in.empty() && !if_DUST_SENSOR_file(file_location, LOG_FILE)) 
+        return 1;
+    if (ring_in.empty() && !loadSensorFile(pool, file, options))
+        return 1;
+#ifdef __linux__
+    SharedRing input_ring;
+    if (!ring_in.empty() && !openRing(input_ring, ring_in, producers)) 
+    {
+        error(03, LOG_FILE, ring_in);
+        return 1;
+    }
+#endif
+
+    /* task 2.1 */
+    CoverageTracker coverage;   /* readings of each sensor per hour */
+    if (options.sampling > 0 && !initCoverageTracker(coverage, options.sampling, options.min_coverage, 
+        names.coverage, output_writer))
+    {
+        error(03, LOG_FILE, names.coverage);
+#ifdef __linux__
+        if (!ring_in.empty())
+            closeRing(input_ring, true);
+#endif
+        return 1;
+    }
+
+    int num_sensors;            /* number of sensors */
+    int num_outlier;
+    HampelFilter hampel;        /* rolling median/MAD of each sensor */
+    initHampelFilter(hampel, options.window, options.threshold);
+    HampelFilter *hampel_filter = options.filter_mode == FILTER_HAMPEL ? &hampel : NULL;
+    CoverageTracker *tracker = options.sampling > 0 ? &coverage : NULL;
+    vector<DataField> data;     /* handle valid data */
+    bool filter_written = false;
+    Arena times;                /* time strings of data */
+    initArena(times, options.budget, options.huge_pages);
+    if (ring_in.empty())
+    {
+        vector<const RawReading*> readings;
+        collectReadings(file, readings);
+        data = filterReadings(readings, names.outlier, hampel_filter, tracker, times, &num_sensors, &num_outlier,
+            &filter_written);
+        releaseSensorFile(file, options);
+    }
+#ifdef __linux__
+    else 
+    {
+        data = receiveDatainRing(input_ring, producers, names.outlier, hampel_filter, tracker, options.meta, 
+            times, &num_sensors, &num_outlier, &filter_written);
+        closeRing(input_ring, true);
     }
+#endif
+    if (times.failed)
+    {
+        error(06, LOG_FILE);
+        return 1;
+    }
+    if (!filter_written)
+        return 1;
+    cout << "Filter outliers completely. Output file: " << names.outlier << endl;          /* notify */
+    if (options.sampling > 0) 
+    {
+        cout << "Duplicates: " << coverage.num_duplicates << ", sensor-hours below " << options.min_coverage 
+            << "% coverage: " << coverage.num_excluded << ". Output file: " << names.coverage << endl;
+    }
+
+    /* task 2.2 - 2.4 */
+    TaskGroup group;
+    vector<averageValue> list;  /* average values */
+    atomic<bool> written(true); /* all output files are written */
+    analyseDataSet(pool, group, data, num_sensors, options.meta, names, list, written);
+
+    bool ring_failed = false;
+#ifdef __linux__
+    if (!ring_out.empty()) 
+    {
+        SharedRing ring;
+        ring_failed = !openRing(ring, ring_out, 1);
+        if (!ring_failed) 
+        {
+            sendAverageValue(ring, list);
+            closeRing(ring, false);
+        }
+    }
+#endif
+    waitGroup(pool, group);
+    freeArena(times);
 
-    OUTPUT_STREAM.close();
+    if (ring_failed) 
+    {
+        error(03, LOG_FILE, ring_out);
+        return 1;
+    }
+    if (!written)
+        return 1;
+    cout << "Roll up AQI completely. Output files: " << names.daily << ", " << names.weekly 
+        << ", " << names.monthly << endl;           /* notify */
+    if (!ring_out.empty())
+        cout << "Calculate AQI completely. Sent to ring: " << ring_out << endl;
+    else if (!names.aqi.empty())
+        cout << "Calculate AQI completely. Output file: " << names.aqi << endl;      /* notify */
+    if (!names.summary.empty())
+        cout << "Analysed sensor data completely. Output file: " << names.summary << endl;
+    if (!names.aqi_columnar.empty())
+        cout << "Exported AQI and sensor data by column. Output files: " << names.aqi_columnar << ", "
+            << names.summary_columnar << endl;
+    cout << "Analysed sensor statistics completely. Output file: " << names.statistics << endl;
+    if (options.meta != NULL)
+        cout << "Grouped AQI by site and region. Output files: " << names.group_aqi[META_SITE] << ", "
+            << names.group_aqi[META_REGION] << ", " << names.group_statistics[META_SITE] << ", " 
+            << names.group_statistics[META_REGION] << endl;
+    return 0;
 }
 
 /* Find max, min, mean value of each sensor
 * Inputs: command-line statement
+    dust_process [input file] [-f range|hampel] [-w window] [-k threshold]
+        [-ring-in name] [-producers number of dust_sim] [-ring-out name]
+        [-st sampling] [-cov min coverage (%)] [-t threads] [-format csv|columnar|both] [-meta file]
+        [-memory-budget MiB] [-huge-pages on|off]
+    dust_process -batch directory|manifest [-batch-out file|merged] [-od output directory]
+        [-f range|hampel] [-w window] [-k threshold] [-st sampling] [-cov min coverage (%)] [-t threads]
+        [-format csv|columnar|both] [-meta file] [-memory-budget MiB] [-huge-pages on|off]
+    batch input is every .csv file in directory or every file listed in manifest (one per line),
+    paths are relative to working directory
+    metadata file has lines id,site,region[,offset,gain], value of sensor is changed to
+    value * gain + offset before outliers are filtered
+    memory budget counts input text, readings, valid data and their time strings (all files of batch
+    together), input file which does not fit is not processed (error 06)
 * Output: 
     dust_outliers.csv
-    dust_aqi.csv
+    dust_coverage.csv (if sampling time is given)
+    dust_aqi.csv (or average values sent to ring)
+    dust_aqi_daily.csv, dust_aqi_weekly.csv, dust_aqi_monthly.csv
     dust_summary.csv
     dust_aqi.csv
+    dust_aqi.col, dust_summary.col (if -format columnar or both, see columnar.h)
+    dust_aqi_site.csv, dust_aqi_region.csv, dust_statistics_site.csv, dust_statistics_region.csv (if -meta)
+    (batch: same files for each input file with name of input file in front, e.g. gw01_dust_aqi.csv,
+    or one set for all input files if -batch-out merged)
     task2.log
     nofication of each sub-task (should appear if process run successfully)
 * Pre-condition: task2.log is accessible
@@ -411,56 +1288,185 @@ int main(int argc, char *argv[])
     }
 
     string input_filename = "dust_sensor.csv";          /* default input file */
-    if (argc == 2) 
+    ProcessOptions options = {FILTER_RANGE, HAMPEL_WINDOW, HAMPEL_THRESHOLD, 0, 0.0, OUTPUT_CSV, NULL, NULL, false};
+    string ring_in = "";                                /* read readings from ring instead of input file */
+    string ring_out = "";                               /* send average values to ring instead of dust_aqi.csv */
+    int producers = 1;
+    string batch = "";                                  /* directory or manifest of input files */
+    bool merged = false;
+    string output_dir = "";
+    string meta_file = "";                              /* site, region and calibration of sensors */
+    long long budget_mb = 0;                            /* memory budget (MiB), 0 if there is no limit */
+    int num_threads = max(1, (int)thread::hardware_concurrency());
+
+    int argPos = 1;
+    if (argc >= 2 && argv[1][0] != '-') 
     {
         string temp_str = argv[1];
         input_filename.assign(temp_str);                /* new input file */
+        argPos = 2;
     }
-    /* get file directory */
-    string file_location = INPUT_FILE_LOCATION;
-    file_location.push_back('/');
-    file_location.append(input_filename); 
 
-    /* task 2.1 */
-    /* check if input file and dust_outliers.csv are accessible*/
-    if (!scanFile(INPUT_FILE_LOCATION, input_filename, LOG_FILE, READ_MODE))
+    /* check if options are valid and get value */
+    for (int i = argPos; i < argc; i += 2) 
+    {
+        string str = argv[i];
+        if (i + 1 >= argc) 
+        {
+            error(02, LOG_FILE);
+            return 1;
+        }
+
+        string value = argv[i + 1];
+        if (str == "-f" && value == "range")
+            options.filter_mode = FILTER_RANGE;         /* fixed bounds only */
+        else if (str == "-f" && value == "hampel")
+            options.filter_mode = FILTER_HAMPEL;        /* fixed bounds and rolling median/MAD */
+        else if (str == "-w")
+            options.window = atoi(argv[i + 1]);         /* window of Hampel filter */
+        else if (str == "-k")
+            options.threshold = atof(argv[i + 1]);      /* threshold of Hampel filter */
+        else if (str == "-ring-in")
+            ring_in = value;
+        else if (str == "-ring-out")
+            ring_out = value;
+        else if (str == "-producers")
+            producers = atoi(argv[i + 1]);
+        else if (str == "-st")
+            options.sampling = atoi(argv[i + 1]);       /* same as dust_sim -st */
+        else if (str == "-cov")
+            options.min_coverage = atof(argv[i + 1]);
+        else if (str == "-batch")
+            batch = value;
+        else if (str == "-format" && (value == "csv" || value == "columnar" || value == "both"))
+            options.output_format = (value == "csv") ? OUTPUT_CSV : (value == "columnar") ? OUTPUT_COLUMNAR
+                                  : OUTPUT_CSV | OUTPUT_COLUMNAR;
+        else if (str == "-batch-out" && (value == "file" || value == "merged"))
+            merged = (value == "merged");
+        else if (str == "-od")
+            output_dir = value;
+        else if (str == "-meta")
+            meta_file = value;
+        else if (str == "-memory-budget" && atoll(argv[i + 1]) > 0)
+            budget_mb = atoll(argv[i + 1]);
+        else if (str == "-huge-pages" && (value == "on" || value == "off"))
+            options.huge_pages = (value == "on");
+        else if (str == "-t")
+            num_threads = atoi(argv[i + 1]);
+        else 
+        {
+            error(02, LOG_FILE);
+            return 1;
+        }
+    }
+
+    /* coverage needs sampling time, batch reads files only */
+    if (options.window < 3 || options.threshold <= 0 || producers < 1 || options.sampling < 0 
+        || options.sampling > 3600 || options.min_coverage < 0 || options.min_coverage > 100 
+        || (options.min_coverage > 0 && options.sampling == 0) || num_threads < 1
+        || (!batch.empty() && (argPos == 2 || !ring_in.empty() || !ring_out.empty()))) 
+    {
+        error(02, LOG_FILE);
         return 1;
-    
-    if (!scanFile(OUTLIER_FILE,LOG_FILE,WRITE_MODE)) 
+    }
+#ifndef __linux__
+    if (!ring_in.empty() || !ring_out.empty()) 
+    {
+        error(02, LOG_FILE);            /* shared memory ring needs Linux */
         return 1;
+    }
+#endif
+    MemoryBudget budget;                                /* memory in use is always counted */
+    initMemoryBudget(budget, (size_t)budget_mb * MEBIBYTE);
+    options.budget = &budget;
 
-    /* check if file has correct format */
-    if (!if_DUST_SENSOR_file(file_location, LOG_FILE)) 
-        return 1;
+    /* load metadata before output names are made */
+    SensorMetadata meta;
+    if (!meta_file.empty())
+    {
+        if (!scanFile(meta_file, LOG_FILE, READ_MODE) || !loadSensorMetadata(meta_file, meta, LOG_FILE))
+            return 1;
+        options.meta = &meta;
+    }
 
-    int num_sensors;            /* number of sensors */
-    int interval = -1;          /* duration measurement */
-    vector<DataField> data = sortDatainFile(file_location, &num_sensors);       /* handle valid data */
+    /* get file directory */
+    string file_location = INPUT_FILE_LOCATION;
+    file_location.push_back('/');
+    file_location.append(input_filename); 
 
-    /* task 2.2 */
-    vector<averageValue> list = calculateAverageValue(data, num_sensors, &interval);        /* get average data list */
-    /* check if dust_aqi.csv is accessible */
-    if (!scanFile(AQI_FILE, LOG_FILE, WRITE_MODE))
-        return 1;
+    vector<SensorFile> files;                           /* input files of batch */
+    if (batch.empty())
+    {
+        /* check if input file and all output files are accessible before any work */
+        if (ring_in.empty() && !scanFile(INPUT_FILE_LOCATION, input_filename, LOG_FILE, READ_MODE))
+            return 1;
+        OutputNames names = outputNames("", options);
+        if (!ring_out.empty())
+            names.aqi = "";
+        if (!checkOutputFiles(names))
+            return 1;
+    }
+    else
+    {
+        error_code code;
+        if (!output_dir.empty())
+            filesystem::create_directories(output_dir, code);
+        if (!listBatchFiles(batch, output_dir, files))
+        {
+            error(03, LOG_FILE, batch);
+            return 1;
+        }
 
-    writeCalculateAverageValue(list);           /* write data */
-    cout << "Calculate AQI completely. Output file: " << AQI_FILE << endl;      /* notify */
+        /* two input files with same name would write same output files */
+        vector<string> prefixes;
+        for (const SensorFile &file : files)
+            prefixes.push_back(file.prefix);
+        sort(prefixes.begin(), prefixes.end());
+        if (files.empty() || (!merged && adjacent_find(prefixes.begin(), prefixes.end()) != prefixes.end()))
+        {
+            error(02, LOG_FILE);
+            return 1;
+        }
 
-    /* task 2.3 */
-    /* check if dust_summary.csv is accessible */
-    if (!scanFile(SENSOR_ANALYSING_FILE,LOG_FILE,WRITE_MODE))
-        return 1;
+        if (merged && !checkOutputFiles(outputNames(output_dir.empty() ? "" : output_dir + "/", options)))
+            return 1;
+        for (int i = 0; !merged && i < (int)files.size(); i++)
+        {
+            if (!checkOutputFiles(outputNames(files[i].prefix, options)))
+                return 1;
+        }
+    }
 
-    analyseSensorData(data, num_sensors, interval);             
-    cout << "Analysed sensor data completely. Output file: " << SENSOR_ANALYSING_FILE << endl;
+    /* write output files in background (io_uring or writer threads) */
+    AsyncWriter writer;
+    if (initAsyncWriter(writer))
+        output_writer = &writer;
+    WorkPool pool;
+    initPool(pool, num_threads);
 
-    /* task 2.4 */
-    /* check if dust_statistics.csv is accessible*/
-    if (!scanFile(SENSOR_STATISTICS_FILE,LOG_FILE,WRITE_MODE))
-        return 1;
+    int result;
+    if (batch.empty())
+        result = processInput(pool, file_location, ring_in, producers, ring_out, options);
+    else
+    {
+        auto start = chrono::steady_clock::now();
+        int num_failed = processBatch(pool, files, options, merged, output_dir);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << "Processed " << files.size() - num_failed << " of " << files.size() << " input files in " 
+            << fixed << setprecision(3) << seconds << " s with " << num_threads << " threads." << endl;
+        result = (num_failed > 0) ? 1 : 0;
+    }
 
-    SensorAverageStat(list, num_sensors);
-    cout << "Analysed sensor statistics completely. Output file: " << SENSOR_STATISTICS_FILE << endl;
+    closePool(pool);
+    if (output_writer != NULL && !closeAsyncWriter(writer))
+        error(03, LOG_FILE, "output files");
 
-    return 0;    
-}
\ No newline at end of file
+    /* peak of counted memory, for sizing of budget */
+    if (budget.refused > 0)
+        cout << "Memory budget exceeded: " << (budget.refused + MEBIBYTE - 1) / MEBIBYTE << " MiB needed, " 
+            << budget_mb << " MiB allowed." << endl;
+    else if (budget_mb > 0)
+        cout << "Memory counted in budget: peak " << (budget.peak + MEBIBYTE - 1) / MEBIBYTE << " MiB of " 
+            << budget_mb << " MiB." << endl;
+    return result;
+}
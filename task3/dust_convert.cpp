@@ -7,176 +7,433 @@
 #include "../header.h"
 #include "../error.h"
 #include "../readfile.h"
+#include "../writer.h"
+#include "../packet.h"
+#include "../queue.h"
+#include "../aqi.h"
+#include "../ring.h"
+#include "../validate.h"
+#include <thread>
+#include <map>
+#include <atomic>
 
 #define AQI_FILE_LOCATION "../task2"
 #define LOG_FILE "task3.log"
 
-/* Define datatype of each data in packet */
-typedef unsigned char packet_id;
-typedef unsigned char packet_start_end;
-typedef int packet_time;
-typedef float packet_value;
-typedef short int packet_aqi;
-typedef unsigned char packet_checksum;
-typedef unsigned char packet_length;
-
-const packet_length PACKET_SIZE = sizeof(packet_aqi) + sizeof(packet_checksum) 
-                                + sizeof(packet_id) + sizeof(packet_length)
-                                + sizeof(packet_time) + sizeof(packet_value)
-                                + 2 * sizeof(packet_start_end);
-const packet_start_end START_BYTE = 0x7A;
-const packet_start_end END_BYTE = 0x7F;
-
-/* Check if date and time is in format YYYY:MM:DD hh:mm:ss
-* Inputs: time string
-* Output: true or false */
-bool checkDateFormat(string date) 
+#define BATCH_BYTES         (256 * 1024)    /* input text per batch */
+#define MAX_BATCHES         64              /* batches read but not written yet */
+
+/* Convert string of digits to number
+* Input: number string, result
+* Output: true (if string is valid) or false */
+bool parseInteger(const string &num_str, int &num) 
 {
-    /* extract time string in parts */
-    stringstream ss(date);
-    int year, month, day, hour, min, sec;
-    char colon1, colon2, colon3, colon4;
-    ss >> year >> colon1 >> month >> colon2 >> day >> hour >> colon3 >> min >> colon4 >> sec;
-
-    /* check if parts are valid */
-    if ((month >= 1 && month <= 12)
-        && (day >= 1 && day <= 31)
-        && (hour >= 0 && hour <= 23)
-        && (min >= 0 && min <= 59)
-        && (sec >= 0 && sec <= 59)
-        && (colon1 == ':') && (colon2 == ':') && (colon3 == ':') && (colon4 == ':'))
-        return true;
-
-    return false;
+    if (num_str.empty() || num_str.size() > 9)
+        return false;
+
+    num = 0;
+    for (char c : num_str) 
+    {
+        if (!isdigit((unsigned char)c))
+            return false;
+        num = num * 10 + (c - '0');
+    }
+    return true;
 }
 
-/* Convert date and time to time in seconds
-* Input: time string
-* Output: time in seconds */
-packet_time UnixTimestampConvert(string time_str) 
+/* Create data packet
+* Input: 
+    temp_str: data line in input file
+    packet: byte array (PACKET_SIZE bytes)
+* Output: true (if data line is valid) or false */
+bool loadingPacket(string &temp_str, packet_checksum *packet) 
 {
-    tm timeStruct;
-    stringstream ss(time_str);          
-    /* get time from time string */
-    ss >> get_time(&timeStruct, "%Y:%m:%d %H:%M:%S");
-    time_t time = mktime(&timeStruct); 
+    string id_str, time_str, value_str, aqi_str;
+    if (!temp_str.empty() && temp_str.back() == '\r')
+        temp_str.pop_back();
+    stringstream ss(temp_str);
 
-    return static_cast<packet_time>(time);
+    /* extract dataline in parts */
+    getline(ss, id_str, ',');
+    getline(ss, time_str, ',');
+    getline(ss, value_str, ',');
+    getline(ss, aqi_str, ',');
+
+    /* check if data is missing or invalid */
+    int id, aqi;
+    packet_value value;
+    const char *value_end = value_str.data() + value_str.size();
+    if (!parseInteger(id_str, id) || (id <= 0) || (checkDateFormat(time_str) == false)
+        || value_str.empty() || from_chars(value_str.data(), value_end, value).ptr != value_end
+        || !parseInteger(aqi_str, aqi)) 
+        return false;
+
+    /* extract data in each line in file and insert byte in packet */
+    fillPacket(packet, static_cast<packet_id>(id), UnixTimestampConvert(time_str), value, static_cast<packet_aqi>(aqi));
+    return true;
 }
 
-/* Check if system is little-endian
-* Output: true or false */
-bool ifSystemIsLittleEnd() 
+/* Get record for version 2 frame from data line
+* Input: 
+    temp_str: data line in input file
+    record: result
+    hour: hour part of time string (output)
+* Output: true (if data line is valid) or false */
+bool loadingRecord(string &temp_str, FrameRecord &record, string &hour) 
 {
-    union {
-        float num;
-        uint8_t array[4];
-    } temp;
-
-    temp.num = 234.5;
-    // 234.5 = 0x436a8000
-    if (temp.array[0] == 0x00)
-        return true;
-    else
+    string id_str, time_str, value_str, aqi_str;
+    if (!temp_str.empty() && temp_str.back() == '\r')
+        temp_str.pop_back();
+    stringstream ss(temp_str);
+
+    /* extract dataline in parts */
+    getline(ss, id_str, ',');
+    getline(ss, time_str, ',');
+    getline(ss, value_str, ',');
+    getline(ss, aqi_str, ',');
+
+    /* check if data is missing or invalid */
+    if (!parseInteger(id_str, record.id) || (record.id <= 0)
+        || (time_str.size() < 13) || (checkDateFormat(time_str) == false)
+        || !parseDustValue(value_str, record.value) || (record.value < 0) || !parseInteger(aqi_str, record.aqi))
         return false;
+
+    record.time = UnixTimestampConvert(time_str);
+    hour.assign(time_str, 0, 13);
+    return true;
 }
 
-/* Convert data from decimal to hexa 
-* Input: Decimal value
-* Output: Hexa value */
-template <typename data_type>
-vector<packet_checksum> decimalToHexa(data_type num, bool little_endian) 
+/* Structure for batch of input lines */
+struct LineBatch 
+{
+    long seq;                   /* batch order in input file */
+    int first_line;             /* line position of first line */
+    string text;                /* whole lines */
+};
+
+/* Structure for converted batch */
+struct PacketBatch 
+{
+    string text;                /* hexa lines of valid packets */
+    int error_line;             /* line position of invalid line, 0 if none */
+    long long num_records;
+    long long num_bytes;
+};
+
+/* Structure for putting converted batches back in input order */
+struct OrderedOutput 
+{
+    mutex lock;
+    condition_variable ready;           /* new batch converted */
+    condition_variable space;           /* batch written */
+    map<long, PacketBatch> done;        /* converted batches not written yet */
+    long next_seq;                      /* next batch to write */
+    long total;                         /* number of batches, -1 if still reading */
+    atomic<bool> stopped;               /* error found, stop reading */
+    atomic<long long> num_records;      /* number of converted data lines */
+    atomic<long long> num_bytes;        /* size of packets (not hexa text) */
+};
+
+/* Reader: split input file in batches of whole lines
+* Inputs: input file directory, queue of batches, output order
+* Output: batches in queue */
+void readStage(string input_filepath, BoundedQueue<LineBatch> &batches, OrderedOutput &order) 
 {
-    vector<packet_checksum> packet;     /* handle byte array */
-    union FloatBytes                    /* structure for conversion */
+    ifstream INPUT_STREAM(input_filepath, ios::binary);
+    string temp_str;
+    getline(INPUT_STREAM, temp_str);                /* skip first line */
+
+    long seq = 0;
+    int linePos = 1;
+    string rest;                                    /* unfinished line of previous block */
+    vector<char> block(BATCH_BYTES);
+
+    while (INPUT_STREAM) 
     {
-        data_type num;
-        unsigned char byteArray[sizeof(data_type)];
-    } converter;
-    converter.num = num;
+        INPUT_STREAM.read(block.data(), BATCH_BYTES);
+        size_t size = INPUT_STREAM.gcount();
+        if (size == 0)
+            break;
+
+        /* keep unfinished line for next batch, except at end of file */
+        size_t cut = size;
+        if (INPUT_STREAM) 
+        {
+            while (cut > 0 && block[cut - 1] != '\n')
+                cut--;
+        }
+
+        LineBatch batch = {seq, linePos, rest};
+        batch.text.append(block.data(), cut);
+        rest.assign(block.data() + cut, size - cut);
+        if (batch.text.empty())
+            continue;
+
+        /* wait if writer is too far behind */
+        {
+            unique_lock<mutex> guard(order.lock);
+            order.space.wait(guard, [&] { return seq - order.next_seq < MAX_BATCHES || order.stopped; });
+            if (order.stopped)
+                break;
+        }
 
-    /* if system is liitle-endian, order the bytes reversely */
-    if (little_endian) 
+        for (char c : batch.text)
+            linePos += (c == '\n');
+        pushQueue(batches, std::move(batch));
+        seq++;
+    }
+
+    if (!rest.empty() && !order.stopped)
+        pushQueue(batches, LineBatch{seq++, linePos, rest});
+
+    closeQueue(batches);
     {
-        for (int i = sizeof(data_type) - 1; i >= 0; i--)
-            packet.push_back(static_cast<int>(converter.byteArray[i]));
+        lock_guard<mutex> guard(order.lock);
+        order.total = seq;
     }
-    else 
+    order.ready.notify_all();
+}
+
+/* Create version 2 frame of records and append it as hexa line
+* Inputs: records (cleared after), converted batch */
+void flushFrame(vector<FrameRecord> &records, PacketBatch &result) 
+{
+    if (records.empty())
+        return;
+
+    packet_time base_time = records[0].time;
+    for (const FrameRecord &record : records)
+        base_time = min(base_time, record.time);
+
+    vector<unsigned char> frame = buildFrameV2(records.data(), records.size(), base_time);
+    appendPacket(result.text, frame);
+    result.num_bytes += frame.size();
+    records.clear();
+}
+
+/* Create version 2 frames of lines in batch, one frame per hour
+* Inputs: batch, converted batch
+* Output: hexa lines in result */
+void convertBatchV2(LineBatch &batch, PacketBatch &result) 
+{
+    stringstream ss(batch.text);
+    string temp_str, hour, frame_hour;
+    vector<FrameRecord> records;
+    int linePos = batch.first_line;
+
+    while (getline(ss, temp_str)) 
     {
-        for (int i = 0; i < sizeof(data_type); i++)
-            packet.push_back(static_cast<int>(converter.byteArray[i]));
+        FrameRecord record;
+        if (!loadingRecord(temp_str, record, hour)) 
+        {
+            result.error_line = linePos;
+            break;
+        }
+
+        if (hour != frame_hour || records.size() == FRAME_MAX_RECORDS) 
+        {
+            flushFrame(records, result);
+            frame_hour = hour;
+        }
+        records.push_back(record);
+        result.num_records++;
+        linePos++;
     }
+    flushFrame(records, result);
+}
 
-    return packet;
+/* Create version 1 packets of lines in batch
+* Inputs: batch, converted batch
+* Output: hexa lines in result */
+void convertBatch(LineBatch &batch, PacketBatch &result) 
+{
+    stringstream ss(batch.text);
+    string temp_str;
+    int linePos = batch.first_line;
+    packet_checksum packet[PACKET_SIZE];
+    while (getline(ss, temp_str)) 
+    {
+        if (!loadingPacket(temp_str, packet))       /* get packet */
+        {
+            result.error_line = linePos;
+            break;
+        }
+        appendPacket(result.text, packet, PACKET_SIZE);
+        result.num_records++;
+        result.num_bytes += PACKET_SIZE;
+        linePos++;
+    }
 }
 
-/* Calculate checksum of packet
-* Input: vector<packet_checksum> packet - data packet
-* Output: Checksum */
-packet_checksum calculateCheckSum(vector<packet_checksum> &packet) 
+/* Worker: create packets of all lines in batch
+* Inputs: queue of batches, output order, packet version
+* Output: converted batches in order.done */
+void convertStage(BoundedQueue<LineBatch> &batches, OrderedOutput &order, int version) 
 {
-    packet_checksum checksum = 0;
-    for (const packet_checksum& byte : packet) 
-        checksum += byte;
+    LineBatch batch;
+    while (popQueue(batches, batch)) 
+    {
+        PacketBatch result = {"", 0, 0, 0};
+        result.text.reserve(batch.text.size() * 2);
+
+        if (!order.stopped && version == PACKET_VERSION_2)
+            convertBatchV2(batch, result);
+        else if (!order.stopped)
+            convertBatch(batch, result);
+        order.num_records += result.num_records;
+        order.num_bytes += result.num_bytes;
 
-    return static_cast<packet_checksum>(~checksum + 1);
+        {
+            lock_guard<mutex> guard(order.lock);
+            order.done[batch.seq] = std::move(result);
+        }
+        order.ready.notify_all();
+    }
 }
 
-/* Create data packet
-* Input: temp_str - data line in input file
-* Output: vector<packet_checksum> packet storing byte array */
-vector<packet_checksum> loadingPacket(string &temp_str) 
+/* Convert hexa digit to number
+* Input: character
+* Output: 0 - 15, -1 if not hexa digit */
+int hexaValue(char c) 
 {
-    string id_str, time_str, value_str, aqi_str;
-    stringstream ss(temp_str);
-    vector<packet_checksum> packet;
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
 
-    /* extract dataline in parts */
-    getline(ss, id_str, ',');
-    getline(ss, time_str, ',');
-    getline(ss, value_str, ',');
-    getline(ss, aqi_str, ',');
+/* Read version 2 frames (hexa lines) and write records in dust_aqi.csv format
+* Input: input and output file name
+* Output: line position of invalid frame, 0 if none, -1 if output file cannot be written */
+int decodeFrames(string input_filename, string output_filename) 
+{
+    ifstream INPUT_STREAM(input_filename);
+    WriteBuffer OUTPUT_STREAM;
+    if (!openWriteBuffer(OUTPUT_STREAM, output_filename))
+        return -1;
+    writeText(OUTPUT_STREAM, "id,time,value,aqi,pollution\n");
+
+    string temp_str;
+    vector<unsigned char> frame;
+    vector<FrameRecord> records;
+    int linePos = 0;
 
-    /* check if data missing */
-    if ((id_str.size() == 0) || (time_str.size() == 0)
-        || (value_str.size() == 0)  || (aqi_str.size() == 0) 
-        || (checkDateFormat(time_str) == false) && (stoi(id_str) <= 0)) 
+    while (getline(INPUT_STREAM, temp_str)) 
     {
-        packet.push_back(0);            /* if yes, return zero packet */
-        return packet;
-    }
+        linePos++;
+        frame.clear();
+        records.clear();
 
-    bool little_end = ifSystemIsLittleEnd();
+        /* "7B 02 ..." to byte array */
+        bool valid = true;
+        for (size_t i = 0; i + 1 < temp_str.size(); i += 3) 
+        {
+            int high = hexaValue(temp_str[i]), low = hexaValue(temp_str[i + 1]);
+            if (high < 0 || low < 0) 
+            {
+                valid = false;
+                break;
+            }
+            frame.push_back((unsigned char)(high * 16 + low));
+        }
 
-    /* extract data in each line in file and insert byte in packet */
-    packet.push_back(PACKET_SIZE);
-    vector<packet_checksum> id = decimalToHexa(static_cast<packet_id>(stoi(id_str)), little_end);
-    vector<packet_checksum> time = decimalToHexa(static_cast<packet_time>(UnixTimestampConvert(time_str)), little_end);
-    vector<packet_checksum> value = decimalToHexa(static_cast<packet_value>(stof(value_str)), little_end);
-    vector<packet_checksum> aqi = decimalToHexa(static_cast<packet_aqi>(stoi(aqi_str)), little_end);
-    packet.insert(packet.end(), id.begin(), id.end());
-    packet.insert(packet.end(), time.begin(), time.end());
-    packet.insert(packet.end(), value.begin(), value.end());
-    packet.insert(packet.end(), aqi.begin(), aqi.end());
-    packet_checksum checksum = calculateCheckSum(packet);
-    packet.push_back(checksum);
-    packet.insert(packet.begin(), START_BYTE);
-    packet.push_back(END_BYTE);    
-    
-    return packet;
+        size_t used = 0;
+        if (!valid || !parseFrameV2(frame.data(), frame.size(), records, used) || used != frame.size()) 
+        {
+            closeWriteBuffer(OUTPUT_STREAM);
+            return linePos;
+        }
+
+        for (const FrameRecord &record : records) 
+        {
+            writeInt(OUTPUT_STREAM, record.id);
+            writeChar(OUTPUT_STREAM, ',');
+            writeTimestamp(OUTPUT_STREAM, record.time);
+            writeChar(OUTPUT_STREAM, ',');
+            writeTenths(OUTPUT_STREAM, record.value);
+            writeChar(OUTPUT_STREAM, ',');
+            writeInt(OUTPUT_STREAM, record.aqi);
+            writeChar(OUTPUT_STREAM, ',');
+            writeText(OUTPUT_STREAM, AQItoLevel(record.aqi));
+            writeChar(OUTPUT_STREAM, '\n');
+        }
+    }
+
+    return closeWriteBuffer(OUTPUT_STREAM) ? 0 : -1;
 }
 
-/* Write packet of in output file
-* Input: vector<packet_checksum> packet from loadingPacket()
-* Output: string of hexa array */
-string writePacket(vector<packet_checksum> &packet) 
+#ifdef __linux__
+/* Create packets of average values from shared memory ring
+* Inputs: ring written by dust_process, output buffer, packet version, converted batch (for counts)
+* Output: position of invalid record, 0 if none. Ring is read to the end even after error
+so that dust_process is not blocked */
+int convertRing(SharedRing &ring, WriteBuffer &OUTPUT_STREAM, int version, PacketBatch &result) 
 {
-    stringstream ss;
-    for (const packet_checksum& byte : packet)
-        ss << uppercase << hex << setw(2) << setfill('0') << static_cast<int>(byte) << ' ';
+    RingRecord record;
+    vector<FrameRecord> records;
+    int recordPos = 0;
+    int64_t last_time = -1;
+    string hour, frame_hour;
+    packet_time time_num = 0;
+
+    while (popRing(ring, record)) 
+    {
+        recordPos++;
+        if (result.error_line != 0)
+            continue;
+
+        /* value has one decimal as in dust_aqi.csv */
+        char value_str[32];
+        *to_chars(value_str, value_str + 31, record.value, chars_format::fixed, 1).ptr = '\0';
+        int tenths;
+        if (record.id <= 0 || record.aqi < 0 || !parseDustValue(value_str, tenths) || tenths < 0) 
+        {
+            result.error_line = recordPos;
+            continue;
+        }
+
+        if (record.time != last_time) 
+        {
+            char Timestamp[19];
+            formatTimestamp(Timestamp, record.time);
+            hour.assign(Timestamp, 13);
+            time_num = static_cast<packet_time>(record.time);
+            last_time = record.time;
+        }
 
-    return ss.str();
+        if (version == PACKET_VERSION_2) 
+        {
+            if (hour != frame_hour || records.size() == FRAME_MAX_RECORDS) 
+            {
+                flushFrame(records, result);
+                frame_hour = hour;
+            }
+            records.push_back({record.id, time_num, tenths, record.aqi});
+        }
+        else 
+        {
+            packet_checksum packet[PACKET_SIZE];
+            fillPacket(packet, static_cast<packet_id>(record.id), time_num, strtof(value_str, NULL), 
+                static_cast<packet_aqi>(record.aqi));
+            appendPacket(result.text, packet, PACKET_SIZE);
+            result.num_bytes += PACKET_SIZE;
+        }
+        result.num_records++;
+
+        if (result.text.size() >= BATCH_BYTES) 
+        {
+            writeText(OUTPUT_STREAM, result.text);
+            result.text.clear();
+        }
+    }
+    flushFrame(records, result);
+    writeText(OUTPUT_STREAM, result.text);
+    return result.error_line;
 }
+#endif
 
 /* Main function
 * Input: command-line statement
@@ -184,7 +441,10 @@ string writePacket(vector<packet_checksum> &packet)
     ile with name given by user
     task3.log
     nofication (should appear if program run successfully)
-* Pre-condition: task3.log is accessible and command-line is valid */
+* Pre-condition: task3.log is accessible and command-line is valid
+    dust_convert input_file output_file [-t threads] [-v2]
+    dust_convert -ring name output_file [-v2] (read average values from shared memory ring)
+    dust_convert -d input_file output_file (decode version 2 frames) */
 int main(int argc, char *argv[]) 
 {
     /* pre-condition */
@@ -193,13 +453,100 @@ int main(int argc, char *argv[])
         cout << "Cannot access " << LOG_FILE << " to record error." << endl;
         return 1;
     }
+    /* decode version 2 frames */
+    if (argc == 4 && string(argv[1]) == "-d") 
+    {
+        if (!scanFile(argv[2], LOG_FILE, READ_MODE) || !scanFile(argv[3], LOG_FILE, WRITE_MODE))
+            return 1;
+
+        int error_line = decodeFrames(argv[2], argv[3]);
+        if (error_line < 0) 
+        {
+            error(03, LOG_FILE, argv[3]);
+            return 1;
+        }
+        if (error_line != 0) 
+        {
+            error(05, LOG_FILE, error_line);
+            return 1;
+        }
+        cout << "Decoding completed successfully." << endl;
+        return 0;
+    }
+
+    /* read average values from shared memory ring */
+    if ((argc == 4 || argc == 5) && string(argv[1]) == "-ring") 
+    {
+#ifdef __linux__
+        if (argc == 5 && string(argv[4]) != "-v2") 
+        {
+            error(2, LOG_FILE);
+            return 1;
+        }
+        if (!scanFile(argv[3], LOG_FILE, WRITE_MODE))
+            return 1;
+
+        SharedRing ring;
+        if (!openRing(ring, argv[2], 1)) 
+        {
+            error(03, LOG_FILE, argv[2]);
+            return 1;
+        }
+        WriteBuffer OUTPUT_STREAM;
+        if (!openWriteBuffer(OUTPUT_STREAM, argv[3])) 
+        {
+            closeRing(ring, true);
+            error(03, LOG_FILE, argv[3]);
+            return 1;
+        }
+        PacketBatch result = {"", 0, 0, 0};
+        int error_line = convertRing(ring, OUTPUT_STREAM, (argc == 5) ? PACKET_VERSION_2 : 1, result);
+        closeRing(ring, true);
+        if (!closeWriteBuffer(OUTPUT_STREAM)) 
+        {
+            error(03, LOG_FILE, argv[3]);
+            return 1;
+        }
+
+        if (error_line != 0) 
+        {
+            error(05, LOG_FILE, error_line);
+            return 1;
+        }
+        cout << "Conversion completed successfully." << endl;
+        cout << "Records: " << result.num_records << endl;
+        return 0;
+#else
+        error(2, LOG_FILE);             /* shared memory ring needs Linux */
+        return 1;
+#endif
+    }
+
     /* check command-line */
-    if (argc != 3) 
+    if (argc < 3 || argc > 6) 
     {
         error(1, LOG_FILE);
         return 1;
     }
 
+    int num_threads = thread::hardware_concurrency();          /* number of workers */
+    int version = 1;                                            /* packet version */
+    for (int i = 3; i < argc; i++) 
+    {
+        string str = argv[i];
+        if (str == "-t" && i + 1 < argc && atoi(argv[i + 1]) >= 1)
+            num_threads = atoi(argv[++i]);
+        else if (str == "-v2")
+            version = PACKET_VERSION_2;
+        else 
+        {
+            error(2, LOG_FILE);
+            return 1;
+        }
+    }
+    if (num_threads < 1)
+        num_threads = 1;
+
     string input_filename(argv[1]), output_filename(argv[2]);       /* input, output file */
     string input_filepath = AQI_FILE_LOCATION;
     input_filepath.push_back('/');
@@ -212,31 +559,83 @@ int main(int argc, char *argv[])
     if (!scanFile(output_filename, LOG_FILE, WRITE_MODE))
         return 1;
 
-    /* check if file has correct format */
-    if (!if_DUST_AQI_file(input_filepath, LOG_FILE))
+    /* check if file has correct format, every line is checked before conversion */
+    if (!if_DUST_AQI_file(input_filepath, LOG_FILE) || !validateFile(input_filepath, DUST_AQI_LAYOUT, LOG_FILE))
         return 1;
 
-    ifstream INPUT_STREAM(input_filepath);          /* stream for input and output file */
-    ofstream OUTPUT_STREAM(output_filename);
-    string temp_str;
-    int linePos = 0;                                /* show line position */
+    WriteBuffer OUTPUT_STREAM;                      /* buffer for output file */
+    if (!openWriteBuffer(OUTPUT_STREAM, output_filename)) 
+    {
+        error(03, LOG_FILE, output_filename);
+        return 1;
+    }
 
-    getline(INPUT_STREAM, temp_str);                /* skip first line */
-    /* read data */
-    while (getline(INPUT_STREAM, temp_str)) 
+    /* reader, workers and writer (this thread) */
+    BoundedQueue<LineBatch> batches;
+    initQueue(batches, 2 * num_threads);
+    OrderedOutput order;
+    order.next_seq = 0;
+    order.total = -1;
+    order.stopped = false;
+    order.num_records = 0;
+    order.num_bytes = 0;
+
+    thread reader(readStage, input_filepath, ref(batches), ref(order));
+    vector<thread> workers;
+    for (int i = 0; i < num_threads; i++)
+        workers.push_back(thread(convertStage, ref(batches), ref(order), version));
+
+    /* write batches in input order */
+    int error_line = 0;
+    while (true) 
     {
-        vector<packet_checksum> packet = loadingPacket(temp_str);       /* get packet */
-        if (packet[0] != START_BYTE) 
+        unique_lock<mutex> guard(order.lock);
+        order.ready.wait(guard, [&] { 
+            return order.done.count(order.next_seq) || order.total == order.next_seq; });
+        if (order.total == order.next_seq)
+            break;
+
+        PacketBatch result = std::move(order.done[order.next_seq]);
+        order.done.erase(order.next_seq);
+        order.next_seq++;
+        if (result.error_line != 0)
+            order.stopped = true;
+        guard.unlock();
+        order.space.notify_all();
+
+        writeText(OUTPUT_STREAM, result.text);                      /* write packets */
+        if (result.error_line != 0) 
         {
-            error(07, LOG_FILE, linePos);;
-            return 1;
+            error_line = result.error_line;
+            break;
         }
+    }
+
+    reader.join();
+    for (thread &worker : workers)
+        worker.join();
+    if (!closeWriteBuffer(OUTPUT_STREAM)) 
+    {
+        error(03, LOG_FILE, output_filename);
+        return 1;
+    }
 
-        OUTPUT_STREAM << writePacket(packet) << endl;               /* write packet */
+    if (error_line != 0) 
+    {
+        error(05, LOG_FILE, error_line);
+        return 1;
     }
-    INPUT_STREAM.close();
-    OUTPUT_STREAM.close();
 
     cout << "Conversion completed successfully." << endl;           /* notify */
+    if (order.num_records > 0) 
+    {
+        double bytes_per_record = (double)order.num_bytes / order.num_records;
+        cout << "Records: " << order.num_records << ", " << fixed << setprecision(2)
+            << bytes_per_record << " bytes per record";
+        if (version == PACKET_VERSION_2)
+            cout << " (version 1: " << (int)PACKET_SIZE << ", " << setprecision(1)
+                << 100.0 * (1.0 - bytes_per_record / PACKET_SIZE) << "% less)";
+        cout << endl;
+    }
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,321 @@
+/***********************************************************
+* Program: dust_pipeline.cpp
+* Purpose: Simulate, analyse and packetize dust data in one process
+************************************************************/
+
+#include "../header.h"
+#include "../error.h"
+#include "../readfile.h"
+#include "../writer.h"
+#include "../aqi.h"
+#include "../packet.h"
+#include "../queue.h"
+#include <thread>
+#include <chrono>
+
+#define LOG_FILE            "task4.log"
+#define BATCH_SIZE          4096            /* readings per batch */
+#define QUEUE_CAPACITY      16              /* batches waiting between two stages */
+
+/* Structure for one reading of sensor */
+struct SensorReading
+{
+    int id;
+    time_t time;
+    double value;
+};
+
+typedef vector<SensorReading> ReadingBatch;
+typedef vector<averageValue> AverageBatch;
+
+/* Structure for command-line options */
+struct PipelineOption
+{
+    int num_sensors;            /* number of sensor */
+    int sampling;               /* time per simulation */
+    int interval;               /* duration measurement */
+    string sensor_file;         /* dust_sensor.csv format, empty if not written */
+    string aqi_file;            /* dust_aqi.csv format, empty if not written */
+    string packet_file;         /* dust_convert format, empty if not written */
+};
+
+/* Structure for counting result of each stage */
+struct PipelineCount
+{
+    long long num_readings;
+    long long num_outliers;
+    long long num_averages;
+    long long num_packets;
+    bool sensor_failed;             /* dust_sensor.csv could not be written */
+    bool output_failed;             /* dust_aqi.csv or packet file could not be written */
+};
+
+/* Generate dust concentration value, same as dust_sim
+* Output: A double number from 0.0 to 1000.0*/
+double generatePM25Value()
+{
+    return (double)(rand() % 10001)/10.0;
+}
+
+/* Stage 1: simulate readings and pass them in batches
+* Inputs: options, output queue, counter
+* Output: batches of readings, dust_sensor.csv (if required) */
+void simulateStage(const PipelineOption &option, BoundedQueue<ReadingBatch> &output, PipelineCount &count)
+{
+    WriteBuffer sensor_file;
+    bool write_csv = !option.sensor_file.empty();
+    if (write_csv && !openWriteBuffer(sensor_file, option.sensor_file))
+    {
+        error(03, LOG_FILE, option.sensor_file);
+        count.sensor_failed = true;
+        write_csv = false;
+    }
+    if (write_csv)
+        writeText(sensor_file, "id,time,value\n");
+
+    ReadingBatch batch;
+    batch.reserve(BATCH_SIZE);
+
+    srand(time(0));
+    time_t start_time = time(NULL) - option.interval * 3600;
+    for (int time_incre = 0; time_incre <= option.interval * 3600; time_incre += option.sampling)
+    {
+        time_t timenow = start_time + time_incre;
+        char Timestamp[19];
+        if (write_csv)
+            formatTimestamp(Timestamp, timenow);
+
+        for (int id = 1; id <= option.num_sensors; id++)
+        {
+            double dust_concentration = generatePM25Value();
+            if (write_csv)
+                writeSensorLine(sensor_file, id, Timestamp, dust_concentration);
+
+            batch.push_back({id, timenow, dust_concentration});
+            if (batch.size() == BATCH_SIZE)
+            {
+                count.num_readings += batch.size();
+                pushQueue(output, std::move(batch));
+                batch = ReadingBatch();
+                batch.reserve(BATCH_SIZE);
+            }
+        }
+    }
+
+    count.num_readings += batch.size();
+    if (!batch.empty())
+        pushQueue(output, std::move(batch));
+    closeQueue(output);
+
+    if (write_csv && !closeWriteBuffer(sensor_file))
+    {
+        error(03, LOG_FILE, option.sensor_file);
+        count.sensor_failed = true;
+    }
+}
+
+/* Stage 2: filter outliers and calculate hourly average
+* Inputs: options, input and output queue, counter
+* Output: batches of average values, one batch per finished hour */
+void aggregateStage(const PipelineOption &option, BoundedQueue<ReadingBatch> &input,
+    BoundedQueue<AverageBatch> &output, PipelineCount &count)
+{
+    HourlyAverage hourly;
+    initHourlyAverage(hourly, option.num_sensors);
+
+    AverageBatch list;
+    ReadingBatch batch;
+    time_t last_time = -1;
+    string time_str;
+
+    while (popQueue(input, batch))
+    {
+        for (const SensorReading &reading : batch)
+        {
+            /* same bounds as dust_process */
+            if ((reading.value < 0) || (reading.value > 550.5))
+            {
+                count.num_outliers++;
+                continue;
+            }
+
+            if (reading.time != last_time)
+            {
+                char Timestamp[19];
+                formatTimestamp(Timestamp, reading.time);
+                time_str.assign(Timestamp, 19);
+                last_time = reading.time;
+            }
+            addHourlyValue(hourly, reading.id, time_str, valueToTenths(reading.value), list);
+        }
+
+        if (!list.empty())
+        {
+            count.num_averages += list.size();
+            pushQueue(output, std::move(list));
+            list = AverageBatch();
+        }
+    }
+
+    closeHour(hourly, list);            /* last hour */
+    count.num_averages += list.size();
+    if (!list.empty())
+        pushQueue(output, std::move(list));
+    closeQueue(output);
+}
+
+/* Stage 3: create data packet of each average value
+* Inputs: options, input queue, counter
+* Output: dust_aqi.csv and packet file (if required) */
+void packetizeStage(const PipelineOption &option, BoundedQueue<AverageBatch> &input, PipelineCount &count)
+{
+    WriteBuffer aqi_file, packet_file;
+    bool write_aqi = !option.aqi_file.empty(), write_packet = !option.packet_file.empty();
+    if (write_aqi && !openWriteBuffer(aqi_file, option.aqi_file))
+    {
+        error(03, LOG_FILE, option.aqi_file);
+        count.output_failed = true;
+        write_aqi = false;
+    }
+    if (write_packet && !openWriteBuffer(packet_file, option.packet_file))
+    {
+        error(03, LOG_FILE, option.packet_file);
+        count.output_failed = true;
+        write_packet = false;
+    }
+    if (write_aqi)
+        writeText(aqi_file, "id,time,value,aqi,pollution\n");
+
+    AverageBatch list;
+    string last_time;
+    packet_time time_num = 0;
+
+    while (popQueue(input, list))
+    {
+        for (const averageValue &entry : list)
+        {
+            if (write_aqi)
+                writeAverageValue(aqi_file, entry);
+
+            if (entry.time != last_time)
+            {
+                time_num = UnixTimestampConvert(entry.time);
+                last_time = entry.time;
+            }
+
+            /* dust_convert reads value with one decimal from dust_aqi.csv */
+            char value_str[32];
+            *to_chars(value_str, value_str + 31, entry.value / 10.0, chars_format::fixed, 1).ptr = '\0';
+            vector<packet_checksum> packet = buildPacket(static_cast<packet_id>(entry.id), time_num,
+                strtof(value_str, NULL), static_cast<packet_aqi>(entry.aqi));
+            count.num_packets++;
+
+            if (write_packet)
+                writePacket(packet_file, packet);
+        }
+    }
+
+    if (write_aqi && !closeWriteBuffer(aqi_file))
+    {
+        error(03, LOG_FILE, option.aqi_file);
+        count.output_failed = true;
+    }
+    if (write_packet && !closeWriteBuffer(packet_file))
+    {
+        error(03, LOG_FILE, option.packet_file);
+        count.output_failed = true;
+    }
+}
+
+/* Main function
+* Input: command-line statement
+    dust_pipeline -n num_sensors [-st sampling] [-si interval]
+        [-sensor file] [-aqi file] [-packet file]
+* Output:
+    output files required by user
+    task4.log
+    notification (should appear if program run successfully)
+* Pre-condition: task4.log is accessible
+*/
+int main(int argc, char *argv[])
+{
+    /* pre-condition */
+    if (!ifAccessGranted(LOG_FILE, WRITE_MODE))
+    {
+        cout << "Cannot access " << LOG_FILE << " to record error." << endl;
+        return 1;
+    }
+
+    /* set default value */
+    PipelineOption option = {1, 30, 24, "", "", ""};
+
+    /* check if command-line is correct */
+    if (argc <= 2 || argc % 2 == 0)
+    {
+        error(01, LOG_FILE);
+        return 1;
+    }
+
+    /* check if arguments are valid and get value */
+    for (int i = 1; i < argc; i += 2)
+    {
+        string str = argv[i];
+        if (str == "-n")
+            option.num_sensors = atoi(argv[i + 1]);
+        else if (str == "-st")
+            option.sampling = atoi(argv[i + 1]);
+        else if (str == "-si")
+            option.interval = atoi(argv[i + 1]);
+        else if (str == "-sensor")
+            option.sensor_file = argv[i + 1];
+        else if (str == "-aqi")
+            option.aqi_file = argv[i + 1];
+        else if (str == "-packet")
+            option.packet_file = argv[i + 1];
+        else
+        {
+            error(02, LOG_FILE);
+            return 1;
+        }
+    }
+
+    if (option.num_sensors <= 0 || option.sampling < 1 || option.interval < 1)
+    {
+        error(02, LOG_FILE);
+        return 1;
+    }
+
+    /* check if output files are accessible */
+    string output_files[] = {option.sensor_file, option.aqi_file, option.packet_file};
+    for (const string &file_name : output_files)
+    {
+        if (!file_name.empty() && !scanFile(file_name, LOG_FILE, WRITE_MODE))
+            return 1;
+    }
+
+    /* run three stages on separate threads */
+    BoundedQueue<ReadingBatch> reading_queue;
+    BoundedQueue<AverageBatch> average_queue;
+    initQueue(reading_queue, QUEUE_CAPACITY);
+    initQueue(average_queue, QUEUE_CAPACITY);
+    PipelineCount count = {0, 0, 0, 0, false, false};
+
+    auto start = chrono::steady_clock::now();
+    thread simulate_thread(simulateStage, cref(option), ref(reading_queue), ref(count));
+    thread aggregate_thread(aggregateStage, cref(option), ref(reading_queue), ref(average_queue), ref(count));
+    packetizeStage(option, average_queue, count);
+    simulate_thread.join();
+    aggregate_thread.join();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (count.sensor_failed || count.output_failed)
+        return 1;
+
+    /* notify */
+    cout << "Readings: " << count.num_readings << endl;
+    cout << "Outliers: " << count.num_outliers << endl;
+    cout << "Average values: " << count.num_averages << endl;
+    cout << "Packets: " << count.num_packets << endl;
+    cout << "Pipeline completed in " << fixed << setprecision(3) << seconds << " s." << endl;
+
+    return 0;
+}
@@ -0,0 +1,465 @@
+/***********************************************************
+* Program: dust_ingest.cpp
+* Purpose: Receive packets from sensors and calculate hourly AQI
+************************************************************/
+
+#include "../header.h"
+#include "../error.h"
+#include "../readfile.h"
+#include "../writer.h"
+#include "../aqi.h"
+#include "../packet.h"
+#include "../socket.h"
+
+#define AQI_FILE            "dust_aqi.csv"
+#define LOG_FILE            "task5.log"
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <csignal>
+#include <cmath>
+#include <chrono>
+
+#define INGEST_BUFFER_SIZE  (64 * 1024)     /* receive buffer per connection */
+#define MAX_EVENTS          256
+#define UDP_BATCH           64              /* datagrams per recvmmsg() */
+#define LISTEN_SLOT         0xFFFFFFFF      /* epoll data of listening socket */
+
+/* Structure for connection, buffer is kept for next connection after closed */
+struct IngestConnection
+{
+    int fd;
+    size_t used;                                    /* bytes waiting in buffer */
+    unsigned char buffer[INGEST_BUFFER_SIZE];
+};
+
+/* Structure for hourly average of one hour */
+struct HourBucket
+{
+    time_t start;                   /* time of beginning of hour, -1 if not used */
+    bool open;
+    HourlyAverage hourly;
+};
+
+/* Structure for counting received data */
+struct IngestCount
+{
+    long long connections;
+    long long packets;
+    long long bad_packets;          /* wrong format or checksum */
+    long long outliers;             /* value out of [0, 550.5] */
+    long long late;                 /* hour is already written */
+    long long unknown_ids;          /* id out of [1, num_sensors] */
+};
+
+/* Structure for state of ingest server */
+struct IngestState
+{
+    HourBucket hours[2];            /* previous and current hour */
+    time_t cached_start;            /* beginning of hour of last reading */
+    WriteBuffer aqi_file;
+    vector<averageValue> list;      /* average values of closed hour */
+    vector<FrameRecord> records;    /* records of version 2 frame */
+    IngestCount count;
+};
+
+volatile sig_atomic_t stop_server = 0;
+
+void handleSignal(int)
+{
+    stop_server = 1;
+}
+
+/* Calculate average value of hour and write it in dust_aqi.csv
+* Inputs: state, hour */
+void closeBucket(IngestState &state, HourBucket &bucket)
+{
+    if (!bucket.open)
+        return;
+
+    closeHour(bucket.hourly, state.list);
+    for (const averageValue &entry : state.list)
+        writeAverageValue(state.aqi_file, entry);
+    state.list.clear();
+    bucket.open = false;
+}
+
+/* Find beginning of local hour of time, localtime() is called only when hour changes
+* Inputs: state, time in seconds
+* Output: time of beginning of hour */
+time_t hourStart(IngestState &state, time_t time_num)
+{
+    if (time_num >= state.cached_start && time_num < state.cached_start + 3600)
+        return state.cached_start;
+
+    tm* tm_local = localtime(&time_num);
+    state.cached_start = time_num - tm_local->tm_min * 60 - tm_local->tm_sec;
+    return state.cached_start;
+}
+
+/* Add reading to its hour. Hours older than previous hour are already written
+* Inputs: state, id, time in seconds, value in 0.1 unit */
+void addReading(IngestState &state, int id, time_t time_num, int tenths)
+{
+    HourBucket *hours = state.hours;
+    if (id < 1 || id > hours[1].hourly.num_sensors)
+    {
+        state.count.unknown_ids++;
+        return;
+    }
+    if (tenths < 0 || tenths > 5505)
+    {
+        state.count.outliers++;
+        return;
+    }
+
+    time_t start = hourStart(state, time_num);
+    HourBucket *bucket;
+    if (start == hours[1].start)
+        bucket = &hours[1];
+    else if (start == hours[0].start)
+        bucket = &hours[0];
+    else if (start > hours[1].start)
+    {
+        /* new hour: write previous hour, current hour becomes previous */
+        closeBucket(state, hours[0]);
+        swap(hours[0], hours[1]);
+        hours[1].start = start;
+        char Timestamp[19];
+        formatTimestamp(Timestamp, start);
+        hours[1].hourly.time_checkpoint.assign(Timestamp, 13);
+        bucket = &hours[1];
+    }
+    else
+    {
+        state.count.late++;
+        return;
+    }
+
+    bucket->open = true;
+    bucket->hourly.sum_value[id - 1] += tenths;
+    bucket->hourly.count[id - 1]++;
+}
+
+/* Decode all complete packets and frames in buffer
+* Inputs: state, buffer and number of bytes
+* Output: number of bytes used, the rest is an unfinished packet */
+size_t decodeBuffer(IngestState &state, const unsigned char *bytes, size_t size)
+{
+    size_t pos = 0;
+    while (pos < size)
+    {
+        if (bytes[pos] == START_BYTE)
+        {
+            if (size - pos < PACKET_SIZE)
+                break;
+
+            packet_id id; packet_time time_num; packet_value value; packet_aqi aqi;
+            if (parsePacket(bytes + pos, id, time_num, value, aqi))
+            {
+                state.count.packets++;
+                addReading(state, id, time_num, (int)lround(value * 10));
+                pos += PACKET_SIZE;
+                continue;
+            }
+        }
+        else if (bytes[pos] == START_BYTE_V2 && (size - pos < 2 || bytes[pos + 1] == PACKET_VERSION_2))
+        {
+            /* wait until length and whole frame are received */
+            size_t length_pos = pos + 2;
+            uint32_t payload_size = 0;
+            bool has_length = readVarint(bytes, length_pos, size, payload_size);
+            if (!has_length && size - pos < 7)
+                break;
+            if (has_length && length_pos + payload_size + 5 > size && payload_size + 12 <= INGEST_BUFFER_SIZE)
+                break;
+
+            if (has_length)
+            {
+                size_t used;
+                state.records.clear();
+                if (parseFrameV2(bytes + pos, size - pos, state.records, used))
+                {
+                    state.count.packets++;
+                    for (const FrameRecord &record : state.records)
+                        addReading(state, record.id, record.time, record.value);
+                    pos += used;
+                    continue;
+                }
+            }
+        }
+
+        /* not a packet: skip one byte and look for next start byte */
+        state.count.bad_packets += (bytes[pos] == START_BYTE || bytes[pos] == START_BYTE_V2);
+        pos++;
+    }
+    return pos;
+}
+
+/* Read all data from stream socket (edge-triggered) and decode packets
+* Inputs: state, connection
+* Output: false if connection is closed */
+bool readConnection(IngestState &state, IngestConnection &conn)
+{
+    while (true)
+    {
+        long n = read(conn.fd, conn.buffer + conn.used, INGEST_BUFFER_SIZE - conn.used);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        if (n == 0)
+            return false;
+
+        conn.used += n;
+        size_t used = decodeBuffer(state, conn.buffer, conn.used);
+        memmove(conn.buffer, conn.buffer + used, conn.used - used);
+        conn.used -= used;
+    }
+}
+
+/* Read all datagrams from UDP socket, each datagram has whole packets
+* Inputs: state, socket, buffers */
+void readDatagrams(IngestState &state, int fd, vector<unsigned char> &buffers)
+{
+    mmsghdr msgs[UDP_BATCH];
+    iovec iovs[UDP_BATCH];
+    size_t size = buffers.size() / UDP_BATCH;
+
+    while (true)
+    {
+        for (int i = 0; i < UDP_BATCH; i++)
+        {
+            iovs[i].iov_base = &buffers[i * size];
+            iovs[i].iov_len = size;
+            memset(&msgs[i], 0, sizeof(mmsghdr));
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int n = recvmmsg(fd, msgs, UDP_BATCH, MSG_DONTWAIT, NULL);
+        if (n <= 0)
+            return;
+        for (int i = 0; i < n; i++)
+            decodeBuffer(state, &buffers[i * size], msgs[i].msg_len);
+    }
+}
+
+/* Receive packets until stopped
+* Inputs: address, number of sensors, running time (0 if until signal), output file
+* Output: dust_aqi.csv format file
+    0 (if success), 1 (if socket cannot be opened) or 2 (if output file cannot be written) */
+int runIngestServer(const SocketAddress &address, int num_sensors, int duration, string aqi_filename)
+{
+    int listen_fd = listenSocket(address);
+    if (listen_fd < 0)
+        return 1;
+
+    IngestState state;
+    for (HourBucket &bucket : state.hours)
+    {
+        bucket.start = -1;
+        bucket.open = false;
+        initHourlyAverage(bucket.hourly, num_sensors);
+    }
+    state.cached_start = -1;
+    state.count = {0, 0, 0, 0, 0, 0};
+    if (!openWriteBuffer(state.aqi_file, aqi_filename))
+    {
+        close(listen_fd);
+        if (address.type == SOCKET_UNIX)
+            removeSocketFile(address);
+        return 2;
+    }
+    writeText(state.aqi_file, "id,time,value,aqi,pollution\n");
+
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    epoll_event event;
+    event.events = EPOLLIN | EPOLLET;
+    event.data.u32 = LISTEN_SLOT;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &event);
+
+    vector<IngestConnection*> conns;                /* connection of each slot */
+    vector<IngestConnection*> free_conns;           /* buffers of closed connections */
+    vector<unsigned int> free_slots;
+    vector<unsigned char> datagrams(UDP_BATCH * 65536);
+
+    signal(SIGINT, handleSignal);
+    signal(SIGTERM, handleSignal);
+    signal(SIGPIPE, SIG_IGN);
+
+    auto start = chrono::steady_clock::now();
+    epoll_event events[MAX_EVENTS];
+    while (!stop_server)
+    {
+        if (duration > 0 && chrono::steady_clock::now() - start >= chrono::seconds(duration))
+            break;
+
+        int n = epoll_wait(epfd, events, MAX_EVENTS, 100);
+        for (int i = 0; i < n; i++)
+        {
+            unsigned int slot = events[i].data.u32;
+            if (slot == LISTEN_SLOT && address.type == SOCKET_UDP)
+            {
+                readDatagrams(state, listen_fd, datagrams);
+                continue;
+            }
+
+            if (slot == LISTEN_SLOT)
+            {
+                /* accept all waiting connections */
+                int fd;
+                while ((fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+                {
+                    IngestConnection *conn;
+                    if (free_conns.empty())
+                        conn = new IngestConnection;
+                    else
+                    {
+                        conn = free_conns.back();
+                        free_conns.pop_back();
+                    }
+                    conn->fd = fd;
+                    conn->used = 0;
+
+                    unsigned int new_slot;
+                    if (free_slots.empty())
+                    {
+                        new_slot = conns.size();
+                        conns.push_back(conn);
+                    }
+                    else
+                    {
+                        new_slot = free_slots.back();
+                        free_slots.pop_back();
+                        conns[new_slot] = conn;
+                    }
+
+                    epoll_event conn_event;
+                    conn_event.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+                    conn_event.data.u32 = new_slot;
+                    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &conn_event);
+                    state.count.connections++;
+                }
+                continue;
+            }
+
+            IngestConnection *conn = conns[slot];
+            if (!readConnection(state, *conn) || (events[i].events & (EPOLLHUP | EPOLLERR)))
+            {
+                close(conn->fd);            /* also removed from epoll */
+                free_conns.push_back(conn);
+                free_slots.push_back(slot);
+                conns[slot] = NULL;
+            }
+        }
+    }
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    /* write hours still open */
+    closeBucket(state, state.hours[0]);
+    closeBucket(state, state.hours[1]);
+    bool file_ok = closeWriteBuffer(state.aqi_file);
+
+    for (IngestConnection *conn : conns)
+    {
+        if (conn != NULL)
+        {
+            close(conn->fd);
+            delete conn;
+        }
+    }
+    for (IngestConnection *conn : free_conns)
+        delete conn;
+    close(epfd);
+    close(listen_fd);
+    if (address.type == SOCKET_UNIX)
+        removeSocketFile(address);
+
+    cout << "Connections: " << state.count.connections << endl;
+    cout << "Packets: " << state.count.packets << " (" << fixed << setprecision(0)
+        << state.count.packets / (seconds > 0 ? seconds : 1) << " packets/s)" << endl;
+    cout << "Bad packets: " << state.count.bad_packets << endl;
+    cout << "Outliers: " << state.count.outliers << endl;
+    cout << "Late readings: " << state.count.late << endl;
+    cout << "Unknown ids: " << state.count.unknown_ids << endl;
+    return file_ok ? 0 : 2;
+}
+#endif
+
+/* Main function
+* Input: command-line statement
+    dust_ingest -listen tcp://host:port | udp://host:port | unix:path
+        [-n num_sensors] [-aqi output_file] [-time seconds]
+* Output:
+    dust_aqi.csv (or file given by user) written hour by hour
+    task5.log
+    notification (should appear if program run successfully)
+* Pre-condition: task5.log is accessible */
+int main(int argc, char *argv[])
+{
+    /* pre-condition */
+    if (!ifAccessGranted(LOG_FILE, WRITE_MODE))
+    {
+        cout << "Cannot access " << LOG_FILE << " to record error." << endl;
+        return 1;
+    }
+
+    /* check if command-line is correct */
+    if (argc <= 2 || argc % 2 == 0)
+    {
+        error(01, LOG_FILE);
+        return 1;
+    }
+
+    string listen_address = "";
+    string aqi_filename = AQI_FILE;
+    int num_sensors = 100000;           /* largest sensor id */
+    int duration = 0;                   /* run until stopped */
+
+    /* check if arguments are valid and get value */
+    for (int i = 1; i < argc; i += 2)
+    {
+        string str = argv[i];
+        if (str == "-listen")
+            listen_address = argv[i + 1];
+        else if (str == "-n")
+            num_sensors = atoi(argv[i + 1]);
+        else if (str == "-aqi")
+            aqi_filename = argv[i + 1];
+        else if (str == "-time")
+            duration = atoi(argv[i + 1]);
+        else
+        {
+            error(02, LOG_FILE);
+            return 1;
+        }
+    }
+
+#ifdef __linux__
+    SocketAddress address;
+    if (!parseSocketAddress(listen_address, address) || num_sensors < 1 || duration < 0)
+    {
+        error(02, LOG_FILE);
+        return 1;
+    }
+
+    /* check if output file is accessible */
+    if (!scanFile(aqi_filename, LOG_FILE, WRITE_MODE))
+        return 1;
+
+    int result = runIngestServer(address, num_sensors, duration, aqi_filename);
+    if (result != 0)
+    {
+        error(03, LOG_FILE, (result == 1) ? listen_address : aqi_filename);
+        return 1;
+    }
+
+    cout << "Ingest completed. Output file: " << aqi_filename << endl;
+    return 0;
+#else
+    error(02, LOG_FILE);                /* server needs Linux */
+    return 1;
+#endif
+}
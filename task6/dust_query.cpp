@@ -0,0 +1,237 @@
+/***********************************************************
+* Program: dust_query.cpp
+* Purpose: Answer filter, group-by and top-K queries on hourly AQI data
+************************************************************/
+
+#include "../header.h"
+#include "../error.h"
+#include "../readfile.h"
+#include "../writer.h"
+#include "../aqi.h"
+#include "../query.h"
+#include "../validate.h"
+#include <chrono>
+
+#define AQI_FILE_LOCATION   "../task2"
+#define QUERY_FILE          "dust_query.csv"
+#define LOG_FILE            "task6.log"
+
+/* Load columns of input file, dust_aqi.col is mapped and used in place
+* Inputs: file directory, table (for dust_aqi.csv), column file (for dust_aqi.col), columns (output)
+* Output: true (if file is valid) or false, error is recorded */
+bool loadQueryInput(const string &file_location, AQITable &table, ColumnFile &column_file, AQIColumns &columns)
+{
+    if (isColumnFile(file_location))
+    {
+        if (!openColumnFile(file_location, column_file) || !columnFileColumns(column_file, columns))
+        {
+            error(04, LOG_FILE);
+            closeColumnFile(column_file);
+            return false;
+        }
+        return true;
+    }
+
+    /* check if file has correct format, every bad line is recorded */
+    if (!if_DUST_AQI_file(file_location, LOG_FILE) || !validateFile(file_location, DUST_AQI_LAYOUT, LOG_FILE))
+        return false;
+
+    int error_line;
+    if (!loadAQITable(file_location, table, error_line))
+    {
+        error(05, LOG_FILE, error_line);
+        return false;
+    }
+    columns = tableColumns(table);
+    return true;
+}
+
+/* Write result of query, rows in dust_aqi.csv format or groups
+* Inputs: buffer of output, query, columns, matching rows and groups */
+void writeQueryResult(WriteBuffer &out, const AQIQuery &query, const AQIColumns &columns,
+    const vector<size_t> &rows, const vector<QueryGroup> &groups)
+{
+    if (query.group == GROUP_NONE)
+        writeQueryRows(out, columns, rows);
+    else
+        writeQueryGroups(out, groups, query.group);
+}
+
+/* Run query on two inputs and compare results as text,
+checks that dust_aqi.col gives the same answers as dust_aqi.csv
+* Inputs: query, number of threads, columns of both inputs
+* Output: true (if results are the same) or false */
+bool sameQueryResult(const AQIQuery &query, int num_threads, const AQIColumns &columns, const AQIColumns &other)
+{
+    const AQIColumns *inputs[2] = {&columns, &other};
+    string text[2];
+    for (int k = 0; k < 2; k++)
+    {
+        vector<size_t> rows;
+        vector<QueryGroup> groups;
+        runQuery(*inputs[k], query, num_threads, rows, groups);
+
+        WriteBuffer out;
+        if (!openStringBuffer(out, text[k], WRITE_BUFFER_SIZE))
+            return false;
+        writeQueryResult(out, query, *inputs[k], rows, groups);
+        closeWriteBuffer(out);
+    }
+    return text[0] == text[1];
+}
+
+/* Main function
+* Input: command-line statement
+    dust_query [input file] [-from time] [-to time] [-id first-last]
+        [-level name] [-min-level name] [-group sensor|hour|day]
+        [-top K] [-by aqi|value|hours] [-order desc|asc] [-t threads] [-o output file]
+        [-compare other input file]
+    time has format YYYY:MM:DD hh:mm:ss or YYYY:MM:DD
+    input file is dust_aqi.csv or dust_aqi.col (dust_process -format columnar)
+    -compare runs query on other input file too and fails if results differ,
+        e.g. dust_aqi.csv -compare dust_aqi.col after dust_process -format both
+* Output:
+    dust_query.csv (or output file given by user)
+    task6.log
+    notification (should appear if program run successfully)
+* Pre-condition: task6.log is accessible
+*/
+int main(int argc, char *argv[])
+{
+    /* pre-condition */
+    if (!ifAccessGranted(LOG_FILE, WRITE_MODE))
+    {
+        cout << "Cannot access " << LOG_FILE << " to record error." << endl;
+        return 1;
+    }
+
+    string input_filename = "dust_aqi.csv";         /* default input file */
+    string output_filename = QUERY_FILE;
+    string compare_filename;                        /* empty if results are not compared */
+    int num_threads = thread::hardware_concurrency();
+    AQIQuery query;
+    initQuery(query);
+
+    int argPos = 1;
+    if (argc >= 2 && argv[1][0] != '-')
+    {
+        input_filename = argv[1];                   /* new input file */
+        argPos = 2;
+    }
+
+    /* check if options are valid and get value */
+    for (int i = argPos; i < argc; i += 2)
+    {
+        string str = argv[i];
+        if (i + 1 >= argc)
+        {
+            error(02, LOG_FILE);
+            return 1;
+        }
+
+        string value = argv[i + 1];
+        bool valid = true;
+        if (str == "-t")
+        {
+            num_threads = atoi(argv[i + 1]);
+            valid = num_threads >= 1;
+        }
+        else if (str == "-o")
+            output_filename = value;
+        else if (str == "-compare")
+            compare_filename = value;
+        else
+            valid = parseQueryOption(str, value, query);
+
+        if (!valid)
+        {
+            error(02, LOG_FILE);
+            return 1;
+        }
+    }
+
+    /* check if options fit together */
+    if (!checkQuery(query))
+    {
+        error(02, LOG_FILE);
+        return 1;
+    }
+
+    /* get file directory */
+    string file_location = AQI_FILE_LOCATION;
+    file_location.push_back('/');
+    file_location.append(input_filename);
+
+    /* check if input and output file are accessible */
+    if (!scanFile(AQI_FILE_LOCATION, input_filename, LOG_FILE, READ_MODE))
+        return 1;
+    if (!compare_filename.empty() && !scanFile(AQI_FILE_LOCATION, compare_filename, LOG_FILE, READ_MODE))
+        return 1;
+    if (!scanFile(output_filename, LOG_FILE, WRITE_MODE))
+        return 1;
+
+    /* load columns, dust_aqi.col is mapped and used in place */
+    auto start = chrono::steady_clock::now();
+    AQITable table;
+    AQIColumns columns;
+    ColumnFile column_file = {};
+    if (!loadQueryInput(file_location, table, column_file, columns))
+        return 1;
+    double load_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    /* run query */
+    start = chrono::steady_clock::now();
+    vector<size_t> rows;
+    vector<QueryGroup> groups;
+    size_t num_matched = runQuery(columns, query, num_threads, rows, groups);
+    double query_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    /* write result */
+    WriteBuffer OUTPUT_STREAM;
+    if (!openWriteBuffer(OUTPUT_STREAM, output_filename))
+    {
+        error(03, LOG_FILE, output_filename);
+        closeColumnFile(column_file);
+        return 1;
+    }
+    writeQueryResult(OUTPUT_STREAM, query, columns, rows, groups);
+    if (!closeWriteBuffer(OUTPUT_STREAM))
+    {
+        error(03, LOG_FILE, output_filename);
+        closeColumnFile(column_file);
+        return 1;
+    }
+
+    /* notify */
+    cout << "Rows: " << columns.num_rows << ", matched: " << num_matched << ", results: "
+        << ((query.group == GROUP_NONE) ? rows.size() : groups.size()) << endl;
+    cout << "Load " << fixed << setprecision(3) << load_seconds << " s, query "
+        << query_seconds * 1000 << " ms. Output file: " << output_filename << endl;
+
+    /* same query on other input file */
+    if (!compare_filename.empty())
+    {
+        string compare_location = string(AQI_FILE_LOCATION) + "/" + compare_filename;
+        AQITable other_table;
+        AQIColumns other_columns;
+        ColumnFile other_file = {};
+        if (!loadQueryInput(compare_location, other_table, other_file, other_columns))
+        {
+            closeColumnFile(column_file);
+            return 1;
+        }
+        bool same = sameQueryResult(query, num_threads, columns, other_columns);
+        closeColumnFile(other_file);
+        if (!same)
+        {
+            error(04, LOG_FILE);
+            closeColumnFile(column_file);
+            return 1;
+        }
+        cout << "Same results on " << compare_filename << "." << endl;
+    }
+
+    closeColumnFile(column_file);
+
+    return 0;
+}
@@ -0,0 +1,714 @@
+/***********************************************************
+* Program: dust_daemon.cpp
+* Purpose: Keep hourly AQI, summary and statistics in memory and answer
+    requests on local socket, answers are cached until data changes
+************************************************************/
+
+#include "../header.h"
+#include "../error.h"
+#include "../readfile.h"
+#include "../writer.h"
+#include "../aqi.h"
+#include "../columnar.h"
+#include "../query.h"
+#include "../summary.h"
+#include "../cache.h"
+#include "../validate.h"
+#include "../socket.h"
+
+#define AQI_FILE            "../task2/dust_aqi.csv"
+#define SUMMARY_FILE        "../task2/dust_summary.csv"
+#define STATISTICS_FILE     "../task2/dust_statistics.csv"
+#define DAEMON_ADDRESS      "unix:dust_daemon.sock"
+#define LOG_FILE            "task7.log"
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <csignal>
+#include <chrono>
+
+#define MAX_REQUEST         (64 * 1024)     /* longest request line */
+#define ANSWER_BUFFER_SIZE  (64 * 1024)
+#define MAX_UNSENT          (4 << 20)       /* answers waiting on one connection, requests are not read above it */
+#define MAX_EVENTS          256
+#define LISTEN_SLOT         0xFFFFFFFF      /* epoll data of listening socket */
+
+/* Protocol: one request per line, answer is "OK <bytes>\n" and bytes of CSV text,
+or "ERR <reason>\n"
+    QUERY [dust_query options]      rows or groups of hourly AQI as dust_query.csv
+    SUMMARY [first-last]            dust_summary.csv of sensors
+    STATISTICS [first-last]         dust_statistics.csv of sensors
+    STATUS                          counters, not cached
+    RELOAD                          load files again and clear cache */
+
+/* Structure for input file and its version when loaded */
+struct SourceFile
+{
+    string name;
+    long long mtime;                /* modification time in nanoseconds, -1 if missing */
+    long long size;
+};
+
+/* Structure for data in memory. Columns point to table or to mapped dust_aqi.col */
+struct DaemonData
+{
+    AQITable table;
+    ColumnFile column_file;
+    AQIColumns columns;
+    SummaryTable summary;
+    StatisticsTable statistics;
+};
+
+/* Structure for connection, requests may come in parts and several at once */
+struct DaemonConnection
+{
+    int fd;
+    string input;                   /* request not finished yet */
+    string output;                  /* answers not sent yet */
+    size_t sent;
+};
+
+/* Structure for state of daemon */
+struct DaemonState
+{
+    SourceFile sources[3];          /* dust_aqi, dust_summary, dust_statistics */
+    DaemonData *data;
+    long long generation;           /* number of loads */
+    int num_threads;
+    ResultCache cache;
+    long long requests;
+    double hit_seconds;             /* time spent on cached and other answers */
+    double miss_seconds;
+};
+
+volatile sig_atomic_t stop_daemon = 0;
+
+void handleSignal(int)
+{
+    stop_daemon = 1;
+}
+
+/* Get current version of file
+* Input: source file (name is set)
+* Output: modification time and size */
+void statSource(SourceFile &source)
+{
+    struct stat info;
+    if (stat(source.name.c_str(), &info) != 0)
+    {
+        source.mtime = source.size = -1;
+        return;
+    }
+    source.mtime = (long long)info.st_mtim.tv_sec * 1000000000LL + info.st_mtim.tv_nsec;
+    source.size = info.st_size;
+}
+
+/* Check if any input file has changed since it was loaded
+* Input: state
+* Output: true or false */
+bool sourcesChanged(DaemonState &state)
+{
+    for (SourceFile &source : state.sources)
+    {
+        SourceFile now = source;
+        statSource(now);
+        if (now.mtime != source.mtime || now.size != source.size)
+            return true;
+    }
+    return false;
+}
+
+void closeDaemonData(DaemonData *data)
+{
+    if (data == NULL)
+        return;
+    closeColumnFile(data->column_file);
+    delete data;
+}
+
+/* Load all input files, dust_aqi.col and dust_summary.col are found by their content
+* Inputs: input files, data
+* Output: true (if all files are valid) or false, error is recorded in log file */
+bool loadDaemonData(SourceFile sources[3], DaemonData &data)
+{
+    int error_line;
+    data.column_file = {};
+    for (int i = 0; i < 3; i++)
+    {
+        if (!ifAccessGranted(sources[i].name, READ_MODE))
+        {
+            error(03, LOG_FILE, sources[i].name);
+            return false;
+        }
+    }
+
+    /* hourly AQI */
+    const string &aqi_name = sources[0].name;
+    if (isColumnFile(aqi_name))
+    {
+        if (!openColumnFile(aqi_name, data.column_file) || !columnFileColumns(data.column_file, data.columns))
+        {
+            error(04, LOG_FILE);
+            return false;
+        }
+    }
+    else
+    {
+        if (!if_DUST_AQI_file(aqi_name, LOG_FILE) || !validateFile(aqi_name, DUST_AQI_LAYOUT, LOG_FILE))
+            return false;
+        if (!loadAQITable(aqi_name, data.table, error_line))
+        {
+            error(05, LOG_FILE, error_line);
+            return false;
+        }
+        data.columns = tableColumns(data.table);
+    }
+
+    /* summary */
+    const string &summary_name = sources[1].name;
+    if (isColumnFile(summary_name))
+    {
+        ColumnFile summary_file = {};
+        bool ok = openColumnFile(summary_name, summary_file) && loadSummaryColumns(summary_file, data.summary);
+        closeColumnFile(summary_file);
+        if (!ok)
+        {
+            error(04, LOG_FILE);
+            return false;
+        }
+    }
+    else if (!loadSummaryTable(summary_name, data.summary, error_line))
+    {
+        error(05, LOG_FILE, error_line);
+        return false;
+    }
+
+    /* pollution statistics */
+    if (!loadStatisticsTable(sources[2].name, data.statistics, error_line))
+    {
+        error(05, LOG_FILE, error_line);
+        return false;
+    }
+    return true;
+}
+
+/* Load input files again. Old data is kept if new files are invalid,
+files are not loaded again until they change
+* Input: state
+* Output: true (if data is replaced) or false */
+bool reloadData(DaemonState &state)
+{
+    for (SourceFile &source : state.sources)
+        statSource(source);
+
+    DaemonData *data = new DaemonData;
+    if (!loadDaemonData(state.sources, *data))
+    {
+        closeDaemonData(data);
+        return false;
+    }
+
+    closeDaemonData(state.data);
+    state.data = data;
+    state.generation++;
+    clearCache(state.cache);
+    return true;
+}
+
+/* Split request line in words, text in double quotes is one word (level names have spaces)
+* Inputs: request line, words
+* Output: true (if quotes are closed) or false */
+bool splitRequest(const string &line, vector<string> &words)
+{
+    words.clear();
+    size_t pos = 0;
+    while (pos < line.size())
+    {
+        if (line[pos] == ' ' || line[pos] == '\t')
+        {
+            pos++;
+            continue;
+        }
+
+        string word;
+        if (line[pos] == '"')
+        {
+            size_t end = line.find('"', pos + 1);
+            if (end == string::npos)
+                return false;
+            word = line.substr(pos + 1, end - pos - 1);
+            pos = end + 1;
+        }
+        else
+        {
+            size_t end = line.find_first_of(" \t", pos);
+            if (end == string::npos)
+                end = line.size();
+            word = line.substr(pos, end - pos);
+            pos = end;
+        }
+        words.push_back(word);
+    }
+    return true;
+}
+
+/* Get cache key of query, options in any order give the same key
+* Input: query
+* Output: key */
+string queryKey(const AQIQuery &query)
+{
+    string key = "Q";
+    for (long long field : {(long long)query.time_from, (long long)query.time_to, (long long)query.id_min,
+        (long long)query.id_max, (long long)query.level_min, (long long)query.level_max, (long long)query.group,
+        (long long)query.order, (long long)query.ascending, (long long)query.top})
+    {
+        key.push_back(' ');
+        key.append(to_string(field));
+    }
+    return key;
+}
+
+/* Put CSV text in answer
+* Inputs: answer, CSV text */
+void okAnswer(string &answer, const string &body)
+{
+    answer = "OK ";
+    answer.append(to_string(body.size()));
+    answer.push_back('\n');
+    answer.append(body);
+}
+
+/* Answer one request, QUERY, SUMMARY and STATISTICS answers are cached
+* Inputs: state, request line, output of connection */
+void answerRequest(DaemonState &state, const string &line, string &output)
+{
+    auto start = chrono::steady_clock::now();
+    state.requests++;
+
+    vector<string> words;
+    if (!splitRequest(line, words) || words.empty())
+    {
+        output.append("ERR invalid command\n");
+        return;
+    }
+
+    const string &command = words[0];
+    AQIQuery query;
+    initQuery(query);
+    string key;
+    bool valid = true;
+    if (command == "QUERY")
+    {
+        for (size_t i = 1; valid && i < words.size(); i += 2)
+            valid = (i + 1 < words.size()) && parseQueryOption(words[i], words[i + 1], query);
+        valid = valid && checkQuery(query);
+        key = queryKey(query);
+    }
+    else if (command == "SUMMARY" || command == "STATISTICS")
+    {
+        /* optional id range, same as -id of query */
+        valid = (words.size() == 1) || (words.size() == 2 && parseQueryOption("-id", words[1], query));
+        key = command.substr(0, 2) + " " + to_string(query.id_min) + " " + to_string(query.id_max);
+    }
+    else if (command == "STATUS" && words.size() == 1)
+    {
+        const DaemonData &data = *state.data;
+        string body = "rows," + to_string(data.columns.num_rows) + "\n"
+            + "sensors," + to_string(max(data.columns.max_id, data.summary.max_id)) + "\n"
+            + "generation," + to_string(state.generation) + "\n"
+            + "requests," + to_string(state.requests) + "\n"
+            + "cache_entries," + to_string(state.cache.entries.size()) + "\n"
+            + "cache_bytes," + to_string(state.cache.bytes) + "\n"
+            + "cache_hits," + to_string(state.cache.hits) + "\n"
+            + "cache_misses," + to_string(state.cache.misses) + "\n";
+
+        stringstream times;
+        times << fixed << setprecision(1)
+            << "hit_us," << (state.cache.hits > 0 ? state.hit_seconds * 1e6 / state.cache.hits : 0.0) << "\n"
+            << "miss_us," << (state.cache.misses > 0 ? state.miss_seconds * 1e6 / state.cache.misses : 0.0) << "\n";
+        body.append(times.str());
+
+        string answer;
+        okAnswer(answer, body);
+        output.append(answer);
+        return;
+    }
+    else if (command == "RELOAD" && words.size() == 1)
+    {
+        output.append(reloadData(state) ? "OK 0\n" : "ERR invalid input file, old data is kept\n");
+        return;
+    }
+    else
+    {
+        output.append("ERR invalid command\n");
+        return;
+    }
+
+    if (!valid)
+    {
+        output.append("ERR invalid argument\n");
+        return;
+    }
+
+    const string *cached = findCache(state.cache, key);
+    if (cached != NULL)
+    {
+        output.append(*cached);
+        state.hit_seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        return;
+    }
+
+    /* write CSV text as dust_query, dust_process would write it */
+    const DaemonData &data = *state.data;
+    string body, answer;
+    WriteBuffer out;
+    openStringBuffer(out, body, ANSWER_BUFFER_SIZE);
+    if (command == "QUERY")
+    {
+        vector<size_t> rows;
+        vector<QueryGroup> groups;
+        runQuery(data.columns, query, state.num_threads, rows, groups);
+        if (query.group == GROUP_NONE)
+            writeQueryRows(out, data.columns, rows);
+        else
+            writeQueryGroups(out, groups, query.group);
+    }
+    else if (command == "SUMMARY")
+        writeSummaryRows(out, data.summary, query.id_min, query.id_max);
+    else
+        writeStatisticsRows(out, data.statistics, query.id_min, query.id_max);
+    closeWriteBuffer(out);
+
+    okAnswer(answer, body);
+    storeCache(state.cache, key, answer);
+    output.append(answer);
+    state.miss_seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+/* Send answers waiting in connection
+* Input: connection
+* Output: false if connection is broken */
+bool sendAnswers(DaemonConnection &conn)
+{
+    while (conn.sent < conn.output.size())
+    {
+        long n = send(conn.fd, conn.output.data() + conn.sent, conn.output.size() - conn.sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        conn.sent += n;
+    }
+    conn.output.clear();
+    conn.sent = 0;
+    return true;
+}
+
+/* Read requests from connection (edge-triggered) and answer complete lines.
+Client which does not read its answers is not read either: above MAX_UNSENT
+unsent bytes reading stops, it goes on when socket is writable (EPOLLOUT)
+* Inputs: state, connection
+* Output: false if connection is closed */
+bool readRequests(DaemonState &state, DaemonConnection &conn)
+{
+    char buffer[16384];
+    while (true)
+    {
+        /* drop part which is sent, so output holds only unsent answers */
+        conn.output.erase(0, conn.sent);
+        conn.sent = 0;
+
+        size_t begin = 0, end;
+        while (conn.output.size() - conn.sent <= MAX_UNSENT && (end = conn.input.find('\n', begin)) != string::npos)
+        {
+            size_t length = end - begin;
+            if (length > 0 && conn.input[end - 1] == '\r')
+                length--;
+            answerRequest(state, conn.input.substr(begin, length), conn.output);
+            begin = end + 1;
+        }
+        conn.input.erase(0, begin);
+
+        if (!sendAnswers(conn))
+            return false;
+        if (conn.output.size() - conn.sent > MAX_UNSENT)
+            return true;                    /* socket is full, wait for EPOLLOUT */
+        if (conn.input.find('\n') != string::npos)
+            continue;
+        if (conn.input.size() > MAX_REQUEST)
+        {
+            conn.output.append("ERR request too long\n");
+            sendAnswers(conn);
+            return false;
+        }
+
+        long n = read(conn.fd, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return true;
+        if (n <= 0)
+            return false;
+        conn.input.append(buffer, n);
+    }
+}
+
+/* Answer requests until stopped, input files are checked for change every watch seconds
+* Inputs: address, state, watch time (0 if only RELOAD loads files), running time (0 if until signal)
+* Output: true (if socket can be opened) or false */
+bool runDaemon(const SocketAddress &address, DaemonState &state, int watch, int duration)
+{
+    int listen_fd = listenSocket(address);
+    if (listen_fd < 0)
+        return false;
+
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    epoll_event event;
+    event.events = EPOLLIN | EPOLLET;
+    event.data.u32 = LISTEN_SLOT;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &event);
+
+    vector<DaemonConnection*> conns;                /* connection of each slot */
+    vector<unsigned int> free_slots;
+
+    signal(SIGINT, handleSignal);
+    signal(SIGTERM, handleSignal);
+    signal(SIGPIPE, SIG_IGN);
+
+    auto start = chrono::steady_clock::now(), last_watch = start;
+    epoll_event events[MAX_EVENTS];
+    while (!stop_daemon)
+    {
+        auto now = chrono::steady_clock::now();
+        if (duration > 0 && now - start >= chrono::seconds(duration))
+            break;
+        if (watch > 0 && now - last_watch >= chrono::seconds(watch))
+        {
+            /* new data from dust_process or dust_ingest */
+            last_watch = now;
+            if (sourcesChanged(state))
+                reloadData(state);
+        }
+
+        int n = epoll_wait(epfd, events, MAX_EVENTS, 100);
+        for (int i = 0; i < n; i++)
+        {
+            unsigned int slot = events[i].data.u32;
+            if (slot == LISTEN_SLOT)
+            {
+                /* accept all waiting connections */
+                int fd;
+                while ((fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+                {
+                    DaemonConnection *conn = new DaemonConnection;
+                    conn->fd = fd;
+                    conn->sent = 0;
+
+                    unsigned int new_slot;
+                    if (free_slots.empty())
+                    {
+                        new_slot = conns.size();
+                        conns.push_back(conn);
+                    }
+                    else
+                    {
+                        new_slot = free_slots.back();
+                        free_slots.pop_back();
+                        conns[new_slot] = conn;
+                    }
+
+                    epoll_event conn_event;
+                    conn_event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+                    conn_event.data.u32 = new_slot;
+                    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &conn_event);
+                }
+                continue;
+            }
+
+            DaemonConnection *conn = conns[slot];
+            bool open = (events[i].events & (EPOLLHUP | EPOLLERR)) == 0;
+            /* writable socket also goes on with requests left when answers were waiting */
+            if (open && (events[i].events & (EPOLLIN | EPOLLOUT | EPOLLRDHUP)))
+                open = readRequests(state, *conn);
+            if (!open)
+            {
+                close(conn->fd);            /* also removed from epoll */
+                delete conn;
+                free_slots.push_back(slot);
+                conns[slot] = NULL;
+            }
+        }
+    }
+
+    for (DaemonConnection *conn : conns)
+    {
+        if (conn != NULL)
+        {
+            close(conn->fd);
+            delete conn;
+        }
+    }
+    close(epfd);
+    close(listen_fd);
+    if (address.type == SOCKET_UNIX)
+        removeSocketFile(address);
+    return true;
+}
+
+/* Send one request to daemon and print answer
+* Inputs: address, request, answer is OK or not (output)
+* Output: true (if whole answer is received) or false */
+bool sendRequest(const SocketAddress &address, const string &request, bool &answer_ok)
+{
+    answer_ok = false;
+    int fd = connectSocket(address);
+    if (fd < 0)
+        return false;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);      /* wait for answer */
+
+    string line = request + "\n", answer;
+    bool ok = writeAll(fd, line.data(), line.size());
+    size_t expected = string::npos;                 /* size of whole answer */
+    char buffer[16384];
+    while (ok && answer.size() < expected)
+    {
+        long n = read(fd, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        answer.append(buffer, n);
+
+        size_t newline = answer.find('\n');
+        if (expected == string::npos && newline != string::npos)
+            expected = (answer.compare(0, 3, "OK ") == 0) ? newline + 1 + atoll(answer.c_str() + 3) : newline + 1;
+    }
+    close(fd);
+
+    size_t newline = answer.find('\n');
+    if (newline == string::npos || answer.size() < expected)
+        return false;
+    answer_ok = (answer.compare(0, 3, "OK ") == 0);
+    cout << (answer_ok ? answer.substr(newline + 1) : answer);
+    return true;
+}
+#endif
+
+/* Main function
+* Input: command-line statement
+    dust_daemon [-listen unix:path] [-aqi file] [-summary file] [-statistics file]
+        [-cache entries] [-cache-mb size] [-watch seconds] [-t threads] [-time seconds]
+    dust_daemon -send request [-listen unix:path]
+    dust_aqi and dust_summary can be .csv or .col files (dust_process -format columnar)
+* Output:
+    answers on socket (daemon) or answer on screen (-send)
+    task7.log
+    notification (should appear if program run successfully)
+* Pre-condition: task7.log is accessible */
+int main(int argc, char *argv[])
+{
+    /* pre-condition */
+    if (!ifAccessGranted(LOG_FILE, WRITE_MODE))
+    {
+        cout << "Cannot access " << LOG_FILE << " to record error." << endl;
+        return 1;
+    }
+
+    /* check if command-line is correct */
+    if (argc % 2 == 0)
+    {
+        error(01, LOG_FILE);
+        return 1;
+    }
+
+    string listen_address = DAEMON_ADDRESS;
+    string file_names[3] = {AQI_FILE, SUMMARY_FILE, STATISTICS_FILE};
+    string request = "";
+    int cache_entries = 1024;
+    int cache_mb = 64;
+    int watch = 1;                      /* check input files every second */
+    int num_threads = thread::hardware_concurrency();
+    int duration = 0;                   /* run until stopped */
+
+    /* check if arguments are valid and get value */
+    for (int i = 1; i < argc; i += 2)
+    {
+        string str = argv[i];
+        if (str == "-listen")
+            listen_address = argv[i + 1];
+        else if (str == "-aqi")
+            file_names[0] = argv[i + 1];
+        else if (str == "-summary")
+            file_names[1] = argv[i + 1];
+        else if (str == "-statistics")
+            file_names[2] = argv[i + 1];
+        else if (str == "-send")
+            request = argv[i + 1];
+        else if (str == "-cache")
+            cache_entries = atoi(argv[i + 1]);
+        else if (str == "-cache-mb")
+            cache_mb = atoi(argv[i + 1]);
+        else if (str == "-watch")
+            watch = atoi(argv[i + 1]);
+        else if (str == "-t")
+            num_threads = atoi(argv[i + 1]);
+        else if (str == "-time")
+            duration = atoi(argv[i + 1]);
+        else
+        {
+            error(02, LOG_FILE);
+            return 1;
+        }
+    }
+
+#ifdef __linux__
+    SocketAddress address;
+    if (!parseSocketAddress(listen_address, address) || address.type == SOCKET_UDP
+        || cache_entries < 0 || cache_mb < 0 || watch < 0 || num_threads < 1 || duration < 0)
+    {
+        error(02, LOG_FILE);
+        return 1;
+    }
+
+    if (!request.empty())
+    {
+        bool answer_ok;
+        if (!sendRequest(address, request, answer_ok))
+        {
+            error(03, LOG_FILE, listen_address);
+            return 1;
+        }
+        return answer_ok ? 0 : 1;
+    }
+
+    /* load data */
+    DaemonState state;
+    for (int i = 0; i < 3; i++)
+        state.sources[i] = {file_names[i], -1, -1};
+    state.data = NULL;
+    state.generation = 0;
+    state.num_threads = num_threads;
+    state.requests = 0;
+    state.hit_seconds = state.miss_seconds = 0;
+    initCache(state.cache, cache_entries, (size_t)cache_mb << 20);
+    if (!reloadData(state))
+        return 1;
+
+    cout << "Loaded " << state.data->columns.num_rows << " hourly values. Listening on " << listen_address << endl;
+    if (!runDaemon(address, state, watch, duration))
+    {
+        error(03, LOG_FILE, listen_address);
+        closeDaemonData(state.data);
+        return 1;
+    }
+
+    cout << "Daemon stopped. Requests: " << state.requests << ", cache hits: " << state.cache.hits
+        << ", misses: " << state.cache.misses << ", loads: " << state.generation << endl;
+    closeDaemonData(state.data);
+    return 0;
+#else
+    error(02, LOG_FILE);                /* daemon needs Linux */
+    return 1;
+#endif
+}
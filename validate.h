@@ -0,0 +1,304 @@
+/***********************************************************
+* Program: validate.h
+* Purpose: Check every line of dust_sensor.csv and dust_aqi.csv format file
+    before any work, separators are found 64 bytes at a time
+************************************************************/
+
+#ifndef VALIDATE_H
+#define VALIDATE_H
+
+#include "header.h"
+#include "error.h"
+#include "aqi.h"
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VALIDATE_SSE2
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#define VALIDATE_BLOCK      64              /* bytes per separator mask */
+#define VALIDATE_READ_SIZE  (4 << 20)       /* bytes read at a time from file */
+#define MAX_FIELDS          5
+
+/* kind of field */
+#define FIELD_ID            1               /* 1 to 9 digits, not 0 */
+#define FIELD_TIME          2               /* YYYY:MM:DD hh:mm:ss */
+#define FIELD_VALUE         3               /* [-]digits[.d], as parseDustValue() */
+#define FIELD_COUNT         4               /* 1 to 9 digits */
+#define FIELD_LEVEL         5               /* level of aqiRanges or empty */
+
+/* Structure for fields of line */
+struct LineLayout
+{
+    const char *header;
+    int num_fields;
+    int fields[MAX_FIELDS];
+};
+
+const LineLayout DUST_SENSOR_LAYOUT = {"id,time,value", 3, {FIELD_ID, FIELD_TIME, FIELD_VALUE}};
+const LineLayout DUST_AQI_LAYOUT = {"id,time,value,aqi,pollution", 5,
+    {FIELD_ID, FIELD_TIME, FIELD_VALUE, FIELD_COUNT, FIELD_LEVEL}};
+
+/* Structure for state between parts of text, line may go on in next part */
+struct LineValidator
+{
+    const LineLayout *layout;
+    int field;                      /* index of current field */
+    bool line_ok;                   /* fields of current line are valid so far */
+    long long line;                 /* position of current line (first data line is 1) */
+    vector<long long> bad_lines;
+};
+
+/* Get position of lowest set bit
+* Input: mask (not 0)
+* Output: bit position */
+inline int lowestBit(uint64_t mask)
+{
+#ifdef _MSC_VER
+    unsigned long bit;
+    _BitScanForward64(&bit, mask);
+    return (int)bit;
+#else
+    return __builtin_ctzll(mask);
+#endif
+}
+
+/* Find commas and ends of line in block
+* Inputs: VALIDATE_BLOCK bytes, masks (output, bit i is byte i) */
+inline void separatorMasks(const char *block, uint64_t &commas, uint64_t &newlines)
+{
+#ifdef VALIDATE_SSE2
+    const __m128i comma = _mm_set1_epi8(','), newline = _mm_set1_epi8('\n');
+    commas = newlines = 0;
+    for (int i = 0; i < VALIDATE_BLOCK / 16; i++)
+    {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(block + 16 * i));
+        commas |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, comma)) << (16 * i);
+        newlines |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline)) << (16 * i);
+    }
+#else
+    commas = newlines = 0;
+    for (int i = 0; i < VALIDATE_BLOCK; i++)
+    {
+        commas |= (uint64_t)(block[i] == ',') << i;
+        newlines |= (uint64_t)(block[i] == '\n') << i;
+    }
+#endif
+}
+
+inline bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+/* Check if all bytes are digits
+* Inputs: text and its length */
+inline bool allDigits(const char *text, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        if (!isDigit(text[i]))
+            return false;
+    }
+    return true;
+}
+
+/* Get number of two digits */
+inline int twoDigits(const char *text)
+{
+    return (text[0] - '0') * 10 + (text[1] - '0');
+}
+
+/* Check shape and ranges of YYYY:MM:DD hh:mm:ss, same ranges as checkDateFormat()
+* Inputs: text and its length */
+inline bool checkTimeField(const char *text, size_t size)
+{
+    if (size != 19 || text[4] != ':' || text[7] != ':' || text[10] != ' ' || text[13] != ':' || text[16] != ':'
+        || !allDigits(text, 4) || !allDigits(text + 5, 2) || !allDigits(text + 8, 2)
+        || !allDigits(text + 11, 2) || !allDigits(text + 14, 2) || !allDigits(text + 17, 2))
+        return false;
+
+    int month = twoDigits(text + 5), day = twoDigits(text + 8);
+    return month >= 1 && month <= 12 && day >= 1 && day <= 31
+        && twoDigits(text + 11) <= 23 && twoDigits(text + 14) <= 59 && twoDigits(text + 17) <= 59;
+}
+
+/* Check field of line
+* Inputs: kind of field, text and its length (without end of line)
+* Output: true (if field is valid) or false */
+inline bool checkField(int kind, const char *text, size_t size)
+{
+    switch (kind)
+    {
+        case FIELD_ID:
+        {
+            if (size == 0 || size > 9 || !allDigits(text, size))
+                return false;
+            for (size_t i = 0; i < size; i++)
+            {
+                if (text[i] != '0')
+                    return true;
+            }
+            return false;
+        }
+        case FIELD_TIME:
+            return checkTimeField(text, size);
+        case FIELD_VALUE:
+        {
+            size_t pos = (size > 0 && text[0] == '-') ? 1 : 0;
+            size_t digits = 0;
+            while (pos + digits < size && isDigit(text[pos + digits]))
+                digits++;
+            pos += digits;
+            if (digits == 0 || digits > 9)
+                return false;
+            return pos == size || (pos + 2 == size && text[pos] == '.' && isDigit(text[pos + 1]));
+        }
+        case FIELD_COUNT:
+            return size > 0 && size <= 9 && allDigits(text, size);
+        case FIELD_LEVEL:
+        {
+            if (size == 0)
+                return true;
+            for (const AQIRange &range : aqiRanges)
+            {
+                if (range.level.size() == size && memcmp(range.level.data(), text, size) == 0)
+                    return true;
+            }
+            return false;
+        }
+    }
+    return false;
+}
+
+/* Set up validator of data lines
+* Inputs: validator, layout of line */
+void initLineValidator(LineValidator &validator, const LineLayout &layout)
+{
+    validator.layout = &layout;
+    validator.field = 0;
+    validator.line_ok = true;
+    validator.line = 1;
+    validator.bad_lines.clear();
+}
+
+/* Check field which ends at separator, finish line at end of line
+* Inputs: validator, field text and its length, separator is end of line or not */
+inline void endField(LineValidator &validator, const char *text, size_t size, bool end_line)
+{
+    if (end_line && size > 0 && text[size - 1] == '\r')
+        size--;                     /* line ends with CRLF */
+    if (validator.line_ok)
+    {
+        validator.line_ok = validator.field < validator.layout->num_fields
+            && checkField(validator.layout->fields[validator.field], text, size);
+    }
+    validator.field++;
+
+    if (end_line)
+    {
+        if (!validator.line_ok || validator.field != validator.layout->num_fields)
+            validator.bad_lines.push_back(validator.line);
+        validator.line++;
+        validator.field = 0;
+        validator.line_ok = true;
+    }
+}
+
+/* Check data lines in text. Text ends at end of line, except at end of file
+* Inputs: validator, text and its length, end of file or not */
+void validateLines(LineValidator &validator, const char *data, size_t size, bool last)
+{
+    size_t field_start = 0;
+    char tail[VALIDATE_BLOCK];
+    for (size_t base = 0; base < size; base += VALIDATE_BLOCK)
+    {
+        const char *block = data + base;
+        if (size - base < VALIDATE_BLOCK)
+        {
+            /* last part of text, zero bytes are not separators */
+            memset(tail, 0, VALIDATE_BLOCK);
+            memcpy(tail, block, size - base);
+            block = tail;
+        }
+
+        uint64_t commas, newlines;
+        separatorMasks(block, commas, newlines);
+        uint64_t separators = commas | newlines;
+        while (separators != 0)
+        {
+            int bit = lowestBit(separators);
+            separators &= separators - 1;
+            size_t pos = base + bit;
+            endField(validator, data + field_start, pos - field_start, ((newlines >> bit) & 1) != 0);
+            field_start = pos + 1;
+        }
+    }
+
+    /* last line of file has no end of line */
+    if (last && field_start < size)
+        endField(validator, data + field_start, size - field_start, true);
+}
+
+/* Record all bad lines in log file
+* Inputs: validator, log file
+* Output: true (if there is no bad line) or false */
+bool reportBadLines(const LineValidator &validator, const string &log_file)
+{
+    for (long long line : validator.bad_lines)
+        error(05, log_file, (int)line);
+    return validator.bad_lines.empty();
+}
+
+/* Check all data lines of text of whole file, first line is header
+* Inputs: text, layout of line, log file
+* Output: true (if all lines are valid) or false, each bad line is recorded in log file */
+bool validateText(const string &text, const LineLayout &layout, const string &log_file)
+{
+    LineValidator validator;
+    initLineValidator(validator, layout);
+    size_t begin = text.find('\n');
+    if (begin != string::npos)
+        validateLines(validator, text.data() + begin + 1, text.size() - begin - 1, true);
+    return reportBadLines(validator, log_file);
+}
+
+/* Check all data lines of file, file is read in parts of whole lines
+* Inputs: file name, layout of line, log file
+* Output: true (if all lines are valid) or false, each bad line is recorded in log file */
+bool validateFile(const string &file_name, const LineLayout &layout, const string &log_file)
+{
+    ifstream input_file(file_name, ios::binary);
+    string header;
+    getline(input_file, header);                    /* checked by if_DUST_SENSOR_file(), if_DUST_AQI_file() */
+
+    LineValidator validator;
+    initLineValidator(validator, layout);
+    vector<char> buffer(VALIDATE_READ_SIZE);
+    size_t used = 0;                                /* unfinished line of previous part */
+    while (true)
+    {
+        if (used == buffer.size())
+            buffer.resize(buffer.size() * 2);       /* line longer than buffer */
+        input_file.read(buffer.data() + used, buffer.size() - used);
+        size_t size = used + input_file.gcount();
+        bool last = !input_file;
+
+        size_t cut = size;
+        while (!last && cut > 0 && buffer[cut - 1] != '\n')
+            cut--;
+        validateLines(validator, buffer.data(), cut, last);
+        if (last)
+            break;
+        memmove(buffer.data(), buffer.data() + cut, size - cut);
+        used = size - cut;
+    }
+    return reportBadLines(validator, log_file);
+}
+
+#endif
@@ -0,0 +1,481 @@
+/***********************************************************
+* Program: writer.h
+* Purpose: Buffered writer shared by all output files
+************************************************************/
+
+#ifndef WRITER_H
+#define WRITER_H
+
+#include "header.h"
+#include "async.h"
+#include <charconv>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#include <malloc.h>
+#else
+#include <unistd.h>
+#endif
+
+#define WRITE_BUFFER_SIZE   (1 << 20)       /* 1 MiB per output file */
+#define WRITE_BUFFER_ALIGN  4096            /* block size for O_DIRECT */
+
+/* Structure for buffered output file.
+Text is formatted straight into data and written in big chunks.
+Build with -DWRITE_DIRECT_IO to bypass page cache where O_DIRECT exists.
+With background writer, full buffer is written while text goes to the other one */
+struct WriteBuffer
+{
+    int fd;                 /* output file */
+    char *data;             /* aligned buffer being filled */
+    size_t used;            /* bytes waiting in buffer */
+    size_t capacity;
+    bool direct;            /* file opened with O_DIRECT */
+    long long written;      /* bytes passed to file, position of data[0] */
+    AsyncWriter *async;     /* background writer, NULL if written on this thread */
+    char *buffers[2];       /* data is one of them */
+    atomic<int> busy[2];    /* buffer is being written */
+    string file_name;       /* final name, empty if file is written in place */
+    string temp_name;
+    string *text;           /* output string instead of file, NULL if output is file */
+    atomic<bool> failed;    /* a write failed, file is not complete (set by background writer too) */
+};
+
+/* Allocate aligned buffer
+* Input: size
+* Output: buffer, NULL if failed */
+char *allocWriteBuffer(size_t size)
+{
+#ifdef _WIN32
+    return (char*)_aligned_malloc(size, WRITE_BUFFER_ALIGN);
+#else
+    char *data;
+    if (posix_memalign((void**)&data, WRITE_BUFFER_ALIGN, size) != 0)
+        return NULL;
+    return data;
+#endif
+}
+
+void freeWriteBuffer(char *data)
+{
+#ifdef _WIN32
+    _aligned_free(data);
+#else
+    free(data);
+#endif
+}
+
+/* Write whole byte array to file, retry on partial write
+* Inputs: file descriptor, byte array and its size
+* Output: true (if success) or false */
+bool writeAll(int fd, const char *bytes, size_t size)
+{
+    while (size > 0)
+    {
+        long n = write(fd, bytes, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+/* Open output file with empty buffer
+* Inputs: buffer and file name
+* Output: true (if file can be created) or false */
+bool openWriteBuffer(WriteBuffer &out, string file_name)
+{
+    out.used = 0;
+    out.capacity = WRITE_BUFFER_SIZE;
+    out.direct = false;
+    out.written = 0;
+    out.async = NULL;
+    out.buffers[1] = NULL;
+    out.busy[0] = out.busy[1] = 0;
+    out.file_name = "";
+    out.temp_name = "";
+    out.text = NULL;
+    out.failed = false;
+
+#ifdef _WIN32
+    /* text mode keeps CRLF line ending as ofstream does */
+    out.fd = open(file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#else
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#if defined(WRITE_DIRECT_IO) && defined(O_DIRECT)
+    out.fd = open(file_name.c_str(), flags | O_DIRECT, 0644);
+    out.direct = (out.fd >= 0);
+    if (out.fd < 0)
+#endif
+        out.fd = open(file_name.c_str(), flags, 0644);
+#endif
+    out.data = out.buffers[0] = allocWriteBuffer(out.capacity);
+
+    if (out.fd < 0 || out.data == NULL)
+    {
+        if (out.fd >= 0)
+            close(out.fd);
+        out.fd = -1;
+        freeWriteBuffer(out.data);
+        out.data = out.buffers[0] = NULL;
+        return false;
+    }
+    return true;
+}
+
+/* Open output file under temporary name, it gets its name when closed,
+so readers never see half-written file
+* Inputs: buffer, file name, background writer (NULL if written on this thread)
+* Output: true (if file can be created) or false */
+bool openWriteBufferAtomic(WriteBuffer &out, string file_name, AsyncWriter *async)
+{
+    if (!openWriteBuffer(out, file_name + ".tmp"))
+        return false;
+
+    out.file_name = file_name;
+    out.temp_name = file_name + ".tmp";
+#ifndef _WIN32
+    out.buffers[1] = (async != NULL) ? allocWriteBuffer(out.capacity) : NULL;
+    if (out.buffers[1] != NULL)
+        out.async = async;
+#endif
+    return true;
+}
+
+/* Open buffer which appends text to string instead of file,
+for answers which are sent on socket or kept in memory
+* Inputs: buffer, output string, buffer size
+* Output: true (if buffer can be allocated) or false */
+bool openStringBuffer(WriteBuffer &out, string &text, size_t capacity)
+{
+    out.fd = -1;
+    out.used = 0;
+    out.capacity = capacity;
+    out.direct = false;
+    out.written = 0;
+    out.async = NULL;
+    out.buffers[1] = NULL;
+    out.busy[0] = out.busy[1] = 0;
+    out.file_name = "";
+    out.temp_name = "";
+    out.text = &text;
+    out.failed = false;
+    out.data = out.buffers[0] = allocWriteBuffer(capacity);
+    return out.data != NULL;
+}
+
+/* Write bytes as they are, Windows would change line ending to CRLF in text mode.
+For binary output file
+* Input: buffer */
+void setBinaryWriteBuffer(WriteBuffer &out)
+{
+#ifdef _WIN32
+    if (out.fd >= 0)
+        _setmode(out.fd, _O_BINARY);
+#else
+    (void)out;
+#endif
+}
+
+/* Write buffered text to file. With O_DIRECT only whole blocks are written,
+the rest is moved to beginning of buffer. Failure is kept in failed,
+so file is not given its name when closed
+* Input: buffer
+* Output: empty (or less than one block) buffer, true (if success) or false */
+bool flushWriteBuffer(WriteBuffer &out)
+{
+    if (out.text != NULL)
+    {
+        out.text->append(out.data, out.used);
+        out.written += out.used;
+        out.used = 0;
+        return true;
+    }
+
+    size_t size = out.used;
+    if (out.direct)
+        size -= size % WRITE_BUFFER_ALIGN;
+
+    bool ok = true;
+#ifndef _WIN32
+    if (out.async != NULL)
+    {
+        /* write this buffer in background, go on with the other one */
+        int current = (out.data == out.buffers[0]) ? 0 : 1;
+        char *next = out.buffers[1 - current];
+        waitWrite(*out.async, out.busy[1 - current]);
+        if (size > 0)
+            submitWrite(*out.async, out.fd, out.data, size, out.written, out.busy[current], out.failed);
+        memcpy(next, out.data + size, out.used - size);
+        out.data = next;
+    }
+    else
+#endif
+    {
+        ok = writeAll(out.fd, out.data, size);
+        memmove(out.data, out.data + size, out.used - size);
+    }
+    out.used -= size;
+    out.written += size;
+    if (!ok)
+        out.failed = true;
+    return ok;
+}
+
+/* Wait until background writes of buffer are done
+* Input: buffer */
+void waitWriteBuffer(WriteBuffer &out)
+{
+#ifndef _WIN32
+    if (out.async != NULL)
+    {
+        waitWrite(*out.async, out.busy[0]);
+        waitWrite(*out.async, out.busy[1]);
+    }
+#endif
+}
+
+/* Make sure buffer has room for next field
+* Inputs: buffer, number of bytes going to be written */
+inline void reserveWriteBuffer(WriteBuffer &out, size_t size)
+{
+    if (out.used + size > out.capacity)
+        flushWriteBuffer(out);
+}
+
+/* Write text in buffer
+* Inputs: buffer, text and its length */
+inline void writeText(WriteBuffer &out, const char *text, size_t size)
+{
+    if (size > out.capacity / 2)
+    {
+        /* too big for buffer, write directly */
+        size_t done = 0;
+        while (done < size)
+        {
+            size_t part = min(size - done, out.capacity - out.used);
+            memcpy(out.data + out.used, text + done, part);
+            out.used += part;
+            done += part;
+            if (out.used == out.capacity)
+                flushWriteBuffer(out);
+        }
+        return;
+    }
+    reserveWriteBuffer(out, size);
+    memcpy(out.data + out.used, text, size);
+    out.used += size;
+}
+
+inline void writeText(WriteBuffer &out, const string &text)
+{
+    writeText(out, text.data(), text.size());
+}
+
+inline void writeText(WriteBuffer &out, const char *text)
+{
+    writeText(out, text, strlen(text));
+}
+
+inline void writeChar(WriteBuffer &out, char c)
+{
+    reserveWriteBuffer(out, 1);
+    out.data[out.used++] = c;
+}
+
+/* Write integer in decimal
+* Inputs: buffer and integer */
+inline void writeInt(WriteBuffer &out, long long num)
+{
+    reserveWriteBuffer(out, 24);
+    char *end = to_chars(out.data + out.used, out.data + out.capacity, num).ptr;
+    out.used = end - out.data;
+}
+
+/* Write double with fixed number of digits after decimal point,
+rounding is the same as fixed << setprecision()
+* Inputs: buffer, double number and precision */
+inline void writeFixed(WriteBuffer &out, double num, int precision)
+{
+    reserveWriteBuffer(out, 400);
+    char *end = to_chars(out.data + out.used, out.data + out.capacity, num, chars_format::fixed, precision).ptr;
+    out.used = end - out.data;
+}
+
+/* Write number in 0.1 unit with one digit after decimal point
+* Inputs: buffer, number in 0.1 unit */
+inline void writeTenths(WriteBuffer &out, long long tenths)
+{
+    if (tenths < 0)
+    {
+        writeChar(out, '-');
+        tenths = -tenths;
+    }
+    writeInt(out, tenths / 10);
+    writeChar(out, '.');
+    writeChar(out, '0' + tenths % 10);
+}
+
+/* Write two decimal digits */
+inline void writeTwoDigits(char *text, int num)
+{
+    text[0] = '0' + num / 10;
+    text[1] = '0' + num % 10;
+}
+
+/* Generate date and time from time in seconds
+* Inputs: text (at least 19 characters), time in seconds
+* Output: text with format YYYY:MM:DD hh:mm:ss (no null character) */
+void formatTimestamp(char *text, time_t time_now)
+{
+    tm local;
+#ifdef _WIN32
+    localtime_s(&local, &time_now);
+#else
+    localtime_r(&time_now, &local);
+#endif
+    tm* tm_local = &local;
+    int year = tm_local->tm_year + 1900;
+
+    writeTwoDigits(text, year / 100);
+    writeTwoDigits(text + 2, year % 100);
+    text[4] = ':';
+    writeTwoDigits(text + 5, tm_local->tm_mon + 1);
+    text[7] = ':';
+    writeTwoDigits(text + 8, tm_local->tm_mday);
+    text[10] = ' ';
+    writeTwoDigits(text + 11, tm_local->tm_hour);
+    text[13] = ':';
+    writeTwoDigits(text + 14, tm_local->tm_min);
+    text[16] = ':';
+    writeTwoDigits(text + 17, tm_local->tm_sec);
+}
+
+/* Write date and time with format YYYY:MM:DD hh:mm:ss
+* Inputs: buffer, time in seconds */
+inline void writeTimestamp(WriteBuffer &out, time_t time_now)
+{
+    reserveWriteBuffer(out, 19);
+    formatTimestamp(out.data + out.used, time_now);
+    out.used += 19;
+}
+
+/* Write byte as two upper case hexa digits and a space
+* Inputs: buffer, byte */
+inline void writeHexByte(WriteBuffer &out, unsigned char byte)
+{
+    static const char HEXA_DIGITS[] = "0123456789ABCDEF";
+    reserveWriteBuffer(out, 3);
+    out.data[out.used++] = HEXA_DIGITS[byte >> 4];
+    out.data[out.used++] = HEXA_DIGITS[byte & 0x0F];
+    out.data[out.used++] = ' ';
+}
+
+/* Write rest of buffer and close file, file under temporary name
+is removed instead of renamed if any write failed
+* Input: buffer
+* Output: true (if all data is written) or false */
+bool closeWriteBuffer(WriteBuffer &out)
+{
+    if (out.text != NULL)
+    {
+        flushWriteBuffer(out);
+        freeWriteBuffer(out.buffers[0]);
+        out.data = out.buffers[0] = NULL;
+        out.text = NULL;
+        return true;
+    }
+    if (out.fd < 0)
+        return false;
+
+    flushWriteBuffer(out);
+    waitWriteBuffer(out);
+    bool ok = !out.failed;
+#if !defined(_WIN32) && defined(O_DIRECT)
+    if (out.direct && out.used > 0)
+    {
+        /* last part is not a whole block, write it without O_DIRECT */
+        fcntl(out.fd, F_SETFL, fcntl(out.fd, F_GETFL) & ~O_DIRECT);
+        ok = pwriteAll(out.fd, out.data, out.used, out.written) && ok;
+        out.written += out.used;
+        out.used = 0;
+    }
+#endif
+    close(out.fd);
+    out.fd = -1;
+
+    /* give file its name */
+    if (ok && !out.temp_name.empty())
+    {
+#ifdef _WIN32
+        remove(out.file_name.c_str());          /* rename() does not replace file */
+#endif
+        ok = (rename(out.temp_name.c_str(), out.file_name.c_str()) == 0);
+    }
+    else if (!out.temp_name.empty())
+        remove(out.temp_name.c_str());
+
+    freeWriteBuffer(out.buffers[0]);
+    freeWriteBuffer(out.buffers[1]);
+    out.data = out.buffers[0] = out.buffers[1] = NULL;
+    return ok;
+}
+
+/* Close output file without giving it its name, file under temporary name is removed.
+For output which is not complete
+* Input: buffer */
+void abortWriteBuffer(WriteBuffer &out)
+{
+    if (out.fd >= 0)
+    {
+        waitWriteBuffer(out);
+        close(out.fd);
+        out.fd = -1;
+        if (!out.temp_name.empty())
+            remove(out.temp_name.c_str());
+    }
+    freeWriteBuffer(out.buffers[0]);
+    freeWriteBuffer(out.buffers[1]);
+    out.data = out.buffers[0] = out.buffers[1] = NULL;
+}
+
+/* Overwrite text at position in file which is already written,
+used for counters in first line
+* Inputs: file name, position and text
+* Output: true (if success) or false */
+bool rewriteFileAt(string file_name, long offset, string text)
+{
+    int fd = open(file_name.c_str(), O_WRONLY);
+    if (fd < 0)
+        return false;
+
+    bool ok = (lseek(fd, offset, SEEK_SET) == offset) && writeAll(fd, text.data(), text.size());
+    close(fd);
+    return ok;
+}
+
+/* Overwrite text at position in output file which is not closed yet,
+used for counters in first line. Part still in buffer is changed in memory
+* Inputs: buffer, position and text
+* Output: true (if success) or false */
+bool patchWriteBuffer(WriteBuffer &out, long long offset, string text)
+{
+    size_t in_file = (offset < out.written) ? min(text.size(), (size_t)(out.written - offset)) : 0;
+    bool ok = true;
+    if (in_file > 0)
+    {
+        waitWriteBuffer(out);
+        ok = rewriteFileAt(out.temp_name.empty() ? out.file_name : out.temp_name, offset, text.substr(0, in_file));
+        if (!ok)
+            out.failed = true;
+    }
+    memcpy(out.data + (offset + in_file - out.written), text.data() + in_file, text.size() - in_file);
+    return ok;
+}
+
+#endif